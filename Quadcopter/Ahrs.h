@@ -0,0 +1,194 @@
+// ****************************************************************************************
+// Quaternion attitude estimator (AHRS_MAHONY)
+//    Mahony's filter in fixed point: every gyro sample turns the quaternion, the accel (at
+//    mainLoopFreq) and the compass heading (as updated by magTask) pull it back through a
+//    proportional term and an integral one, which ends up as the gyro bias
+//    unlike the complementary filter it stays right when roll, pitch and yaw move together,
+//    and the Euler angles come out of the quaternion so there is no wrap to look after
+//    the compass only corrects the heading (about the estimated up axis), like
+//    combineGyroMagHeadings, so its inclination never matters, but it is tilt compensated
+//    axes as the rest of MotionSensor.h: x forward (roll), y left (pitch), z up (yaw),
+//    the quaternion turns the body into the earth frame, outputs currentAngles (ZYX)
+//    formats: quaternion and unit vectors Q30, rates Q4 gyro counts, see quadcopter_bench
+//    for the cost per update and the error against the complementary filter
+// ****************************************************************************************
+
+const byte QUAT_FRAC_BITS = 30;
+const int32_t QUAT_ONE = 1L << QUAT_FRAC_BITS;
+const byte AHRS_RATE_FRAC_BITS = 4;   // gyro counts, for the feedback added to the gyro
+const byte AHRS_BIAS_FRAC_BITS = 16;  // gyro counts, for the integral
+const byte AHRS_GAIN_FRAC_BITS = 14;  // the errors are cut down to Q14 for the gains
+
+// radians per second per gyro count
+const float ahrsGyroRadians = gyroRes * DEG_TO_RAD;
+// gyro counts * micros to a half angle in Q30 (the quaternion derivative is half the rate), in Q(4 + 14)
+const uint32_t ahrsStepScale = (uint32_t)(ahrsGyroRadians * 0.5f * MICROS_TO_SECONDS * (float)QUAT_ONE *
+                                          (float)(1UL << (GYRO_STEP_FRAC_BITS + GYRO_INTERVAL_FRAC_BITS)) + 0.5f);
+// a unit error to Q4 gyro counts, per update for the integral
+// (a 90 degree heading error times ahrsKpMagGain is what limits the gains, ahrsKpMag 2.5 is as far as it goes at FS_SEL = 2)
+const int32_t ahrsKpGain = (int32_t)(ahrsKp / ahrsGyroRadians * (1 << AHRS_RATE_FRAC_BITS) + 0.5f);
+const int32_t ahrsKpMagGain = (int32_t)(ahrsKpMag / ahrsGyroRadians * (1 << AHRS_RATE_FRAC_BITS) + 0.5f);
+const int32_t ahrsKiGain = (int32_t)(ahrsKi / ahrsGyroRadians * (mainLoopFreq * MICROS_TO_SECONDS) *
+                                     (1L << AHRS_BIAS_FRAC_BITS) + 0.5f);
+const int32_t ahrsMaxCorrection = 32767;  // Q4 counts, 62 deg/s at FS_SEL = 2, keeps the products within 32 bits
+const int32_t ahrsMaxBias = 64L << AHRS_BIAS_FRAC_BITS;  // 2 deg/s at FS_SEL = 2
+const bam16 ahrsMaxHeadingError = 16384;  // 90 degrees
+
+int32_t ahrsQ[4] = {QUAT_ONE, 0, 0, 0};
+int32_t ahrsCorrection[3];  // Q4 counts, added to the gyro until the next correction
+int32_t ahrsBias[3];        // Q16 counts
+
+// a * b of two Q30 values up to 1, from three 16 x 16 multiplies (the low x low one is
+// under 4 lsb and left out)
+static inline int32_t mulQ30(int32_t a, int32_t b) {
+  int16_t ah = a >> 16;
+  uint16_t al = a;
+  int16_t bh = b >> 16;
+  uint16_t bl = b;
+  return (int32_t)ah * bh * 4 + (((int32_t)ah * bl) >> 14) + (((int32_t)bh * al) >> 14);
+}
+
+uint16_t isqrt32(uint32_t value) {
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+  while (bit > value) bit >>= 2;
+  while (bit) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    }
+    else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return root;
+}
+
+static inline int32_t clampLong(int32_t value, int32_t limit) {
+  if (value > limit) return limit;
+  if (value < -limit) return -limit;
+  return value;
+}
+
+// one step of Newton's method for 1 / sqrt(|q|^2), the quaternion only drifts by a few lsb per step
+void ahrsNormalise() {
+  int32_t norm = mulQ30(ahrsQ[0], ahrsQ[0]) + mulQ30(ahrsQ[1], ahrsQ[1]) +
+                 mulQ30(ahrsQ[2], ahrsQ[2]) + mulQ30(ahrsQ[3], ahrsQ[3]);
+  int32_t scale = QUAT_ONE + ((QUAT_ONE - norm) >> 1);
+  for (byte i = 0; i < 4; i++) {
+    ahrsQ[i] = mulQ30(ahrsQ[i], scale);
+  }
+}
+
+// q += q * (0, w) * dt / 2, with the gyro plus the feedback from the last correction
+void ahrsIntegrateGyro() {
+  unsigned long interval = thisReadingTime - lastReadingTime;
+  if (interval > gyroMaxInterval) interval = gyroMaxInterval;
+  int32_t step = (interval * ahrsStepScale + (1UL << (GYRO_INTERVAL_FRAC_BITS - 1))) >> GYRO_INTERVAL_FRAC_BITS;
+  // separately shifted, each product is within 32 bits but not their sum
+  int32_t hx = (((int32_t)gyX * step) >> GYRO_STEP_FRAC_BITS) +
+               ((ahrsCorrection[0] * step) >> (GYRO_STEP_FRAC_BITS + AHRS_RATE_FRAC_BITS));
+  int32_t hy = (((int32_t)gyY * step) >> GYRO_STEP_FRAC_BITS) +
+               ((ahrsCorrection[1] * step) >> (GYRO_STEP_FRAC_BITS + AHRS_RATE_FRAC_BITS));
+  int32_t hz = (((int32_t)gyZ * step) >> GYRO_STEP_FRAC_BITS) +
+               ((ahrsCorrection[2] * step) >> (GYRO_STEP_FRAC_BITS + AHRS_RATE_FRAC_BITS));
+  int32_t q0 = ahrsQ[0], q1 = ahrsQ[1], q2 = ahrsQ[2], q3 = ahrsQ[3];
+  ahrsQ[0] = q0 - mulQ30(q1, hx) - mulQ30(q2, hy) - mulQ30(q3, hz);
+  ahrsQ[1] = q1 + mulQ30(q0, hx) + mulQ30(q2, hz) - mulQ30(q3, hy);
+  ahrsQ[2] = q2 + mulQ30(q0, hy) - mulQ30(q1, hz) + mulQ30(q3, hx);
+  ahrsQ[3] = q3 + mulQ30(q0, hz) + mulQ30(q1, hy) - mulQ30(q2, hx);
+  ahrsNormalise();
+}
+
+// the errors are rotations (Q30, sine of the angle along each body axis) that the feedback turns through
+void ahrsCorrect() {
+  int32_t q0 = ahrsQ[0], q1 = ahrsQ[1], q2 = ahrsQ[2], q3 = ahrsQ[3];
+  // up as the quaternion sees it in the body frame (the bottom row of the matrix), Q15
+  int32_t vx = (mulQ30(q1, q3) - mulQ30(q0, q2)) >> 14;
+  int32_t vy = (mulQ30(q0, q1) + mulQ30(q2, q3)) >> 14;
+  int32_t vz = (mulQ30(q0, q0) - mulQ30(q1, q1) - mulQ30(q2, q2) + mulQ30(q3, q3)) >> 15;
+  int32_t error[3] = {0, 0, 0};
+
+  // up as the accel sees it, Q15, x flipped back (applyAccelOffsets turns it round for the angles)
+  int32_t ax = -(accXAveFixed >> ACCEL_AVE_FRAC_BITS);
+  int32_t ay = accYAveFixed >> ACCEL_AVE_FRAC_BITS;
+  int32_t az = accZAveFixed >> ACCEL_AVE_FRAC_BITS;
+  uint16_t norm = isqrt32((uint32_t)(ax * ax) + (uint32_t)(ay * ay) + (uint32_t)(az * az));
+  if (norm != 0) {
+    int32_t inverse = (1L << 27) / norm;  // no component is longer than the norm, so the products stay within Q27
+    ax = (ax * inverse) >> 12;
+    ay = (ay * inverse) >> 12;
+    az = (az * inverse) >> 12;
+    // measured x estimated, its length is the sine of the angle between them
+    error[0] = ay * vz - az * vy;
+    error[1] = az * vx - ax * vz;
+    error[2] = ax * vy - ay * vx;
+  }
+
+  // the compass field turned into the earth frame by the quaternion (so tilt compensated, this assumes
+  // the HMC5883L z axis is up like the others), its heading there is what the estimate is out by
+  // the matrix rows are halved to stay within Q30, Q14 times the counts then
+  int32_t r00 = (QUAT_ONE >> 1) - mulQ30(q2, q2) - mulQ30(q3, q3);
+  int32_t r01 = mulQ30(q1, q2) - mulQ30(q0, q3);
+  int32_t r02 = mulQ30(q1, q3) + mulQ30(q0, q2);
+  int32_t r10 = mulQ30(q1, q2) + mulQ30(q0, q3);
+  int32_t r11 = (QUAT_ONE >> 1) - mulQ30(q1, q1) - mulQ30(q3, q3);
+  int32_t r12 = mulQ30(q2, q3) - mulQ30(q0, q1);
+  int earthX = ((r00 >> 15) * (int32_t)mx + (r01 >> 15) * (int32_t)my + (r02 >> 15) * (int32_t)mz) >> 12;
+  int earthY = ((r10 >> 15) * (int32_t)mx + (r11 >> 15) * (int32_t)my + (r12 >> 15) * (int32_t)mz) >> 12;
+  // as magCalculateHeading and headingAdjustment, clamped so the products below keep within 32 bits
+  bam16 headingError = bamDifference(-atan2Bam(earthY, earthX), yawOffsetAngle);
+  if (headingError > ahrsMaxHeadingError) headingError = ahrsMaxHeadingError;
+  if (headingError < -ahrsMaxHeadingError) headingError = -ahrsMaxHeadingError;
+  int32_t headingRadians = ((int32_t)headingError * 25736) >> 13;  // pi in Q13, Q15 radians out
+  // turned about the estimated up axis
+  int32_t magError[3] = {headingRadians * vx, headingRadians * vy, headingRadians * vz};
+
+  for (byte i = 0; i < 3; i++) {
+    int32_t e = error[i] >> (QUAT_FRAC_BITS - AHRS_GAIN_FRAC_BITS);
+    int32_t m = magError[i] >> (QUAT_FRAC_BITS - AHRS_GAIN_FRAC_BITS);
+    ahrsBias[i] = clampLong(ahrsBias[i] + (((e + m) * ahrsKiGain) >> AHRS_GAIN_FRAC_BITS), ahrsMaxBias);
+    int32_t correction = ((e * ahrsKpGain) >> AHRS_GAIN_FRAC_BITS) + ((m * ahrsKpMagGain) >> AHRS_GAIN_FRAC_BITS) +
+                         (ahrsBias[i] >> (AHRS_BIAS_FRAC_BITS - AHRS_RATE_FRAC_BITS));
+    ahrsCorrection[i] = clampLong(correction, ahrsMaxCorrection);
+  }
+}
+
+// ZYX Euler angles of the quaternion, less the sensor mounting offsets (as applyAngleOffsets)
+void ahrsUpdateAngles() {
+  int32_t q0 = ahrsQ[0], q1 = ahrsQ[1], q2 = ahrsQ[2], q3 = ahrsQ[3];
+  int32_t q22 = mulQ30(q2, q2);
+  // atan2 takes int, so Q14, halved before the factor of 2 (in the shift) so +/-1 fits
+  int rollY = (mulQ30(q0, q1) + mulQ30(q2, q3)) >> 15;
+  int rollX = ((QUAT_ONE >> 1) - mulQ30(q1, q1) - q22) >> 15;
+  int yawY = (mulQ30(q0, q3) + mulQ30(q1, q2)) >> 15;
+  int yawX = ((QUAT_ONE >> 1) - q22 - mulQ30(q3, q3)) >> 15;
+  // asin as atan2 of the sine and the cosine, Q30 then Q15
+  int32_t sinPitch = clampLong(2 * (mulQ30(q0, q2) - mulQ30(q3, q1)), QUAT_ONE);
+  uint16_t cosPitch = isqrt32(QUAT_ONE - mulQ30(sinPitch, sinPitch));
+  int pitchY = clampLong(sinPitch >> 15, 32767);
+  int pitchX = cosPitch > 32767 ? 32767 : cosPitch;
+  currentAngles.roll = bamDifference32(bam16ToBam32(atan2Bam(rollY, rollX)), offsetAngleBam[0]);
+  currentAngles.pitch = bamDifference32(bam16ToBam32(atan2Bam(pitchY, pitchX)), offsetAngleBam[1]);
+  currentAngles.yaw = bam16ToBam32(atan2Bam(yawY, yawX));
+}
+
+// from Euler angles (setup only, so float), the mounting offsets are added back and the feedback cleared
+void ahrsSetAngles(struct angle *angles) {
+  float halfRoll = bam32ToDegrees(bamAdd32(angles->roll, offsetAngleBam[0])) * (0.5f * DEG_TO_RAD);
+  float halfPitch = bam32ToDegrees(bamAdd32(angles->pitch, offsetAngleBam[1])) * (0.5f * DEG_TO_RAD);
+  float halfYaw = bam32ToDegrees(angles->yaw) * (0.5f * DEG_TO_RAD);
+  float cr = cos(halfRoll), sr = sin(halfRoll);
+  float cp = cos(halfPitch), sp = sin(halfPitch);
+  float cy = cos(halfYaw), sy = sin(halfYaw);
+  ahrsQ[0] = (int32_t)((cr * cp * cy + sr * sp * sy) * QUAT_ONE);
+  ahrsQ[1] = (int32_t)((sr * cp * cy - cr * sp * sy) * QUAT_ONE);
+  ahrsQ[2] = (int32_t)((cr * sp * cy + sr * cp * sy) * QUAT_ONE);
+  ahrsQ[3] = (int32_t)((cr * cp * sy - sr * sp * cy) * QUAT_ONE);
+  ahrsNormalise();
+  for (byte i = 0; i < 3; i++) {
+    ahrsCorrection[i] = 0;
+    ahrsBias[i] = 0;
+  }
+}
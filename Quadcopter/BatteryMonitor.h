@@ -14,6 +14,8 @@ const int dividerMinReading = 593;  // 593 minimum that the battery should ever
 const int dividerRange = dividerMaxReading - dividerMinReading;
 int dividerReading = 0;
 int batteryLevel = 0;
+const byte batteryWarmUpReadings = 30;  // for the filter to get near the real voltage
+byte batteryReadings = 0;
 
 void calculateBatteryLevel() {
   int tmp = analogRead(pinBatteryMonitor);
@@ -27,7 +29,13 @@ void setupBatteryMonitor() {
   pinMode(pinBatteryMonitor, INPUT);
   ADCSRA &= ~(bit (ADPS0) | bit (ADPS1) | bit (ADPS2)); // clear prescaler bits
   ADCSRA |= bit (ADPS2);  // set ADC prescaler to 16 (from default 128)
-  for (byte i = 0; i < 30; i++) {
-    calculateBatteryLevel();
-  }
+  batteryReadings = 0;
+}
+
+// one reading per call while the rest of setup carries on, true once the level is worth reporting
+bool batteryWarmUpStep() {
+  if (batteryReadings >= batteryWarmUpReadings) return true;
+  calculateBatteryLevel();
+  batteryReadings++;
+  return false;
 }
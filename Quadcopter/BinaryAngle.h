@@ -0,0 +1,57 @@
+// ****************************************************************************************
+// Binary angles (BAM)
+//    a whole turn is 2^16 (bam16) or 2^32 (bam32), so integer overflow is the +/-180 wrap:
+//    a - b is the shortest signed turn from b to a and no +/-360 corrections are needed
+//    bam16 resolves 0.0055 degrees, bam32 is the same angle with 16 more fraction bits for
+//    state that integrates small steps (the gyro at 800Hz)
+// ****************************************************************************************
+
+typedef int16_t bam16;
+typedef int32_t bam32;
+
+const long BAM16_UNITS_PER_TURN = 65536L;
+const float BAM16_PER_DEGREE = 65536.0f / 360.0f;
+const float DEGREES_PER_BAM16 = 360.0f / 65536.0f;
+const float BAM32_PER_DEGREE = 65536.0f * 65536.0f / 360.0f;
+const float DEGREES_PER_BAM32 = 360.0f / (65536.0f * 65536.0f);
+
+// the casts through unsigned make the wrap well defined
+static inline bam16 bamDifference(bam16 a, bam16 b) {
+  return (bam16)(uint16_t)((uint16_t)a - (uint16_t)b);
+}
+
+static inline bam32 bamDifference32(bam32 a, bam32 b) {
+  return (bam32)((uint32_t)a - (uint32_t)b);
+}
+
+static inline bam32 bamAdd32(bam32 angle, int32_t turn) {
+  return (bam32)((uint32_t)angle + (uint32_t)turn);
+}
+
+static inline bam16 bam32ToBam16(bam32 angle) {
+  return (bam16)(angle >> 16);
+}
+
+static inline bam32 bam16ToBam32(bam16 angle) {
+  return (bam32)((uint32_t)(uint16_t)angle << 16);
+}
+
+// any number of turns, the extra ones wrap away
+static inline bam16 degreesToBam(float degrees) {
+  return (bam16)(uint16_t)(int32_t)(degrees * BAM16_PER_DEGREE);
+}
+
+// folds once first, since +180 itself is already beyond int32 (setup and hand-overs only)
+static inline bam32 degreesToBam32(float degrees) {
+  if (degrees >= 180.0f) degrees -= 360.0f;
+  else if (degrees < -180.0f) degrees += 360.0f;
+  return (bam32)(degrees * BAM32_PER_DEGREE);
+}
+
+static inline float bamToDegrees(bam16 angle) {
+  return angle * DEGREES_PER_BAM16;
+}
+
+static inline float bam32ToDegrees(bam32 angle) {
+  return angle * DEGREES_PER_BAM32;
+}
@@ -0,0 +1,183 @@
+// ****************************************************************************************
+// Blackbox flight recorder on serial flash (SpiFlash.h)
+//    each record holds BLACKBOX_FIELDS small integers (listed in blackboxLog) plus the time
+//    intra frames ('I') store them whole, the frames in between ('P') store the difference
+//    to the previous record, both as zigzag varints so most fields take a single byte
+//    frames are packed into 64 byte chunks of [used length][data], the first chunk of a log
+//    flagged in the length byte since the tail of the previous flight may have been lost with
+//    the power; one chunk fills while the
+//    other is programmed, and a record that does not fit is dropped (the next one is then an
+//    intra frame) so blackboxLog never waits for the flash
+//    a log starts with a header frame ('H'), logs follow each other until the flash is full
+//    read back on the host with blackbox_decode (tools/BlackboxDecode.cpp)
+// ****************************************************************************************
+
+const byte BLACKBOX_VERSION = 1;
+const byte BLACKBOX_FIELDS = 25;
+const byte BLACKBOX_CHUNK_SIZE = 64;  // divides the flash page, so a chunk never crosses one
+const byte BLACKBOX_CHUNK_DATA = BLACKBOX_CHUNK_SIZE - 1;
+const byte BLACKBOX_CHUNK_LOG_START = 0x40;  // flag in the length byte
+const byte BLACKBOX_INTRA_INTERVAL = 32;  // records
+const byte BLACKBOX_FRAME_HEADER = 'H';
+const byte BLACKBOX_FRAME_INTRA = 'I';
+const byte BLACKBOX_FRAME_PREDICTED = 'P';
+const byte BLACKBOX_MAX_FRAME = 1 + 5 + BLACKBOX_FIELDS * 3;  // int16 deltas need at most 3 varint bytes
+
+byte blackboxChunk[2][BLACKBOX_CHUNK_SIZE];
+byte blackboxActive = 0;        // chunk being filled
+byte blackboxFill = 0;          // data bytes in the active chunk
+bool blackboxPending = false;   // the other chunk is full and waiting for the flash
+unsigned long blackboxAddress = 0;  // next free chunk in flash
+bool blackboxEnabled = false;
+bool blackboxLogStart = false;  // the active chunk is the first of this log
+
+int16_t blackboxPrevious[BLACKBOX_FIELDS];
+unsigned long blackboxPreviousTime = 0;
+byte blackboxSinceIntra = BLACKBOX_INTRA_INTERVAL;  // first record is an intra frame
+unsigned long blackboxRecords = 0;
+unsigned long blackboxDropped = 0;
+
+byte blackboxFrame[BLACKBOX_MAX_FRAME];
+byte blackboxFrameLength;
+
+static inline void blackboxPutVarint(uint32_t value) {
+  while (value >= 0x80) {
+    blackboxFrame[blackboxFrameLength++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  blackboxFrame[blackboxFrameLength++] = value;
+}
+
+static inline void blackboxPutSigned(int32_t value) {
+  blackboxPutVarint(((uint32_t)value << 1) ^ (uint32_t)(value >> 31));  // zigzag
+}
+
+// a full active chunk is handed to the flash as soon as the other one is free again
+static inline void blackboxSwapChunks() {
+  blackboxChunk[blackboxActive][0] = blackboxFill | (blackboxLogStart ? BLACKBOX_CHUNK_LOG_START : 0);
+  blackboxLogStart = false;
+  blackboxPending = true;
+  blackboxActive ^= 1;
+  blackboxFill = 0;
+}
+
+// copies the frame into the chunks, false if it would not fit
+static bool blackboxAppendFrame() {
+  byte room = BLACKBOX_CHUNK_DATA - blackboxFill;
+  if (!blackboxPending) room += BLACKBOX_CHUNK_DATA;
+  if (blackboxFrameLength > room) return false;
+  for (byte i = 0; i < blackboxFrameLength; i++) {
+    if (blackboxFill == BLACKBOX_CHUNK_DATA) blackboxSwapChunks();
+    blackboxChunk[blackboxActive][1 + blackboxFill++] = blackboxFrame[i];
+  }
+  if (blackboxFill == BLACKBOX_CHUNK_DATA && !blackboxPending) blackboxSwapChunks();
+  return true;
+}
+
+// in setup: finds the flash and, with BLACKBOX_ERASE_ON_BOOT, starts the erase, which takes
+// seconds; armingStep waits for blackboxReady() while everything else carries on
+bool setupBlackbox() {
+  if (!setupFlash()) return false;
+#ifdef BLACKBOX_ERASE_ON_BOOT
+  flashEraseChip();
+#endif
+  return true;
+}
+
+// true once the flash can be read, or when there is none
+bool blackboxReady() {
+  return flashSize == 0 || !flashBusy();
+}
+
+// at arming: finds the end of the previous logs and starts a new one, false if there is no
+// flash (or it is full)
+bool startBlackboxLog() {
+  if (flashSize == 0) return false;
+  // chunks are written in order from 0, so the first unwritten one (length byte still 0xFF) is found by bisection
+  unsigned long low = 0;
+  unsigned long high = flashSize / BLACKBOX_CHUNK_SIZE;
+  while (low < high) {
+    unsigned long middle = (low + high) / 2;
+    byte length;
+    flashRead(middle * BLACKBOX_CHUNK_SIZE, &length, 1);
+    if (length == 0xFF) high = middle;
+    else low = middle + 1;
+  }
+  blackboxAddress = low * BLACKBOX_CHUNK_SIZE;
+  if (blackboxAddress >= flashSize) return false;
+  blackboxLogStart = true;
+  blackboxFrameLength = 0;
+  blackboxFrame[blackboxFrameLength++] = BLACKBOX_FRAME_HEADER;
+  blackboxFrame[blackboxFrameLength++] = BLACKBOX_VERSION;
+  blackboxFrame[blackboxFrameLength++] = BLACKBOX_FIELDS;
+  blackboxPutVarint(blackboxPeriod);
+  blackboxAppendFrame();
+  blackboxEnabled = true;
+  return true;
+}
+
+// one record, status carries what the firmware headers cannot see (state and mode from the .ino)
+void blackboxLog(byte status) {
+  if (!blackboxEnabled) return;
+  int16_t fields[BLACKBOX_FIELDS] = {
+    gyX, gyY, gyZ,
+    pidValueToFixed(bam32ToDegrees(currentAngles.roll)), pidValueToFixed(bam32ToDegrees(currentAngles.pitch)),
+    pidValueToFixed(bam32ToDegrees(currentAngles.yaw)),
+    pidValueToFixed(ratePid.target[ROLL]), pidValueToFixed(ratePid.target[PITCH]), pidValueToFixed(ratePid.target[YAW]),
+    pidValueToFixed(ratePid.actual[ROLL]), pidValueToFixed(ratePid.actual[PITCH]), pidValueToFixed(ratePid.actual[YAW]),
+    pidValueToFixed(ratePid.output[ROLL]), pidValueToFixed(ratePid.output[PITCH]), pidValueToFixed(ratePid.output[YAW]),
+    (int16_t)motorPulse[0], (int16_t)motorPulse[1], (int16_t)motorPulse[2], (int16_t)motorPulse[3],
+    rcPackage.throttle, rcPackage.roll, rcPackage.pitch, rcPackage.yaw, rcPackage.control,
+    status
+  };
+  unsigned long now = micros();
+  bool intra = blackboxSinceIntra >= BLACKBOX_INTRA_INTERVAL;
+  blackboxFrameLength = 0;
+  if (intra) {
+    blackboxFrame[blackboxFrameLength++] = BLACKBOX_FRAME_INTRA;
+    blackboxPutVarint(now);
+    for (byte i = 0; i < BLACKBOX_FIELDS; i++) blackboxPutSigned(fields[i]);
+  }
+  else {
+    blackboxFrame[blackboxFrameLength++] = BLACKBOX_FRAME_PREDICTED;
+    blackboxPutVarint(now - blackboxPreviousTime);
+    for (byte i = 0; i < BLACKBOX_FIELDS; i++) blackboxPutSigned((int32_t)fields[i] - blackboxPrevious[i]);
+  }
+  if (!blackboxAppendFrame()) {
+    blackboxDropped++;
+    blackboxSinceIntra = BLACKBOX_INTRA_INTERVAL;  // the decoder has lost the reference
+    return;
+  }
+  memcpy(blackboxPrevious, fields, sizeof(fields));
+  blackboxPreviousTime = now;
+  blackboxSinceIntra = intra ? 1 : blackboxSinceIntra + 1;
+  blackboxRecords++;
+}
+
+// programs the waiting chunk if the flash is free, at most one chunk (~70us of SPI) per call
+bool blackboxFlush() {
+  if (!blackboxEnabled || !blackboxPending || flashBusy()) return false;
+  flashProgram(blackboxAddress, blackboxChunk[blackboxActive ^ 1], BLACKBOX_CHUNK_SIZE);
+  blackboxPending = false;
+  blackboxAddress += BLACKBOX_CHUNK_SIZE;
+  if (blackboxAddress >= flashSize) blackboxEnabled = false;  // full, keep the flights already on it
+  else if (blackboxFill == BLACKBOX_CHUNK_DATA) blackboxSwapChunks();
+  return true;
+}
+
+// blocking (a few ms at worst): programs the waiting chunk and the part filled one, padded, and
+// stops logging; on disarm and before the failsafe halts, the last records are the ones wanted
+void blackboxFinish() {
+  while (blackboxEnabled && blackboxPending) {
+    while (flashBusy());
+    blackboxFlush();
+  }
+  if (blackboxEnabled && blackboxFill > 0) {
+    memset(&blackboxChunk[blackboxActive][1 + blackboxFill], 0xFF, BLACKBOX_CHUNK_DATA - blackboxFill);
+    blackboxSwapChunks();
+    while (flashBusy());
+    blackboxFlush();
+  }
+  while (flashBusy());  // done before the caller halts or the power goes
+  blackboxEnabled = false;
+}
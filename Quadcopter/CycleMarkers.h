@@ -0,0 +1,20 @@
+// ****************************************************************************************
+// Stage markers for the simavr cycle benchmark (simbench/)
+//    only compiled in when the image is built with -DCYCLE_BENCH, otherwise they are empty
+//    each marker is a single OUT to GPIOR0, which the simulator watches to timestamp stages
+// ****************************************************************************************
+
+const byte CYCLE_STAGE_GYRO = 1;      // processGyroData (the read itself runs in the TWI interrupt)
+const byte CYCLE_STAGE_MAIN = 2;      // 200Hz block: accel processing, fusion, attitude PIDs (and rate loop if not split)
+const byte CYCLE_STAGE_MAG_FUSION = 3;  // combineGyroMagHeadings
+const byte CYCLE_STAGE_ESC_ISR = 4;   // generate_esc_pulses
+const byte CYCLE_STAGE_RATE = 5;      // rate PIDs + processMotors
+const byte CYCLE_STAGE_END_FLAG = 0x80;
+
+#ifdef CYCLE_BENCH
+#define CYCLE_MARK_BEGIN(stage) (GPIOR0 = (stage))
+#define CYCLE_MARK_END(stage) (GPIOR0 = (stage) | CYCLE_STAGE_END_FLAG)
+#else
+#define CYCLE_MARK_BEGIN(stage)
+#define CYCLE_MARK_END(stage)
+#endif
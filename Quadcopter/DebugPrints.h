@@ -1,47 +1,47 @@
 void printAllAngles() {
-  Serial.print(currentAngles.roll); Serial.print('\t');
-  Serial.print(currentAngles.pitch); Serial.print('\t');
-  Serial.print(currentAngles.yaw); Serial.print('\n');
+  Serial.print(bam32ToDegrees(currentAngles.roll)); Serial.print('\t');
+  Serial.print(bam32ToDegrees(currentAngles.pitch)); Serial.print('\t');
+  Serial.print(bam32ToDegrees(currentAngles.yaw)); Serial.print('\n');
 }
 
 void printAnglesAllSourcesRoll() {
-  Serial.print(currentAngles.roll); Serial.print('\t');
-  Serial.print(accelAngles.roll); Serial.print('\t');
-  Serial.print(gyroAngles.roll); Serial.print('\n');
+  Serial.print(bam32ToDegrees(currentAngles.roll)); Serial.print('\t');
+  Serial.print(bam32ToDegrees(accelAngles.roll)); Serial.print('\t');
+  Serial.print(bam32ToDegrees(gyroAngles.roll)); Serial.print('\n');
 }
 
 void printAnglesAllSourcesPitch() {
-  Serial.print(currentAngles.pitch); Serial.print('\t');
-  Serial.print(accelAngles.pitch); Serial.print('\t');
-  Serial.print(gyroAngles.pitch); Serial.print('\n');
+  Serial.print(bam32ToDegrees(currentAngles.pitch)); Serial.print('\t');
+  Serial.print(bam32ToDegrees(accelAngles.pitch)); Serial.print('\t');
+  Serial.print(bam32ToDegrees(gyroAngles.pitch)); Serial.print('\n');
 }
 
 void printMotorPulsesBlock() {
-  Serial.print(motor1pulse); Serial.print('\t');
-  Serial.print(motor2pulse); Serial.print('\n');
-  Serial.print(motor3pulse); Serial.print('\t');
-  Serial.print(motor4pulse); Serial.print('\n');
+  Serial.print(motorPulse[0]); Serial.print('\t');
+  Serial.print(motorPulse[1]); Serial.print('\n');
+  Serial.print(motorPulse[2]); Serial.print('\t');
+  Serial.print(motorPulse[3]); Serial.print('\n');
   Serial.print('\n');
 }
 void printMotorPulsesLine() {
-  Serial.print(motor1pulse); Serial.print('\t');
-  Serial.print(motor2pulse); Serial.print('\t');
-  Serial.print(motor3pulse); Serial.print('\t');
-  Serial.print(motor4pulse); Serial.print('\n');
+  Serial.print(motorPulse[0]); Serial.print('\t');
+  Serial.print(motorPulse[1]); Serial.print('\t');
+  Serial.print(motorPulse[2]); Serial.print('\t');
+  Serial.print(motorPulse[3]); Serial.print('\n');
 }
 
 void printRatePIDOutputs() {
-  Serial.print(rateRollSettings.output); Serial.print('\t');
-  Serial.print(ratePitchSettings.output); Serial.print('\t');
-  Serial.print(rateYawSettings.output); Serial.print('\n');
+  Serial.print(ratePid.output[ROLL]); Serial.print('\t');
+  Serial.print(ratePid.output[PITCH]); Serial.print('\t');
+  Serial.print(ratePid.output[YAW]); Serial.print('\n');
 }
 
 
 void printPidInfoPitch() {
   // plot the actual error as well?
-  Serial.print(attitudePitchSettings.actual); Serial.print('\t');
-  Serial.print(attitudePitchSettings.target); Serial.print('\t');
-  Serial.print(attitudePitchSettings.output); Serial.print('\n');
+  Serial.print(attitudePid.actual[PITCH]); Serial.print('\t');
+  Serial.print(attitudePid.target[PITCH]); Serial.print('\t');
+  Serial.print(attitudePid.output[PITCH]); Serial.print('\n');
 }
 
 
@@ -49,3 +49,18 @@ void printPidInfoPitch() {
 
 
 
+
+// one line per task in registration order: runs, overruns, skipped, worst exec / jitter / response (us)
+void printTaskStatistics() {
+  Serial.print(schedulerPasses); Serial.print('\n');
+  for (byte i = 0; i < numTasks; i++) {
+    struct taskStatistics *s = &tasks[i].stats;
+    Serial.print(i); Serial.print('\t');
+    Serial.print(s->runs); Serial.print('\t');
+    Serial.print(s->overruns); Serial.print('\t');
+    Serial.print(s->skipped); Serial.print('\t');
+    Serial.print(s->maxExec); Serial.print('\t');
+    Serial.print(s->maxJitter); Serial.print('\t');
+    Serial.print(s->maxResponse); Serial.print('\n');
+  }
+}
@@ -0,0 +1,67 @@
+// ****************************************************************************************
+// Lock free handoff of a block of data from loop() to an interrupt (or back)
+//    a triple buffer for one producer and one consumer: each side owns one slot, the third
+//    (the last published) sits in a shared state byte with a fresh flag, and either side
+//    trades its slot for that one in a single exchange of the byte
+//    neither side waits, the consumer never sees a half written slot and never has to skip
+//    one (it just gets the latest), and the producer can publish as often as it wants, the
+//    slots in between are dropped
+//    the slots are used in place, a taken slot stays put until the next take()
+//    three copies of T, so it is meant for small blocks (a pulse schedule, a sensor sample, a
+//    radio packet)
+// ****************************************************************************************
+
+// the exchange is the only shared access, so it is all that has to be atomic and ordered
+// against the slot accesses: the AVR has no exchange instruction, so interrupts go off for
+// the three cycles it takes (they already are in an ISR); the host build has the stress check
+// run the consumer on another CPU, which needs the real thing
+#ifdef __AVR__
+static inline uint8_t handoffExchange(volatile uint8_t *state, uint8_t value) {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint8_t old = *state;
+  *state = value;
+  SREG = oldSREG;
+  return old;
+}
+#define HANDOFF_BARRIER() asm volatile("" ::: "memory")
+#else
+static inline uint8_t handoffExchange(volatile uint8_t *state, uint8_t value) {
+  return __atomic_exchange_n(state, value, __ATOMIC_ACQ_REL);
+}
+#define HANDOFF_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+const uint8_t HANDOFF_FRESH = 0x04;  // in Handoff.state, set by publish(), cleared by take()
+
+template <typename T>
+struct Handoff {
+  T slots[3];
+  volatile uint8_t state = 1;  // bits 0/1: the last slot published, HANDOFF_FRESH: not taken yet
+  uint8_t reading = 0;         // slot the consumer holds, consumer only
+  uint8_t writing = 2;         // slot being filled, producer only
+
+  // PRODUCER
+  T &startWrite() {
+    return slots[writing];
+  }
+
+  void publish() {
+    writing = handoffExchange(&state, writing | HANDOFF_FRESH) & 3;
+  }
+
+  // CONSUMER
+  bool fresh() const {
+    return state & HANDOFF_FRESH;
+  }
+
+  // the newest published slot, or the same one again when nothing new has been published
+  const T &take() {
+    if (state & HANDOFF_FRESH) reading = handoffExchange(&state, reading) & 3;
+    return slots[reading];
+  }
+
+  const T &current() const {
+    return slots[reading];
+  }
+};
@@ -0,0 +1,198 @@
+// ****************************************************************************************
+// Interrupt driven, non-blocking I2C reads (and short register writes)
+//    requests (device, register, length, destination buffer) are queued from loop() and
+//    clocked through the TWI peripheral by the TWI interrupt, so the CPU is free while the
+//    bytes arrive; loop() checks the request status to see when the data is ready
+//    the blocking I2c library is still used during setup - the two must not overlap,
+//    which is guaranteed as long as nothing is queued here before setup has finished
+// ****************************************************************************************
+
+// request status
+const byte I2C_IDLE = 0;      // free to queue
+const byte I2C_QUEUED = 1;    // waiting for or in transfer
+const byte I2C_DONE = 2;      // destination buffer holds fresh data
+const byte I2C_ERROR = 3;     // NACK, arbitration lost or bus error
+const byte I2C_TIMEOUT = 4;   // no progress for I2C_ASYNC_TIMEOUT
+
+const byte I2C_QUEUE_SIZE = 4;
+const unsigned long I2C_ASYNC_TIMEOUT = 2000;  // MICROseconds, a 14 byte read takes ~400us at 400kHz
+
+// TWI status codes (TWSR with prescaler bits masked), see util/twi.h
+const byte TWI_START = 0x08;
+const byte TWI_REP_START = 0x10;
+const byte TWI_MT_SLA_ACK = 0x18;
+const byte TWI_MT_DATA_ACK = 0x28;
+const byte TWI_MR_SLA_ACK = 0x40;
+const byte TWI_MR_DATA_ACK = 0x50;
+const byte TWI_MR_DATA_NACK = 0x58;
+const byte TWI_STATUS_MASK = 0xF8;
+
+// TWCR values for each bus action, interrupt enabled while a transfer is running
+const byte TWCR_START = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE);
+const byte TWCR_CONTINUE = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+const byte TWCR_ACK = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE);
+const byte TWCR_STOP = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN);
+const byte TWCR_STOP_START = _BV(TWINT) | _BV(TWSTO) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE);
+
+struct i2cRequest {
+  byte address;
+  byte sensorRegister;
+  byte length;
+  byte *destination;       // source of the data for writes
+  volatile byte status;
+  unsigned long queuedAt;  // micros() when queued
+  uint16_t latency;        // MICROseconds from queued to done
+  bool isWrite;
+};
+
+struct i2cStatistics {
+  unsigned long completed;
+  unsigned long errors;     // failed transfers, async and blocking
+  unsigned long timeouts;
+  unsigned long queueFull;
+  uint16_t lastLatency;     // MICROseconds
+  uint16_t maxLatency;      // MICROseconds
+};
+
+struct i2cStatistics i2cStats;
+
+i2cRequest *i2cQueue[I2C_QUEUE_SIZE];
+volatile byte i2cQueueHead = 0;
+volatile byte i2cQueueCount = 0;
+volatile byte i2cByteIndex = 0;
+volatile unsigned long i2cTransferStart = 0;  // for the timeout
+
+// interrupts must be off when this is called
+static inline void i2cStartNextTransfer(byte control) {
+  i2cByteIndex = 0;
+  i2cTransferStart = micros();
+  TWCR = control;
+}
+
+// interrupts must be off when this is called
+static void i2cFinishTransfer(byte status) {
+  i2cRequest *request = i2cQueue[i2cQueueHead];
+  uint16_t latency = (uint16_t)(micros() - request->queuedAt);
+  request->latency = latency;
+  request->status = status;
+  if (status == I2C_DONE) {
+    i2cStats.completed++;
+    i2cStats.lastLatency = latency;
+    if (latency > i2cStats.maxLatency) i2cStats.maxLatency = latency;
+  }
+  else if (status == I2C_TIMEOUT) {
+    i2cStats.timeouts++;
+  }
+  else {
+    i2cStats.errors++;
+  }
+  i2cQueueHead = (i2cQueueHead + 1) % I2C_QUEUE_SIZE;
+  i2cQueueCount--;
+  if (i2cQueueCount > 0) {
+    i2cStartNextTransfer(TWCR_STOP_START);  // stop, then start the next request straight away
+  }
+  else {
+    TWCR = TWCR_STOP;
+  }
+}
+
+ISR(TWI_vect) {
+  i2cRequest *request = i2cQueue[i2cQueueHead];
+  switch (TWSR & TWI_STATUS_MASK) {
+    case TWI_START:
+      TWDR = request->address << 1;  // SLA+W
+      TWCR = TWCR_CONTINUE;
+      break;
+    case TWI_MT_SLA_ACK:
+      TWDR = request->sensorRegister;
+      TWCR = TWCR_CONTINUE;
+      break;
+    case TWI_MT_DATA_ACK:
+      if (!request->isWrite) {
+        TWCR = TWCR_START;  // repeated start to switch to reading
+      }
+      else if (i2cByteIndex < request->length) {
+        TWDR = request->destination[i2cByteIndex++];
+        TWCR = TWCR_CONTINUE;
+      }
+      else {
+        i2cFinishTransfer(I2C_DONE);
+      }
+      break;
+    case TWI_REP_START:
+      TWDR = (request->address << 1) | 1;  // SLA+R
+      TWCR = TWCR_CONTINUE;
+      break;
+    case TWI_MR_SLA_ACK:
+      TWCR = (request->length > 1) ? TWCR_ACK : TWCR_CONTINUE;  // NACK the last byte
+      break;
+    case TWI_MR_DATA_ACK:
+      request->destination[i2cByteIndex++] = TWDR;
+      TWCR = (i2cByteIndex < request->length - 1) ? TWCR_ACK : TWCR_CONTINUE;
+      break;
+    case TWI_MR_DATA_NACK:
+      request->destination[i2cByteIndex++] = TWDR;
+      i2cFinishTransfer(I2C_DONE);
+      break;
+    default:  // NACK from the device, arbitration lost or bus error
+      i2cFinishTransfer(I2C_ERROR);
+      break;
+  }
+}
+
+// returns false if the request is already in flight or the queue is full
+// request->isWrite selects the direction, i2cQueueRead and i2cQueueWrite are the usual entry points
+bool i2cQueueRequest(i2cRequest *request) {
+  if (request->status == I2C_QUEUED) return false;
+  bool queued = false;
+  uint8_t oldSREG = SREG;  // may be called with interrupts already off
+  cli();
+  if (i2cQueueCount < I2C_QUEUE_SIZE) {
+    request->status = I2C_QUEUED;
+    request->queuedAt = micros();
+    i2cQueue[(i2cQueueHead + i2cQueueCount) % I2C_QUEUE_SIZE] = request;
+    i2cQueueCount++;
+    if (i2cQueueCount == 1) i2cStartNextTransfer(TWCR_START);
+    queued = true;
+  }
+  else {
+    i2cStats.queueFull++;
+  }
+  SREG = oldSREG;
+  return queued;
+}
+
+bool i2cQueueRead(i2cRequest *request) {
+  request->isWrite = false;
+  return i2cQueueRequest(request);
+}
+
+bool i2cQueueWrite(i2cRequest *request) {
+  request->isWrite = true;
+  return i2cQueueRequest(request);
+}
+
+// call from loop(), recovers the bus if a transfer has stalled
+void i2cAsyncPoll() {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (i2cQueueCount > 0 && micros() - i2cTransferStart > I2C_ASYNC_TIMEOUT) {
+    TWCR = 0;  // release the bus
+    TWCR = _BV(TWEN);
+    i2cFinishTransfer(I2C_TIMEOUT);
+  }
+  SREG = oldSREG;
+}
+
+// true once per completed request, errors and timeouts free the request for the next attempt
+bool i2cTakeResult(i2cRequest *request) {
+  byte status = request->status;
+  if (status == I2C_DONE) {
+    request->status = I2C_IDLE;
+    return true;
+  }
+  if (status == I2C_ERROR || status == I2C_TIMEOUT) {
+    request->status = I2C_IDLE;
+  }
+  return false;
+}
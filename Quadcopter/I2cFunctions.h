@@ -1,7 +1,5 @@
 // some of these functions aren't technically related to I2C, but that's what I'm using them for here
-// review timeout
-
-boolean i2cTimeout;
+// blocking helpers for setup, failures are counted in i2cStats (I2cAsync.h)
 
 void setupI2C(){
   I2c.begin();
@@ -11,12 +9,12 @@ void setupI2C(){
 
 // stardard write plus records if there was a timeout
 void writeRegister(byte address, byte sensorRegister, byte data) {
- i2cTimeout = I2c.write(address,sensorRegister,data); // start transmission to device
+ if (I2c.write(address,sensorRegister,data)) i2cStats.errors++; // start transmission to device
 } 
 
 // stardard read plus records if there was a timeout
 byte readRegister(byte address, byte sensorRegister) {
- i2cTimeout = I2c.read(address, sensorRegister, 1);
+ if (I2c.read(address, sensorRegister, 1)) i2cStats.errors++;
  return I2c.receive();
 } 
 
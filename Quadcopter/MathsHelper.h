@@ -1,120 +1,253 @@
 // mainly using info from here: http://www.microchip.com/forums/m817546.aspx
 // and progmem stuff from here: http://forum.arduino.cc/index.php?topic=75126.0
 
-// atan2Lookup
-// atan2LookupWithInterpolation
+// atan2 variants, all taking raw (integer) sensor values and returning degrees in [-180, 180)
+// atan2Lookup                     table of atan over [0, 1], truncated to the segment below
+// atan2LookupWithInterpolation    same table, linear between segments
+// atan2Cordic                     integer CORDIC (vectoring mode), no table lookups per segment
+// atan2Polynomial                 7th order minimax polynomial in 32 bit fixed point
+// atan2Bam                        whichever of these ATAN2_ENGINE selects (Parameters.h), as a binary angle
+// atan2Deg                        the same in degrees
+// internally they all work in binary angles (BinaryAngle.h) so the quadrant fix-ups wrap for
+// free, the tables are generated at compile time for any segment count and units per turn, see
+// quadcopter_bench for the speed / accuracy of each
 
 #include <avr/pgmspace.h>
 
-const PROGMEM  uint16_t pglkp[257] = {
-  0,
-  28, 57, 85, 114, 143, 171, 200, 229, 257, 286,
-  314, 343, 372, 400, 429, 457, 486, 514, 543, 571,
-  600, 628, 657, 685, 713, 742, 770, 798, 827, 855,
-  883, 912, 940, 968, 996, 1024, 1052, 1080, 1108, 1136,
-  1164, 1192, 1220, 1248, 1276, 1303, 1331, 1359, 1386, 1414,
-  1442, 1469, 1497, 1524, 1552, 1579, 1606, 1633, 1661, 1688,
-  1715, 1742, 1769, 1796, 1823, 1850, 1877, 1904, 1930, 1957,
-  1984, 2010, 2037, 2063, 2090, 2116, 2142, 2169, 2195, 2221,
-  2247, 2273, 2299, 2325, 2351, 2376, 2402, 2428, 2453, 2479,
-  2504, 2530, 2555, 2580, 2606, 2631, 2656, 2681, 2706, 2731,
-  2755, 2780, 2805, 2830, 2854, 2879, 2903, 2927, 2952, 2976,
-  3000, 3024, 3048, 3072, 3096, 3120, 3143, 3167, 3191, 3214,
-  3238, 3261, 3284, 3308, 3331, 3354, 3377, 3400, 3423, 3446,
-  3468, 3491, 3514, 3536, 3558, 3581, 3603, 3625, 3648, 3670,
-  3692, 3714, 3735, 3757, 3779, 3801, 3822, 3844, 3865, 3887,
-  3908, 3929, 3950, 3971, 3992, 4013, 4034, 4055, 4076, 4096,
-  4117, 4137, 4158, 4178, 4198, 4218, 4239, 4259, 4279, 4299,
-  4318, 4338, 4358, 4378, 4397, 4417, 4436, 4455, 4475, 4494,
-  4513, 4532, 4551, 4570, 4589, 4608, 4626, 4645, 4664, 4682,
-  4700, 4719, 4737, 4755, 4774, 4792, 4810, 4828, 4846, 4863,
-  4881, 4899, 4916, 4934, 4951, 4969, 4986, 5004, 5021, 5038,
-  5055, 5072, 5089, 5106, 5123, 5139, 5156, 5173, 5189, 5206,
-  5222, 5239, 5255, 5271, 5287, 5304, 5320, 5336, 5352, 5368,
-  5383, 5399, 5415, 5430, 5446, 5462, 5477, 5492, 5508, 5523,
-  5538, 5553, 5568, 5584, 5599, 5613, 5628, 5643, 5658, 5673,
-  5687, 5702, 5716, 5731, 5745, 5760
+// ****************************************************************************************
+//        COMPILE TIME TABLE GENERATION
+// ****************************************************************************************
+
+// atan for 0 <= t <= 1 by Euler's series, each term is the previous one times (2n+2)/(2n+3) * t^2/(1+t^2)
+// converges at least as fast as 2^-n, so 40 terms is beyond float precision
+constexpr double constexprAtanSeries(double ratio, double term, int n) {
+  return n >= 40 ? 0.0 : term + constexprAtanSeries(ratio, term * ratio * (2.0 * n + 2) / (2.0 * n + 3), n + 1);
+}
+
+constexpr double constexprAtan(double t) {
+  return constexprAtanSeries(t * t / (1 + t * t), t / (1 + t * t), 0);
+}
+
+constexpr double constexprRound(double value) {
+  return value < 0 ? -(double)(long)(0.5 - value) : (double)(long)(value + 0.5);
+}
+
+// 0, 1, .. N-1 as a template parameter pack (C++11 has no std::make_integer_sequence, and the
+// AVR toolchain no standard library), built by doubling so 1024 entries stay well within the
+// template depth limit
+template <int... Is>
+struct IndexList {
+  typedef IndexList<Is..., (int)(sizeof...(Is) + Is)...> doubled;
+  typedef IndexList<Is..., (int)(sizeof...(Is) + Is)..., (int)(2 * sizeof...(Is))> doubledPlusOne;
 };
 
-const int noOfSegments = 256;  // note that this gets multiplied by 180 later go can't go much higher
-const int scalingFactor = 128;
-const float intToFloat = 1.0f / (float)scalingFactor;
-const int yThreshold = 32767 / noOfSegments;
+template <int N, bool Odd = (N % 2 == 1)> struct MakeIndexList;
+template <int N> struct MakeIndexList<N, false> {
+  typedef typename MakeIndexList<N / 2>::type::doubled type;
+};
+template <int N> struct MakeIndexList<N, true> {
+  typedef typename MakeIndexList<N / 2>::type::doubledPlusOne type;
+};
+template <> struct MakeIndexList<0, false> {
+  typedef IndexList<> type;
+};
 
-float atan2Lookup(int y, int x) {
-  bool xneg = (x < 0);
-  if (xneg) x = -x;
-  bool yneg = (y < 0);
-  if (yneg) y = -y;
-
-  bool swap = (x < y);
-  if (swap) {
-    int tmp = x;
-    x = y;
-    y = tmp;
-  }
-  // x is now guaranteed to be larger than (or equal) y
-  if (x == 0) return 0.0; // both values are zero
-  while (y > yThreshold) {
-    y = y >> 1;  // reduce y so there's no overflow in the next line
-    x = x >> 1; // reduce x to maintain ratio
-  }
-  int idx = (y * noOfSegments) / x;
-  int lkpDegValue = pgm_read_word_near(pglkp + idx);
+const double ATAN2_TWO_PI = 6.283185307179586476925286766559;
 
-  if (swap) {
-    lkpDegValue = (90 * scalingFactor) - lkpDegValue;
-  }
-  if (xneg) {
-    lkpDegValue = (180 * scalingFactor) - lkpDegValue;
-  }
-  if (yneg) {
-    lkpDegValue = -lkpDegValue;
-  }
+// values[i] = atan(i / Segments) in turns * UnitsPerTurn, i = 0..Segments
+template <int Segments, long UnitsPerTurn, typename Indices = typename MakeIndexList<Segments + 1>::type>
+struct Atan2Table;
+
+template <int Segments, long UnitsPerTurn, int... Is>
+struct Atan2Table<Segments, UnitsPerTurn, IndexList<Is...> > {
+  static_assert(UnitsPerTurn / 8 <= 65535, "table entries are uint16_t");
+  static const uint16_t values[Segments + 1];
+};
+
+template <int Segments, long UnitsPerTurn, int... Is>
+const uint16_t Atan2Table<Segments, UnitsPerTurn, IndexList<Is...> >::values[Segments + 1] PROGMEM = {
+  (uint16_t)constexprRound(constexprAtan((double)Is / Segments) / ATAN2_TWO_PI * UnitsPerTurn)...
+};
+
+// CORDIC rotation angles atan(2^-i) in turns * UnitsPerTurn * ATAN2_CORDIC_ANGLE_SCALE
+const long ATAN2_CORDIC_ANGLE_SCALE = 16;  // extra resolution so rounding doesn't add up over the iterations
+
+template <long UnitsPerTurn, typename Indices = typename MakeIndexList<16>::type>
+struct Atan2CordicTable;
+
+template <long UnitsPerTurn, int... Is>
+struct Atan2CordicTable<UnitsPerTurn, IndexList<Is...> > {
+  static const long angles[sizeof...(Is)];
+};
+
+template <long UnitsPerTurn, int... Is>
+const long Atan2CordicTable<UnitsPerTurn, IndexList<Is...> >::angles[sizeof...(Is)] PROGMEM = {
+  (long)constexprRound(constexprAtan(1.0 / (1L << Is)) / ATAN2_TWO_PI * UnitsPerTurn * ATAN2_CORDIC_ANGLE_SCALE)...
+};
 
-  return (float)lkpDegValue * intToFloat;
+// ****************************************************************************************
+//        ATAN2 VARIANTS
+// ****************************************************************************************
+
+// reduces (y, x) to the first octant: 0 <= num <= den, returns false if both are zero
+struct atan2Octant {
+  bool xneg;
+  bool yneg;
+  bool swap;
+};
+
+static inline bool atan2Fold(int y, int x, uint16_t *num, uint16_t *den, struct atan2Octant *octant) {
+  octant->xneg = (x < 0);
+  octant->yneg = (y < 0);
+  uint16_t ux = octant->xneg ? -(uint16_t)x : x;  // as unsigned so -32768 works too
+  uint16_t uy = octant->yneg ? -(uint16_t)y : y;
+  octant->swap = (ux < uy);
+  *num = octant->swap ? ux : uy;
+  *den = octant->swap ? uy : ux;
+  return *den != 0;
 }
 
-// with interpolation between points
-float atan2LookupWithInterpolation(int y, int x) {
+// back from the first octant, 180 degrees comes out as UnitsPerTurn / 2 (which a binary angle wraps to -180)
+template <long UnitsPerTurn>
+static inline long atan2Unfold(long value, const struct atan2Octant *octant) {
+  if (octant->swap) value = UnitsPerTurn / 4 - value;
+  if (octant->xneg) value = UnitsPerTurn / 2 - value;
+  if (octant->yneg) value = -value;
+  return value;
+}
+
+// the templates below return turns * UnitsPerTurn
 
-  bool xneg = (x < 0);
-  if (xneg) x = -x; // could use ~x for slight increase
-  bool yneg = (y < 0);
-  if (yneg) y = -y; // could use ~y for slight increase
-  bool swap = (x < y);
-  if (swap) {
-    int tmp = x;
-    x = y;
-    y = tmp;
+template <int Segments, long UnitsPerTurn>
+long atan2LookupTable(int y, int x) {
+  uint16_t num, den;
+  struct atan2Octant octant;
+  if (!atan2Fold(y, x, &num, &den, &octant)) return 0; // both values are zero
+  const uint16_t threshold = 65535 / Segments;
+  while (num > threshold) {
+    num = num >> 1;  // reduce y so there's no overflow in the next line
+    den = den >> 1; // reduce x to maintain ratio
   }
-  // x is now guaranteed to be larger than (or equal) y
-  if (x == 0) return 0.0; // both values are zero
-  while (y > yThreshold) {
-    y = y >> 1;  // reduce y so there's no overflow in the next line
-    x = x >> 1; // reduce x to maintain ratio
+  uint16_t idx = (num * (uint16_t)Segments) / den;
+  const uint16_t *table = Atan2Table<Segments, UnitsPerTurn>::values;
+  return atan2Unfold<UnitsPerTurn>(pgm_read_word_near(table + idx), &octant);
+}
+
+// with interpolation between points, on 8 fractional bits of the index
+template <int Segments, long UnitsPerTurn>
+long atan2LookupTableInterpolated(int y, int x) {
+  uint16_t num, den;
+  struct atan2Octant octant;
+  if (!atan2Fold(y, x, &num, &den, &octant)) return 0; // both values are zero
+  const uint32_t threshold = 0xFFFFFFFFUL / ((uint32_t)Segments << 8);
+  while (num > threshold) {
+    num = num >> 1;
+    den = den >> 1;
   }
-  int idx = (y * noOfSegments) / x;
-  float partial = ((y * noOfSegments) / (float)x ) - idx; // how much was truncated in integer division?
-  int lkpDegValue = pgm_read_word_near(pglkp + idx);
-
-  int adj = 0;
-  if (idx != noOfSegments) { // for all except the final index
-    int lkpDegNextValue = pgm_read_word_near(pglkp + idx + 1);
-    adj = (int)((float)(lkpDegNextValue - lkpDegValue) * partial);
+  uint32_t position = ((uint32_t)num * ((uint32_t)Segments << 8)) / den;
+  uint16_t idx = position >> 8;
+  const uint16_t *table = Atan2Table<Segments, UnitsPerTurn>::values;
+  long value = pgm_read_word_near(table + idx);
+  if (idx != Segments) { // for all except the final index
+    long next = pgm_read_word_near(table + idx + 1);
+    value += ((next - value) * (byte)position) >> 8;
   }
-  lkpDegValue += adj;
+  return atan2Unfold<UnitsPerTurn>(value, &octant);
+}
 
-  // assign to the correct quadrant based on the inputs
-  if (swap) {
-    lkpDegValue = (90 * scalingFactor) - lkpDegValue;
+// vectoring mode: rotates (x, y) onto the x axis by +/-atan(2^-i), adding up the rotations
+// inputs are normalised to [8192, 16384) first so small (magnetometer) values keep their resolution
+template <long UnitsPerTurn, byte Iterations>
+long atan2CordicScaled(int y, int x) {
+  static_assert(Iterations <= 16, "angle table has 16 entries");
+  uint16_t num, den;
+  struct atan2Octant octant;
+  if (!atan2Fold(y, x, &num, &den, &octant)) return 0; // both values are zero
+  while (den < 8192) {
+    den <<= 1;
+    num <<= 1;
   }
-  if (xneg) {
-    lkpDegValue = (180 * scalingFactor) - lkpDegValue;
+  while (den >= 16384) {
+    den >>= 1;
+    num >>= 1;
   }
-  if (yneg) {
-    lkpDegValue = -lkpDegValue;
+  uint16_t cx = den;   // only grows, at most 16384 * sqrt(2) * 1.647
+  int16_t cy = num;
+  long angle = 0;
+  for (byte i = 0; i < Iterations; i++) {
+    uint16_t dx = cx >> i;
+    int16_t dy = cy >> i;
+    long step = pgm_read_dword_near(Atan2CordicTable<UnitsPerTurn>::angles + i);
+    if (cy >= 0) {
+      cx += dy;
+      cy -= dx;
+      angle += step;
+    }
+    else {
+      cx -= dy;
+      cy += dx;
+      angle -= step;
+    }
   }
+  return atan2Unfold<UnitsPerTurn>((angle + ATAN2_CORDIC_ANGLE_SCALE / 2) / ATAN2_CORDIC_ANGLE_SCALE, &octant);
+}
+
+// atan(t) ~ t * (c1 + c3 t^2 + c5 t^4 + c7 t^6) on [0, 1], minimax fit with max error 0.005 degrees
+// evaluated with t in Q15 and the coefficients in turns * UnitsPerTurn * 2^extra, as many extra
+// bits as keep c1 within 16 bits (so p * t2 fits in 32)
+template <long UnitsPerTurn>
+long atan2PolynomialScaled(int y, int x) {
+  static_assert(UnitsPerTurn < 102943L, "c1 must stay within 16 bits");
+  const byte extra = UnitsPerTurn < 51471L ? 3 : 2;
+  const double unitsPerRadian = UnitsPerTurn / ATAN2_TWO_PI * (1 << extra);
+  const long c1 = (long)constexprRound(0.9992137101587323 * unitsPerRadian);
+  const long c3 = (long)constexprRound(-0.3211738736769718 * unitsPerRadian);
+  const long c5 = (long)constexprRound(0.1462616993223590 * unitsPerRadian);
+  const long c7 = (long)constexprRound(-0.0389845979355701 * unitsPerRadian);
+  uint16_t num, den;
+  struct atan2Octant octant;
+  if (!atan2Fold(y, x, &num, &den, &octant)) return 0; // both values are zero
+  long t = ((uint32_t)num << 15) / den;
+  long t2 = (t * t) >> 15;
+  long p = c7;
+  p = c5 + ((p * t2) >> 15);
+  p = c3 + ((p * t2) >> 15);
+  p = c1 + ((p * t2) >> 15);
+  return atan2Unfold<UnitsPerTurn>((((p * t) >> 15) + (1 << (extra - 1))) >> extra, &octant);
+}
+
+// the original 256 segments, in binary angles
+const int noOfSegments = 256;
+
+float atan2Lookup(int y, int x) {
+  return bamToDegrees(atan2LookupTable<noOfSegments, BAM16_UNITS_PER_TURN>(y, x));
+}
+
+float atan2LookupWithInterpolation(int y, int x) {
+  return bamToDegrees(atan2LookupTableInterpolated<noOfSegments, BAM16_UNITS_PER_TURN>(y, x));
+}
+
+float atan2Cordic(int y, int x) {
+  return bamToDegrees(atan2CordicScaled<BAM16_UNITS_PER_TURN, 14>(y, x));
+}
+
+float atan2Polynomial(int y, int x) {
+  return bamToDegrees(atan2PolynomialScaled<BAM16_UNITS_PER_TURN>(y, x));
+}
+
+// the casts wrap +180 to -180
+bam16 atan2Bam(int y, int x) {
+#if ATAN2_ENGINE == ATAN2_ENGINE_LOOKUP
+  return (bam16)atan2LookupTable<noOfSegments, BAM16_UNITS_PER_TURN>(y, x);
+#elif ATAN2_ENGINE == ATAN2_ENGINE_CORDIC
+  return (bam16)atan2CordicScaled<BAM16_UNITS_PER_TURN, 14>(y, x);
+#elif ATAN2_ENGINE == ATAN2_ENGINE_POLYNOMIAL
+  return (bam16)atan2PolynomialScaled<BAM16_UNITS_PER_TURN>(y, x);
+#else
+  return (bam16)atan2LookupTableInterpolated<noOfSegments, BAM16_UNITS_PER_TURN>(y, x);
+#endif
+}
 
-  return (float)lkpDegValue * intToFloat;
+float atan2Deg(int y, int x) {
+  return bamToDegrees(atan2Bam(y, x));
 }
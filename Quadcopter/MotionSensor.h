@@ -34,12 +34,29 @@ const byte GYRO_ZOUT_H = 71;   // [15:8]
 const byte GYRO_ZOUT_L = 72;   //[7:0]
 
 // DERIVE THESE SETTINGS FROM CALIBRATION & SETUP
+// these are the compiled defaults, loadParams (ParamStore.h) replaces them from the EEPROM at boot
 // ax,ay,az,gx,gy,gz
-const float offsetScale[6] = { 0.01129227174, -0.00323063182, -0.11709311610, -0.02385017929, 0.00375586283, 0.00117846130};
-const float offsetIntercept[6] = { 875.974694, 34.84791487, 17830.3859, -557.7712577, 342.0514029, 207.8547826};
+float offsetScale[6] = { 0.01129227174, -0.00323063182, -0.11709311610, -0.02385017929, 0.00375586283, 0.00117846130};
+float offsetIntercept[6] = { 875.974694, 34.84791487, 17830.3859, -557.7712577, 342.0514029, 207.8547826};
 // will be used to populate these
 int16_t accelXOffset, accelYOffset, accelZOffset, gyXOffset, gyYOffset, gyZOffset;  // to be populated during setup depending on the temperature
-const float offsetAngle[3] = {0.77f, -3.37f, 0.0f};
+float offsetAngle[3] = {0.77f, -3.37f, 0.0f};
+bam32 offsetAngleBam[2] = {degreesToBam32(offsetAngle[0]), degreesToBam32(offsetAngle[1])};
+
+// LAST CALIBRATION
+// the offsets the gyro calibration left and the temperature they were taken at, kept in the parameter
+// store so a boot at about the same temperature can take them instead of calibrating again
+const int16_t NO_CALIBRATION = -32768;
+const int16_t calibrationTemperatureTolerance = 680;  // raw, 340 per degree C
+int16_t calibratedTemperature = NO_CALIBRATION;
+int16_t calibratedOffsets[6];  // ax,ay,az,gx,gy,gz
+bool calibrationChanged = false;  // for setup to write back
+int16_t measuredTemperature;  // raw, from the calibration sampling
+
+void updateAngleOffsets() {
+  offsetAngleBam[0] = degreesToBam32(offsetAngle[0]);
+  offsetAngleBam[1] = degreesToBam32(offsetAngle[1]);
+}
 
 // MEASUREMENT
 int16_t accX, accY, accZ, tmp, gyX, gyY, gyZ; // raw measurement values
@@ -51,10 +68,11 @@ const float MICROS_TO_SECONDS = 0.000001;
 const float gyroRes = (250.0f * pow(2, FS_SEL)) / 32768.0f; // FS_SEL = 0 -> 250.0f / 32768.0f; // see register map
 const float accelRes = (2.0f * pow(2, AFS_SEL)) / 32768.0f;
 
+// binary angles (BinaryAngle.h), so every sum and difference wraps at +/-180 on its own
 struct angle {
-  float roll;
-  float pitch;
-  float yaw;
+  bam32 roll;
+  bam32 pitch;
+  bam32 yaw;
 };
 
 struct angle accelAngles;
@@ -111,21 +129,126 @@ bool readAccels() {
   }
 }
 
-// this depends on pre-calculated values of how the output changes with temperature
-void calculateOffsets() {
-  // first, get the temperature
-  long temperatureSum = 0;
-  int repetitions = 500;
-  for (int i = 0; i < 500; i++) {
-    readGyrosAccels();
-    delay(2);
+// NON-BLOCKING READS (I2cAsync.h)
+// start... queues the transfer, finish... unpacks it once it has arrived (false until then)
+byte gyroBuffer[6];
+byte accelBuffer[6];
+i2cRequest gyroRequest = {MPU_ADDRESS, GYRO_XOUT_H, 6, gyroBuffer, I2C_IDLE, 0, 0, false};
+i2cRequest accelRequest = {MPU_ADDRESS, ACCEL_XOUT_H, 6, accelBuffer, I2C_IDLE, 0, 0, false};
+
+bool startGyroRead() {
+  return i2cQueueRead(&gyroRequest);
+}
+
+bool finishGyroRead() {
+  if (!i2cTakeResult(&gyroRequest)) return false;
+  gyX = gyroBuffer[0] << 8 | gyroBuffer[1];
+  gyY = gyroBuffer[2] << 8 | gyroBuffer[3];
+  gyZ = gyroBuffer[4] << 8 | gyroBuffer[5];
+  lastReadingTime = thisReadingTime;
+  thisReadingTime = micros();
+  return true;
+}
+
+bool startAccelRead() {
+  return i2cQueueRead(&accelRequest);
+}
+
+bool finishAccelRead() {
+  if (!i2cTakeResult(&accelRequest)) return false;
+  accX = accelBuffer[0] << 8 | accelBuffer[1];
+  accY = accelBuffer[2] << 8 | accelBuffer[3];
+  accZ = accelBuffer[4] << 8 | accelBuffer[5];
+  return true;
+}
+
+// FIFO BURST ACQUISITION (MPU_FIFO_MODE)
+// each data ready interrupt triggers a FIFO_COUNT read followed by one burst read of every
+// complete sample waiting (up to FIFO_MAX_BURST), samples are timestamped from the sensor
+// sample clock so dt is exact and none are read twice or skipped
+const byte SMPLRT_DIV = 25;
+const byte FIFO_EN = 35;
+const byte USER_CTRL = 106;
+const byte FIFO_COUNTH = 114;
+const byte FIFO_R_W = 116;
+const byte FIFO_EN_ACCEL_GYRO = 0b01111000;  // XG, YG, ZG, ACCEL
+const byte USER_CTRL_FIFO_EN = 0b01000000;
+const byte USER_CTRL_FIFO_RESET = 0b00000100;
+const byte INT_DATA_RDY_EN = 0b00000001;
+const byte FIFO_SAMPLE_SIZE = 12;  // accel x,y,z then gyro x,y,z
+const byte FIFO_MAX_BURST = 4;     // samples per burst read, the rest wait for the next interrupt
+const uint16_t FIFO_SIZE = 1024;
+const byte pinMpuInterrupt = 2;    // INT0
+
+volatile bool mpuDataReady = false;
+unsigned long fifoResets = 0;  // overflowed or misaligned FIFO
+byte fifoCountBuffer[2];
+byte fifoBuffer[FIFO_SAMPLE_SIZE * FIFO_MAX_BURST];
+byte fifoResetCommand = USER_CTRL_FIFO_EN | USER_CTRL_FIFO_RESET;
+i2cRequest fifoCountRequest = {MPU_ADDRESS, FIFO_COUNTH, 2, fifoCountBuffer, I2C_IDLE, 0, 0, false};
+i2cRequest fifoReadRequest = {MPU_ADDRESS, FIFO_R_W, 0, fifoBuffer, I2C_IDLE, 0, 0, false};
+i2cRequest fifoResetRequest = {MPU_ADDRESS, USER_CTRL, 1, &fifoResetCommand, I2C_IDLE, 0, 0, true};
+
+void mpuDataReadyIsr() {
+  mpuDataReady = true;
+}
+
+// blocking, call once at the end of setup (after calibration, which reads the data registers directly)
+void setupMpuFifo() {
+#ifdef MPU_FIFO_MODE
+  writeRegister(MPU_ADDRESS, SMPLRT_DIV, MPU_SAMPLE_RATE_DIV);
+#endif
+  writeRegister(MPU_ADDRESS, FIFO_EN, FIFO_EN_ACCEL_GYRO);
+  writeRegister(MPU_ADDRESS, USER_CTRL, USER_CTRL_FIFO_EN | USER_CTRL_FIFO_RESET);
+  writeRegister(MPU_ADDRESS, INT_ENABLE, INT_DATA_RDY_EN);
+  readRegister(MPU_ADDRESS, INT_STATUS);  // clear anything already pending
+  pinMode(pinMpuInterrupt, INPUT);
+  attachInterrupt(digitalPinToInterrupt(pinMpuInterrupt), mpuDataReadyIsr, RISING);
+  thisReadingTime = micros();
+}
+
+// call every pass of loop(), returns how many new samples are now in gyX.. and accX..
+// (the caller integrates each one, see processFifoSamples)
+byte serviceMpuFifo() {
+  if (mpuDataReady && fifoCountRequest.status == I2C_IDLE && fifoReadRequest.status == I2C_IDLE) {
+    mpuDataReady = false;
+    i2cQueueRead(&fifoCountRequest);
   }
-  for (int i = 0; i < repetitions; i++) {
-    readGyrosAccels();
-    temperatureSum += tmp;
-    delay(2);
+  if (i2cTakeResult(&fifoCountRequest)) {
+    uint16_t count = fifoCountBuffer[0] << 8 | fifoCountBuffer[1];
+    if (count > FIFO_SIZE - FIFO_SAMPLE_SIZE || count % FIFO_SAMPLE_SIZE != 0) {
+      fifoResets++;
+      i2cQueueWrite(&fifoResetRequest);
+    }
+    else {
+      byte samples = count / FIFO_SAMPLE_SIZE;
+      if (samples > FIFO_MAX_BURST) samples = FIFO_MAX_BURST;
+      if (samples > 0) {
+        fifoReadRequest.length = samples * FIFO_SAMPLE_SIZE;
+        i2cQueueRead(&fifoReadRequest);
+      }
+    }
   }
-  float temperature = (float)temperatureSum / (float)repetitions;
+  i2cTakeResult(&fifoResetRequest);
+  if (!i2cTakeResult(&fifoReadRequest)) return 0;
+  return fifoReadRequest.length / FIFO_SAMPLE_SIZE;
+}
+
+// unpacks sample n of the last burst into the raw measurement variables
+void unpackFifoSample(byte n) {
+  byte *sample = fifoBuffer + n * FIFO_SAMPLE_SIZE;
+  accX = sample[0] << 8 | sample[1];
+  accY = sample[2] << 8 | sample[3];
+  accZ = sample[4] << 8 | sample[5];
+  gyX = sample[6] << 8 | sample[7];
+  gyY = sample[8] << 8 | sample[9];
+  gyZ = sample[10] << 8 | sample[11];
+  lastReadingTime = thisReadingTime;
+  thisReadingTime += gyroLoopFreq;  // sensor sample clock, not micros()
+}
+
+// this depends on pre-calculated values of how the output changes with temperature
+void offsetsFromTemperature(float temperature) {
   accelXOffset = (int)(( temperature * offsetScale[0] ) + offsetIntercept[0]);
   accelYOffset = (int)(( temperature * offsetScale[1] ) + offsetIntercept[1]);
   accelZOffset = (int)(( temperature * offsetScale[2] ) + offsetIntercept[2] - 16384);
@@ -158,10 +281,11 @@ void convertGyroReadingsToValues() {
 }
 
 void accumulateGyroChange() {
-  float interval = (thisReadingTime - lastReadingTime) * MICROS_TO_SECONDS;  // convert to seconds (from micros)
-  currentAngles.roll += valGyX * interval;
-  currentAngles.pitch += valGyY * interval;
-  currentAngles.yaw += valGyZ * interval;
+  // convert to seconds (from micros), times the binary angle units in a degree
+  float interval = (thisReadingTime - lastReadingTime) * (MICROS_TO_SECONDS * BAM32_PER_DEGREE);
+  currentAngles.roll = bamAdd32(currentAngles.roll, (int32_t)(valGyX * interval));
+  currentAngles.pitch = bamAdd32(currentAngles.pitch, (int32_t)(valGyY * interval));
+  currentAngles.yaw = bamAdd32(currentAngles.yaw, (int32_t)(valGyZ * interval));
 
 //  gyroAngles.roll += gyroChangeAngles.roll;
 //  gyroAngles.pitch += gyroChangeAngles.pitch;
@@ -172,10 +296,193 @@ void accumulateGyroChange() {
   // then only when actually populating gyroChangeAngle variables, apply gyroRes and convert to seconds
 }
 
+
+// ****************************************************************************************
+//        FIXED POINT PIPELINE (SENSOR_FIXED_POINT)
+//    same steps as the float functions, from the raw counts to the angles in whole integers
+//    the angles are the same binary angles, the accel averages Q4 counts
+//    gyroRes, MICROS_TO_SECONDS and the alphas are folded into the constants below
+// ****************************************************************************************
+
+const byte ACCEL_AVE_FRAC_BITS = 4;
+const byte ACCEL_ALPHA_FRAC_BITS = 12;
+const byte GYRO_STEP_FRAC_BITS = 4;  // binary angle per count per sample, 7282 (Q4) for 1250us at FS_SEL = 2
+const byte GYRO_INTERVAL_FRAC_BITS = 14;
+const byte COMP_FILTER_FRAC_BITS = 16;
+const byte COMP_FILTER_PRE_SHIFT = 8;  // keeps a 180 degree difference times the gain within 32 bits
+
+// gyro counts * micros to binary angle in Q(4 + 14), 95444 at FS_SEL = 2
+const uint32_t gyroStepScale = (uint32_t)(gyroRes * MICROS_TO_SECONDS * BAM32_PER_DEGREE *
+                                          (float)(1UL << (GYRO_STEP_FRAC_BITS + GYRO_INTERVAL_FRAC_BITS)) + 0.5f);
+// longer gaps are clamped so the step times a full scale reading stays within 32 bits at FS_SEL = 3
+const unsigned long gyroMaxInterval = 4095;  // MICROseconds
+const int32_t accelAverageGain = (int32_t)(accelAverageAlpha * (1L << ACCEL_ALPHA_FRAC_BITS) + 0.5f);
+const int32_t compFilterGain = (int32_t)((1.0f - compFilterAlpha) * (1L << COMP_FILTER_FRAC_BITS) + 0.5f);
+
+int32_t accXAveFixed = 0, accYAveFixed = 0, accZAveFixed = 0;
+
+void accumulateGyroChangeFixed() {
+  unsigned long interval = thisReadingTime - lastReadingTime;
+  if (interval > gyroMaxInterval) interval = gyroMaxInterval;
+  int32_t step = (interval * gyroStepScale + (1UL << (GYRO_INTERVAL_FRAC_BITS - 1))) >> GYRO_INTERVAL_FRAC_BITS;
+  const int32_t half = 1L << (GYRO_STEP_FRAC_BITS - 1);
+  currentAngles.roll = bamAdd32(currentAngles.roll, ((int32_t)gyX * step + half) >> GYRO_STEP_FRAC_BITS);
+  currentAngles.pitch = bamAdd32(currentAngles.pitch, ((int32_t)gyY * step + half) >> GYRO_STEP_FRAC_BITS);
+  currentAngles.yaw = bamAdd32(currentAngles.yaw, ((int32_t)gyZ * step + half) >> GYRO_STEP_FRAC_BITS);
+}
+
+static inline void averageAccelFixed(int32_t *average, int16_t reading) {
+  int32_t diff = ((int32_t)reading << ACCEL_AVE_FRAC_BITS) - *average;
+  *average += (diff * accelAverageGain + (1L << (ACCEL_ALPHA_FRAC_BITS - 1))) >> ACCEL_ALPHA_FRAC_BITS;
+}
+
+void accumulateAccelReadingsFixed() {
+  averageAccelFixed(&accXAveFixed, accX);
+  averageAccelFixed(&accYAveFixed, accY);
+  averageAccelFixed(&accZAveFixed, accZ);
+}
+
+// includes applyAngleOffsets
+void calcAnglesAccelFixed() {
+  int accYInt = accYAveFixed >> ACCEL_AVE_FRAC_BITS;
+  int accZInt = accZAveFixed >> ACCEL_AVE_FRAC_BITS;
+  int accXInt = accXAveFixed >> ACCEL_AVE_FRAC_BITS;
+  accelAngles.roll = bamDifference32(bam16ToBam32(atan2Bam(accYInt, accZInt)), offsetAngleBam[0]);
+  accelAngles.pitch = bamDifference32(bam16ToBam32(atan2Bam(accXInt, accZInt)), offsetAngleBam[1]);
+}
+
+static inline void complementaryFilterFixed(bam32 *angle, bam32 accelAngle) {
+  int32_t diff = bamDifference32(accelAngle, *angle) >> COMP_FILTER_PRE_SHIFT;
+  *angle = bamAdd32(*angle, (diff * compFilterGain) >> (COMP_FILTER_FRAC_BITS - COMP_FILTER_PRE_SHIFT));
+}
+
+void combineGyroAccelDataFixed() {
+  complementaryFilterFixed(&currentAngles.roll, accelAngles.roll);
+  complementaryFilterFixed(&currentAngles.pitch, accelAngles.pitch);
+}
+
+// hands the float accel averages over, after finishAngleInitialisation (which always runs in float)
+void loadSensorStateFixed() {
+  accXAveFixed = (int32_t)(accXAve * (1 << ACCEL_AVE_FRAC_BITS));
+  accYAveFixed = (int32_t)(accYAve * (1 << ACCEL_AVE_FRAC_BITS));
+  accZAveFixed = (int32_t)(accZAve * (1 << ACCEL_AVE_FRAC_BITS));
+}
+
+// ****************************************************************************************
+//        ONLINE GYRO BIAS (GYRO_BIAS_ONLINE)
+//    a scalar Kalman filter per axis on the offsets that applyGyroOffsets takes off
+//    still (every gyro sample since the last main loop within gyroStillThreshold, the accel
+//    within 10% of 1g): the mean gyro reading is the bias itself
+//    moving: the complementary filter's corrections are the reference, a bias b leaves the
+//    angle b * tau ahead of the accel (or compass) one, tau being the filter's time constant,
+//    so the difference over tau is a (much noisier) reading of b; roll and pitch only near level
+//    with AHRS_MAHONY the moving part is left to the AHRS's own integral term
+// ****************************************************************************************
+
+const float gyroNoise = 4.0f;         // counts rms per sample, at DPLF_VALUE = 3
+const float accelAngleNoise = 2.0f;   // degrees rms, motor vibration in the accel angles
+const float compFilterTau = mainLoopFreq * MICROS_TO_SECONDS / (1.0f - compFilterAlpha);  // seconds
+const float gyroBiasProcessNoise = gyroBiasDrift * gyroBiasDrift * mainLoopFreq * MICROS_TO_SECONDS;  // per main loop
+const int32_t accelOneG = 16384 >> AFS_SEL;
+const bam16 gyroBiasLevelAngle = 1820;  // 10 degrees
+const float gyroBiasLevelVariance = accelAngleNoise * accelAngleNoise / (compFilterTau * gyroRes * compFilterTau * gyroRes);
+
+float gyroBias[3];          // counts, the offsets are these rounded
+float gyroBiasVariance[3];  // counts^2
+int32_t gyroBiasSum[3];     // since the last main loop, after the offsets
+byte gyroBiasSamples;
+bool gyroBiasMoved;         // a sample since the last main loop was outside gyroStillThreshold
+bool frameStill;            // as decided at the last main loop
+
+void setupGyroBias() {
+  gyroBias[0] = gyXOffset;
+  gyroBias[1] = gyYOffset;
+  gyroBias[2] = gyZOffset;
+  for (byte axis = 0; axis < 3; axis++) {
+    gyroBiasVariance[axis] = gyroBiasStartError * gyroBiasStartError;
+    gyroBiasSum[axis] = 0;
+  }
+  gyroBiasSamples = 0;
+  gyroBiasMoved = false;
+}
+
+// after applyGyroOffsets, on every gyro sample
+void sumGyroForBias() {
+  if (gyroBiasSamples == 255) return;
+  gyroBiasSum[0] += gyX;
+  gyroBiasSum[1] += gyY;
+  gyroBiasSum[2] += gyZ;
+  gyroBiasSamples++;
+  if (abs(gyX) > gyroStillThreshold || abs(gyY) > gyroStillThreshold || abs(gyZ) > gyroStillThreshold) {
+    gyroBiasMoved = true;
+  }
+}
+
+void updateGyroBias(byte axis, float measurement, float variance) {
+  float gain = gyroBiasVariance[axis] / (gyroBiasVariance[axis] + variance);
+  gyroBias[axis] += gain * (measurement - gyroBias[axis]);
+  gyroBiasVariance[axis] *= 1.0f - gain;
+}
+
+void applyGyroBias() {
+  gyXOffset = (int16_t)lround(gyroBias[0]);
+  gyYOffset = (int16_t)lround(gyroBias[1]);
+  gyZOffset = (int16_t)lround(gyroBias[2]);
+}
+
+// once per main loop, after processAccelData and before the accel angles are fused
+void estimateGyroBias() {
+  for (byte axis = 0; axis < 3; axis++) {
+    gyroBiasVariance[axis] += gyroBiasProcessNoise;
+  }
+  if (gyroBiasSamples == 0) return;
+  uint32_t accelSquared = (uint32_t)((int32_t)accX * accX) + (uint32_t)((int32_t)accY * accY) + (uint32_t)((int32_t)accZ * accZ);
+  const uint32_t oneGSquared = (uint32_t)(accelOneG * accelOneG);
+  frameStill = !gyroBiasMoved && accelSquared > oneGSquared / 100 * 81 && accelSquared < oneGSquared / 100 * 121;
+  if (frameStill) {
+    const int16_t offsets[3] = {gyXOffset, gyYOffset, gyZOffset};
+    for (byte axis = 0; axis < 3; axis++) {
+      updateGyroBias(axis, offsets[axis] + (float)gyroBiasSum[axis] / gyroBiasSamples,
+                     gyroNoise * gyroNoise / gyroBiasSamples);
+    }
+  }
+#ifndef AHRS_MAHONY
+  // only near level, where the accel angles are good to a fraction of a degree (atan2 of two axes)
+  else if (abs(bam32ToBam16(currentAngles.roll)) < gyroBiasLevelAngle && abs(bam32ToBam16(currentAngles.pitch)) < gyroBiasLevelAngle) {
+    const float scale = 1.0f / (compFilterTau * gyroRes);  // degrees of correction to counts of bias
+    updateGyroBias(0, gyroBias[0] - bam32ToDegrees(bamDifference32(accelAngles.roll, currentAngles.roll)) * scale,
+                   gyroBiasLevelVariance);
+    updateGyroBias(1, gyroBias[1] - bam32ToDegrees(bamDifference32(accelAngles.pitch, currentAngles.pitch)) * scale,
+                   gyroBiasLevelVariance);
+  }
+#endif
+  for (byte axis = 0; axis < 3; axis++) {
+    gyroBiasSum[axis] = 0;
+  }
+  gyroBiasSamples = 0;
+  gyroBiasMoved = false;
+  applyGyroBias();
+}
+
+// the quaternion estimator (Ahrs.h, AHRS_MAHONY) comes after this file
+void ahrsIntegrateGyro();
+void ahrsCorrect();
+void ahrsUpdateAngles();
+void ahrsSetAngles(struct angle *angles);
+
 void processGyroData() {
   applyGyroOffsets();
-  convertGyroReadingsToValues();
+#ifdef GYRO_BIAS_ONLINE
+  sumGyroForBias();
+#endif
+  convertGyroReadingsToValues();  // the rate PIDs still take deg/s as float
+#if defined(AHRS_MAHONY)
+  ahrsIntegrateGyro();
+#elif defined(SENSOR_FIXED_POINT)
+  accumulateGyroChangeFixed();
+#else
   accumulateGyroChange();
+#endif
 }
 
 void applyAccelOffsets() {
@@ -192,8 +499,8 @@ void accumulateAccelReadings() {
 }
 
 void calcAnglesAccel() {
-  accelAngles.roll = atan2Lookup(accYAve, accZAve);
-  accelAngles.pitch = atan2Lookup(accXAve, accZAve);
+  accelAngles.roll = bam16ToBam32(atan2Bam(accYAve, accZAve));
+  accelAngles.pitch = bam16ToBam32(atan2Bam(accXAve, accZAve));
 }
 
 //void calcAnglesAccel() {
@@ -202,53 +509,152 @@ void calcAnglesAccel() {
 //}
 
 void applyAngleOffsets(){
-  accelAngles.roll -= offsetAngle[0];
-  accelAngles.pitch -= offsetAngle[1];
+  accelAngles.roll = bamDifference32(accelAngles.roll, offsetAngleBam[0]);
+  accelAngles.pitch = bamDifference32(accelAngles.pitch, offsetAngleBam[1]);
 }
 
 void processAccelData() {
   applyAccelOffsets();
+#if defined(AHRS_MAHONY)
+  accumulateAccelReadingsFixed();
+  ahrsCorrect();
+#elif defined(SENSOR_FIXED_POINT)
+  accumulateAccelReadingsFixed();
+  calcAnglesAccelFixed();
+#else
   accumulateAccelReadings();
   calcAnglesAccel();
   applyAngleOffsets();
+#endif
 }
 
 void combineGyroAccelData() {
-  currentAngles.roll = (currentAngles.roll * compFilterAlpha) + (accelAngles.roll * (1.0f - compFilterAlpha));
-  currentAngles.pitch = (currentAngles.pitch * compFilterAlpha) + (accelAngles.pitch * (1.0f - compFilterAlpha));
+#ifdef GYRO_BIAS_ONLINE
+  estimateGyroBias();
+#endif
+#if defined(AHRS_MAHONY)
+  ahrsUpdateAngles();
+#elif defined(SENSOR_FIXED_POINT)
+  combineGyroAccelDataFixed();
+#else
+  // angle * alpha + accel * (1 - alpha), as a step along the shortest way round
+  currentAngles.roll = bamAdd32(currentAngles.roll,
+                                (int32_t)(bamDifference32(accelAngles.roll, currentAngles.roll) * (1.0f - compFilterAlpha)));
+  currentAngles.pitch = bamAdd32(currentAngles.pitch,
+                                 (int32_t)(bamDifference32(accelAngles.pitch, currentAngles.pitch) * (1.0f - compFilterAlpha)));
+#endif
 }
 
 void calculateVerticalAccel() {
+#if defined(SENSOR_FIXED_POINT) || defined(AHRS_MAHONY)
+  valAcZ = accZAveFixed * (accelRes / (1 << ACCEL_AVE_FRAC_BITS));
+#else
   valAcZ = accZAve * accelRes;      // AcZAve has already been filtered, although I might wish to have a different filter parameter
+#endif
+}
+
+void keepCalibration() {
+  calibratedTemperature = measuredTemperature;
+  calibratedOffsets[0] = accelXOffset;
+  calibratedOffsets[1] = accelYOffset;
+  calibratedOffsets[2] = accelZOffset;
+  calibratedOffsets[3] = gyXOffset;
+  calibratedOffsets[4] = gyYOffset;
+  calibratedOffsets[5] = gyZOffset;
+  calibrationChanged = true;
+}
+
+void useLastCalibration() {
+  accelXOffset = calibratedOffsets[0];
+  accelYOffset = calibratedOffsets[1];
+  accelZOffset = calibratedOffsets[2];
+  gyXOffset = calibratedOffsets[3];
+  gyYOffset = calibratedOffsets[4];
+  gyZOffset = calibratedOffsets[5];
+}
+
+// CALIBRATION SAMPLING
+// stepped from loop() while the radio is being armed, each step takes at most one reading
+// when it is due: a quick look at the temperature, then, unless the last calibration fits it,
+// the sensor is let settle and the temperature and gyro are averaged over the same readings
+enum CalibrationStage {CALIBRATION_TEMPERATURE_CHECK, CALIBRATION_SETTLING, CALIBRATION_GYRO, CALIBRATION_DONE};
+CalibrationStage calibrationStage = CALIBRATION_DONE;
+const unsigned long calibrationSamplePeriod = 2000;  // MICROseconds
+const int calibrationCheckSettle = 10, calibrationCheckSamples = 16;
+const int calibrationSettle = 500, calibrationSamples = 500;
+int calibrationCount;
+long calibrationSum[4];  // temperature, gx, gy, gz
+unsigned long lastCalibrationSample;
+
+void startSensorCalibration() {
+  calibrationStage = CALIBRATION_TEMPERATURE_CHECK;
+  calibrationCount = 0;
+  memset(calibrationSum, 0, sizeof(calibrationSum));
+  lastCalibrationSample = micros() - calibrationSamplePeriod;  // first reading on the first step
 }
 
-void calibrateGyro(int repetitions) {
-  long gyXSum = 0, gyYSum = 0, gyZSum = 0;
-  int i = 0;
-  // throw away first 100 readings
-  for (i = 0; i < 100; i++) {
-    readGyrosAccels();
-    delay(2);
+void finishTemperatureCheck() {
+  measuredTemperature = calibrationSum[0] / calibrationCheckSamples;
+  offsetsFromTemperature((float)calibrationSum[0] / calibrationCheckSamples);
+  calibrationStage = CALIBRATION_DONE;
+  if (calibratedTemperature != NO_CALIBRATION &&
+      abs((int32_t)measuredTemperature - calibratedTemperature) <= calibrationTemperatureTolerance) {
+    useLastCalibration();
   }
-  for (i = 0; i < repetitions; i++) {
-    readGyrosAccels();
-    gyXSum += gyX;
-    gyYSum += gyY;
-    gyZSum += gyZ;
-    delay(2);
+  else {
+#ifndef GYRO_BIAS_ONLINE  // otherwise the temperature model's offsets are only a starting point
+    calibrationStage = CALIBRATION_SETTLING;
+#endif
   }
-  gyXOffset = gyXSum / repetitions;
-  gyYOffset = gyYSum / repetitions;
-  gyZOffset = gyZSum / repetitions;
-  //  Serial.print(gyXOffset); Serial.print('\t');
-  //  Serial.print(gyYOffset); Serial.print('\t');
-  //  Serial.print(gyZOffset); Serial.print('\n');
+}
 
+void finishGyroCalibration() {
+  measuredTemperature = calibrationSum[0] / calibrationSamples;
+  offsetsFromTemperature((float)calibrationSum[0] / calibrationSamples);
+  gyXOffset = calibrationSum[1] / calibrationSamples;
+  gyYOffset = calibrationSum[2] / calibrationSamples;
+  gyZOffset = calibrationSum[3] / calibrationSamples;
+  keepCalibration();
+  calibrationStage = CALIBRATION_DONE;
 }
 
-void wrapGyroHeading() {
-  if (currentAngles.yaw < - 180.0f) currentAngles.yaw += 360.0f;
-  else if (currentAngles.yaw > 180.0f) currentAngles.yaw -= 360.0f;
+// true once the offsets are ready, the QC must be kept still until then
+bool sensorCalibrationStep() {
+  if (calibrationStage == CALIBRATION_DONE) return true;
+  unsigned long now = micros();
+  if (now - lastCalibrationSample < calibrationSamplePeriod) return false;
+  lastCalibrationSample = now;  // no catching up after a stall, the spacing is what matters
+  if (!readGyrosAccels()) return false;
+  calibrationCount++;
+  switch (calibrationStage) {
+    case CALIBRATION_TEMPERATURE_CHECK:
+      if (calibrationCount <= calibrationCheckSettle) break;
+      calibrationSum[0] += tmp;
+      if (calibrationCount == calibrationCheckSettle + calibrationCheckSamples) {
+        finishTemperatureCheck();
+        calibrationCount = 0;
+        memset(calibrationSum, 0, sizeof(calibrationSum));
+      }
+      break;
+    case CALIBRATION_SETTLING:
+      if (calibrationCount == calibrationSettle) {
+        calibrationStage = CALIBRATION_GYRO;
+        calibrationCount = 0;
+      }
+      break;
+    default:  // CALIBRATION_GYRO
+      calibrationSum[0] += tmp;
+      calibrationSum[1] += gyX;
+      calibrationSum[2] += gyY;
+      calibrationSum[3] += gyZ;
+      if (calibrationCount == calibrationSamples) finishGyroCalibration();
+      break;
+  }
+  if (calibrationStage != CALIBRATION_DONE) return false;
+#ifdef GYRO_BIAS_ONLINE
+  setupGyroBias();
+#endif
+  return true;
 }
 
 void setupMotionSensor() {
@@ -268,8 +674,7 @@ void setupMotionSensor() {
     Serial.println(F("Try reseting..."));
     while (1); // CHANGE TO SET SOME STATUS FLAG THAT CAN BE SENT TO TRANSMITTER
   }
-  calculateOffsets();
-  calibrateGyro(500);
+  startSensorCalibration();
 }
 
 /////////////////////////////////////////////////////////////////////////
@@ -291,12 +696,12 @@ const byte RESOLUTION_LOWEST = 0b11100000;
 
 // measurement variables
 int mx, my, mz;
-float magHeading; // main output
+bam16 magHeading; // main output
 
-// offsets
-const int mxo = 3;
-const int myo = -14;
-float yawOffsetAngle = 0.0f;
+// offsets (compiled defaults, see ParamStore.h)
+int mxo = 3;
+int myo = -14;
+bam16 yawOffsetAngle = 0;
 
 void setupMag() {
   writeRegister(MAG_ADDRESS, MAG_MODE, CONTINUOUS_MODE);
@@ -319,18 +724,33 @@ bool readMag() {
   }
 }
 
+byte magBuffer[6];
+i2cRequest magRequest = {MAG_ADDRESS, MAG_FIRST_SENSOR_REG, 6, magBuffer, I2C_IDLE, 0, 0, false};
+
+bool startMagRead() {
+  return i2cQueueRead(&magRequest);
+}
+
+bool finishMagRead() {
+  if (!i2cTakeResult(&magRequest)) return false;
+  mx = (int16_t)(magBuffer[0] << 8 | magBuffer[1]);
+  mz = (int16_t)(magBuffer[2] << 8 | magBuffer[3]);  // NOTE X then Z then Y
+  my = (int16_t)(magBuffer[4] << 8 | magBuffer[5]);
+  return true;
+}
+
 void applyMagOffsets() {
   mx -= mxo;
   my -= myo;
 }
 
 void magCalculateHeading() {
-  magHeading = -atan2Lookup(my, mx);
+  magHeading = -atan2Bam(my, mx);
 }
 
 // starting heading always considered to be zero
 void headingAdjustment() {
-  magHeading -= yawOffsetAngle;
+  magHeading = bamDifference(magHeading, yawOffsetAngle);
 }
 
 void processMagData() {
@@ -339,64 +759,113 @@ void processMagData() {
   headingAdjustment();
 }
 
-void wrapMagHeading() {
-  if (magHeading < - 180.0f) magHeading += 360.0f;
-  else if (magHeading > 180.0f) magHeading -= 360.0f;
-}
 
 
 /////////////////////////////////////////////////////////////////////////
 ////////////////// BOTH /////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////
 
-float headingAlpha = 0.05f;
+const float headingAlpha = 0.05f;
+const int32_t headingGain = (int32_t)(headingAlpha * 65536.0f + 0.5f);  // a bam16 difference times this is a bam32 step
 // note that alpha is the weight applied to the first term in the diff calculation (i.e. mag)
 // currentAngles.yaw already includes the gyro change
 // this needs to comes after the main mixAngles (which adds gyro change to the current angle)
+// the binary angle difference is already the shortest way round, and the sum wraps by itself
+// the yaw half of estimateGyroBias, as the compass is slower and much noisier than the accel
+const float headingNoise = 5.0f;  // degrees rms, the heading is not tilt compensated
+const float headingTau = magLoopFreq * 0.001f / headingAlpha;  // seconds
+
+void estimateGyroBiasYaw(bam16 headingError) {
+  if (frameStill) return;  // the gyro already says more
+  const float scale = 1.0f / (headingTau * gyroRes);
+  const float variance = (headingNoise * scale) * (headingNoise * scale) * headingTau / (magLoopFreq * 0.001f);
+  updateGyroBias(2, gyroBias[2] - bamToDegrees(headingError) * scale, variance);
+  applyGyroBias();
+}
+
+// with AHRS_MAHONY the compass goes in with the next accel correction instead
 void combineGyroMagHeadings() {
-  wrapGyroHeading();
-  wrapMagHeading();
-  float diff = magHeading - currentAngles.yaw;
-  float minDistance;
-  if (diff < - 180.0f) minDistance = diff + 360.0f;
-  else if (diff > 180.0f) minDistance = diff - 360.0f;
-  else minDistance = diff;
-  float adjustment = minDistance * headingAlpha;
-  float newHeading = currentAngles.yaw + adjustment;
-  if (newHeading < - 180.0f) newHeading += 360.0f;
-  else if (newHeading > 180.0f) newHeading -= 360.0f;
-  currentAngles.yaw = newHeading;
-}
-
-// QC must be stationary when this runs
-void initialiseCurrentAngles() {
-  // take a certain number of readings
+#ifndef AHRS_MAHONY
+  bam16 minDistance = bamDifference(magHeading, bam32ToBam16(currentAngles.yaw));
+#ifdef GYRO_BIAS_ONLINE
+  estimateGyroBiasYaw(minDistance);
+#endif
+  currentAngles.yaw = bamAdd32(currentAngles.yaw, minDistance * headingGain);
+#endif
+}
+
+// STARTING ATTITUDE
+// stepped from loop() like the calibration, accel and compass readings are taken side by side
+// QC must be stationary from startAngleInitialisation until the step returns true
+const unsigned long angleSamplePeriod = 5000;  // MICROseconds
+const unsigned long headingSamplePeriod = 15000;  // MICROseconds
+const byte angleSamples = 100, headingSamples = 16;
+byte angleCount, headingCount;
+long headingSum[2];  // mx, my
+unsigned long lastAngleSample, lastHeadingSample;
+
+void startAngleInitialisation() {
+  angleCount = headingCount = 0;
+  headingSum[0] = headingSum[1] = 0;
   readGyrosAccels();  // just to get timing variables filled
-  for (int i = 0; i < 100; i++) {
-    readGyrosAccels();
-    applyAccelOffsets();
-    accumulateAccelReadings();
-    delay(5);
-  }
+  lastAngleSample = lastHeadingSample = micros();
+}
+
+void finishAngleInitialisation() {
   calcAnglesAccel();
   applyAngleOffsets();
   currentAngles.roll = accelAngles.roll;
   currentAngles.pitch = accelAngles.pitch;
+#ifdef GYRO_BIAS_ONLINE
+  estimateGyroBias();  // 100 samples at once, if it was kept still
+#endif
 
-  for (int i = 0; i < 16; i++) {
-    readMag();
-    delay(15);
-  }
+  mx = headingSum[0] / headingSamples;
+  my = headingSum[1] / headingSamples;
   applyMagOffsets();
   magCalculateHeading();
 //  Serial.println(magHeading);
   yawOffsetAngle = magHeading;
   headingAdjustment();
-  currentAngles.yaw = magHeading;
+  currentAngles.yaw = bam16ToBam32(magHeading);
 
   gyroAngles.roll = currentAngles.roll;
   gyroAngles.pitch = currentAngles.pitch;
   gyroAngles.yaw = currentAngles.yaw;
+#if defined(SENSOR_FIXED_POINT) || defined(AHRS_MAHONY)
+  loadSensorStateFixed();
+#endif
+#ifdef AHRS_MAHONY
+  ahrsSetAngles(&currentAngles);
+#endif
+}
+
+// true once currentAngles holds the starting attitude
+bool angleInitialisationStep() {
+  unsigned long now = micros();
+  if (angleCount < angleSamples && now - lastAngleSample >= angleSamplePeriod) {
+    lastAngleSample = now;
+    if (readGyrosAccels()) {
+      applyAccelOffsets();
+      accumulateAccelReadings();
+#ifdef GYRO_BIAS_ONLINE
+      applyGyroOffsets();
+      sumGyroForBias();
+#endif
+      angleCount++;
+    }
+  }
+  if (headingCount < headingSamples && now - lastHeadingSample >= headingSamplePeriod) {
+    lastHeadingSample = now;
+    if (readMag()) {
+      headingSum[0] += mx;
+      headingSum[1] += my;
+      headingCount++;
+    }
+  }
+  if (angleCount < angleSamples || headingCount < headingSamples) return false;
+  finishAngleInitialisation();
+  return true;
 }
 
 
@@ -1,73 +1,175 @@
-const uint16_t CYCLE_TICKS = 5000; // 10000ticks, 5000us, 5ms, 200Hz
+// ESC protocol (Parameters.h): PWM runs its own free running frame, OneShot125 and Multishot
+// send one set of pulses each time processMotors has new values (ESC_SYNCHRONOUS), and so
+// does DShot, without the timer (ESC_DSHOT)
+#if ESC_PROTOCOL == ESC_PROTOCOL_ONESHOT125 || ESC_PROTOCOL == ESC_PROTOCOL_MULTISHOT
+#define ESC_SYNCHRONOUS
+#elif ESC_PROTOCOL == ESC_PROTOCOL_DSHOT150 || ESC_PROTOCOL == ESC_PROTOCOL_DSHOT300
+#define ESC_DSHOT
+#endif
+#if ESC_PROTOCOL != ESC_PROTOCOL_PWM && defined(ESC_HARDWARE_PWM)
+#error "ESC_HARDWARE_PWM only makes PWM pulses"
+#endif
+
+const uint16_t CYCLE_TICKS = 5000; // 5000 ticks, 2500us, 400Hz
 uint16_t escTicks[4];
-uint16_t escTicksEndMain[4];
-uint16_t volatile escTicksEndTemp[4];
-uint16_t escTicksEndIsr[4];  // copy to use in IRS
 uint8_t escOrderMain[4];
-uint8_t volatile escOrderTemp[4];
-uint8_t escOrderIsr[4];  // copy to use in IRS
+// the pulses as a list of edges, worked out by loop() so the ISR only has to walk through it:
+// each interrupt applies one edge to PORTD and sets the compare for the next
+struct escEdge {
+  uint16_t tick;  // Timer1 count the edge is due at
+  uint8_t set;    // PORTD bits to raise
+  uint8_t keep;   // PORTD bits to leave alone, the rest are cleared
+};
+struct escSchedule {
+  escEdge edges[8];   // starts then ends, motors with the same pulse share theirs
+  uint8_t count;
+  uint8_t startPins;  // ESC_SYNCHRONOUS: raised together by startSynchronousPulses, the edges only end pulses
+};
+// handed to the ISR through Handoff.h, it takes the newest one at the end of each frame and
+// keeps using it until the next
+Handoff<escSchedule> escScheduleHandoff;
+const escSchedule *escScheduleIsr = &escScheduleHandoff.slots[0];  // the one the ISR is working through
 uint8_t escIndex = 0;
-bool volatile lockPulses = false;
-bool volatile needUpdatePulses = false; // this needs to be set to true after the rate PID runs
-enum GenerationCycle {START_PULSES, END_PULSES, RESET};
-GenerationCycle escPulseGenerationCycle = RESET;
-const uint16_t PULSE_GAP = 100;  // gap between starting pulses, in ticks
+volatile bool escPulsesRunning = false;  // ESC_SYNCHRONOUS, a set is going out
+// PWM staggers the starts PULSE_GAP apart in 0.5us ticks; OneShot125 (PWM at an eighth of the
+// length) and Multishot run Timer1 at 62.5ns (no prescaler), where the edges come closer than
+// the interrupt can make them one by one, so every pulse starts in the same PORTD write and
+// only the ends are timed, from a sorted list
+const uint16_t PULSE_GAP = 100;  // gap between starting pulses, in ticks (50us), PWM
 const uint16_t escTicksStart[4] = {PULSE_GAP, PULSE_GAP * 2, PULSE_GAP * 3, PULSE_GAP * 4};
+const uint16_t ESC_EDGE_MERGE_TICKS = 160;  // 10us, ends closer than this are made in the same interrupt
+const uint16_t ESC_ISR_LEAD_TICKS = 80;     // 5us, the compare fires this far ahead so the interrupt can wait for the tick
+const uint16_t ESC_MIN_COMPARE_TICKS = 16;  // a compare at 0 would be missed, TCNT1 has only just been cleared
+const uint16_t ESC_END_MERGE_TICKS = 24;    // 1.5us, what the interrupt takes per end: closer ends go out
+                                            // together, halfway between, so neither is out by more than 0.75us
+const uint16_t ESC_END_LATE_TICKS = 11;     // an end comes out this long after its tick (the start write is before
+                                            // TCNT1 = 0, then the wait and the write), so it is asked for that early
 
 // these pins are currently hardcoded within the pulse generation function (direct port manipulation)
+const uint8_t motorPortBit[4] = {B00001000, B01000000, B00010000, B00100000};  // pins 3, 6, 4, 5
+#ifdef ESC_HARDWARE_PWM
+const byte pinMotor1 = 9;  // front left (CW), OC1A
+const byte pinMotor2 = 10; // front right (CCW), OC1B
+const byte pinMotor3 = 3;  // back left (CCW), OC2B
+const byte pinMotor4 = 6;  // back right (CW), from the Timer2 interrupts (OC2A is the SPI MOSI pin)
+#else
 const byte pinMotor1 = 3; // front left (CW)
 const byte pinMotor2 = 6; // front right (CCW)
 const byte pinMotor3 = 4; // back left (CCW)
 const byte pinMotor4 = 5; // back right (CW)
+#endif
 
-int motor1pulse;
-int motor2pulse;
-int motor3pulse;
-int motor4pulse;
+const uint8_t MOTOR_COUNT = 4;  // the ESC outputs below drive four motors
+int motorPulse[MOTOR_COUNT];
 
 // ****************************************************************************************
-//        FUNCTIONS FOR CALCULATING MOTOR PULSES
+//        MIXER
+//    each motor gets throttle plus the roll, pitch and yaw PID outputs weighted by its row of
+//    the frame's table (Q8, MIXER_ONE is 1.0, left motors +roll, front -pitch, CW +yaw)
+//    then the corrections are fitted between THROTTLE_MIN_SPIN and THROTTLE_LIMIT in one pass
+//    over the motors for the lowest and highest one:
+//    shifting them as a block (the original quad code, bit for bit with MIXER_QUAD_X), and
+//    with MIXER_AIRMODE scaling them down first when they need more room than there is, so
+//    the motors never leave the range and the attitude keeps its authority at either end
+//    below THROTTLE_MIN_SPIN on the stick every motor stops, as before
 // ****************************************************************************************
 
-void calculateMotorInput(int throttle, float rollOffset, float pitchOffset, float yawOffset) {
-  motor1pulse = throttle + (int) rollOffset - (int) pitchOffset + (int) yawOffset;
-  motor2pulse = throttle - (int) rollOffset - (int) pitchOffset - (int) yawOffset;
-  motor3pulse = throttle + (int) rollOffset + (int) pitchOffset - (int) yawOffset;
-  motor4pulse = throttle - (int) rollOffset + (int) pitchOffset + (int) yawOffset;
-}
-
-void capMotorInputNearMaxThrottle() {
-  int maxMotorValue = max(motor1pulse, max(motor2pulse, max(motor3pulse, motor4pulse)));
-  int adj = maxMotorValue - THROTTLE_LIMIT;
-  if (adj > 0) {
-    motor1pulse -= adj;
-    motor2pulse -= adj;
-    motor3pulse -= adj;
-    motor4pulse -= adj;
-  }
-}
+struct mixerRow {
+  int16_t roll;
+  int16_t pitch;
+  int16_t yaw;
+};
+
+const int16_t MIXER_ONE = 256;
+
+// 1 front left (CW), 2 front right (CCW), 3 back left (CCW), 4 back right (CW)
+const mixerRow mixerQuadX[4] PROGMEM = {
+  { MIXER_ONE, -MIXER_ONE,  MIXER_ONE},
+  {-MIXER_ONE, -MIXER_ONE, -MIXER_ONE},
+  { MIXER_ONE,  MIXER_ONE, -MIXER_ONE},
+  {-MIXER_ONE,  MIXER_ONE,  MIXER_ONE},
+};
+
+// 1 front (CW), 2 right (CCW), 3 back (CW), 4 left (CCW)
+const mixerRow mixerQuadPlus[4] PROGMEM = {
+  {         0, -MIXER_ONE,  MIXER_ONE},
+  {-MIXER_ONE,          0, -MIXER_ONE},
+  {         0,  MIXER_ONE,  MIXER_ONE},
+  { MIXER_ONE,          0, -MIXER_ONE},
+};
 
-void capMotorInputNearMinThrottle(int throttle) {
+// clockwise from front right (CCW), arms 60 degrees apart, sin/cos 30 = 128/222
+const mixerRow mixerHexX[6] PROGMEM = {
+  {      -128, -222, -MIXER_ONE},
+  {-MIXER_ONE,    0,  MIXER_ONE},
+  {      -128,  222, -MIXER_ONE},
+  {       128,  222,  MIXER_ONE},
+  { MIXER_ONE,    0, -MIXER_ONE},
+  {       128, -222,  MIXER_ONE},
+};
+
+// front left, front right and back arms, top (CW) then bottom (CCW) motor of each
+// the back arm pitches twice as hard as each front one, so the pitch column adds up to 0
+const mixerRow mixerY6[6] PROGMEM = {
+  { MIXER_ONE, -171,  MIXER_ONE},
+  { MIXER_ONE, -171, -MIXER_ONE},
+  {-MIXER_ONE, -171,  MIXER_ONE},
+  {-MIXER_ONE, -171, -MIXER_ONE},
+  {         0,  341,  MIXER_ONE},
+  {         0,  341, -MIXER_ONE},
+};
+
+#if MIXER_FRAME == MIXER_QUAD_X
+#define mixerTable mixerQuadX
+#elif MIXER_FRAME == MIXER_QUAD_PLUS
+#define mixerTable mixerQuadPlus
+#else
+#error "the ESC outputs only drive four motors, MIXER_HEX_X and MIXER_Y6 are for the bench for now"
+#endif
+
+#ifdef MIXER_AIRMODE
+const bool mixerAirMode = true;
+#else
+const bool mixerAirMode = false;
+#endif
+
+template <uint8_t Motors>
+void mixMotors(const mixerRow (&mixer)[Motors], bool airMode, int throttle, int roll, int pitch, int yaw, int *pulses) {
   if (throttle < THROTTLE_MIN_SPIN) { //this is the base throttle i.e. if stick is low, no motor should move even if there's a big movements
-    motor1pulse = ZERO_THROTTLE;
-    motor2pulse = ZERO_THROTTLE;
-    motor3pulse = ZERO_THROTTLE;
-    motor4pulse = ZERO_THROTTLE;
+    for (uint8_t m = 0; m < Motors; m++) pulses[m] = ZERO_THROTTLE;
+    return;
   }
-  else {
-    int minMotorValue = min(motor1pulse, min(motor2pulse, min(motor3pulse, motor4pulse)));
-    int adj = THROTTLE_MIN_SPIN - minMotorValue;
-    if (adj > 0) {
-      motor1pulse += adj;
-      motor2pulse += adj;
-      motor3pulse += adj;
-      motor4pulse += adj;
+  int lowest = 0, highest = 0;
+  for (uint8_t m = 0; m < Motors; m++) {
+    long sum = (long)(int16_t)pgm_read_word_near(&mixer[m].roll) * roll
+               + (long)(int16_t)pgm_read_word_near(&mixer[m].pitch) * pitch
+               + (long)(int16_t)pgm_read_word_near(&mixer[m].yaw) * yaw;
+    int offset = (int)(sum >> 8);
+    pulses[m] = offset;
+    if (m == 0 || offset < lowest) lowest = offset;
+    if (m == 0 || offset > highest) highest = offset;
+  }
+  if (airMode) {
+    const int room = THROTTLE_LIMIT - THROTTLE_MIN_SPIN;
+    int range = highest - lowest;
+    if (range > room) {
+      // the same fraction off every correction, the lowest and highest scale with them
+      uint16_t scale = (uint16_t)(((long)room << 8) / range);
+      for (uint8_t m = 0; m < Motors; m++) pulses[m] = (int)(((long)pulses[m] * scale) >> 8);
+      lowest = (int)(((long)lowest * scale) >> 8);
+      highest = (int)(((long)highest * scale) >> 8);
     }
+    throttle = constrain(throttle, THROTTLE_MIN_SPIN - lowest, THROTTLE_LIMIT - highest);
+  }
+  else {
+    int adj = throttle + highest - THROTTLE_LIMIT;  // the highest motor down to the limit
+    if (adj > 0) throttle -= adj;
+    adj = THROTTLE_MIN_SPIN - (throttle + lowest);  // then the lowest up to min spin
+    if (adj > 0) throttle += adj;
   }
+  for (uint8_t m = 0; m < Motors; m++) pulses[m] += throttle;
 }
 
-
-
 // ****************************************************************************************
 //        FUNCTIONS FOR ESC CREATION
 // ****************************************************************************************
@@ -76,11 +178,21 @@ void capMotorInputNearMinThrottle(int throttle) {
 static void setupPulseTimer() {
   cli();
   TCCR1A = 0;             // normal counting mode
-  TCCR1B = _BV(CS11);     // set prescaler of 8 - 2 ticks per microsecond
+#ifdef ESC_SYNCHRONOUS
+  TCCR1B = _BV(CS10);     // no prescaler - 16 ticks per microsecond
   TCNT1 = 0;              // clear the timer count
   TIFR1 |= _BV(OCF1A);     // clear any pending interrupts;
+  // the compare interrupt is enabled for each set of pulses, by startSynchronousPulses
+#else
+  // CTC with TOP in ICR1, the counter goes back to 0 every frame by itself and compare A
+  // is free to make the edges
+  TCCR1B = _BV(WGM13) | _BV(WGM12) | _BV(CS11);  // set prescaler of 8 - 2 ticks per microsecond
+  ICR1 = CYCLE_TICKS - 1;
+  TCNT1 = 0;              // clear the timer count
+  OCR1A = escScheduleIsr->edges[0].tick;
+  TIFR1 |= _BV(OCF1A);     // clear any pending interrupts;
   TIMSK1 |=  _BV(OCIE1A) ; // enable the output compare interrupt
-  OCR1A = CYCLE_TICKS;
+#endif
   sei(); // enable interrupts
 }
 
@@ -91,85 +203,346 @@ static void endPulseTimer() {
   sei();
 }
 
+static inline void takeNewPulses() {
+  escScheduleIsr = &escScheduleHandoff.take();
+}
+
+// one edge per interrupt, the pins first so they change at the same point after the match
+// whichever motors they belong to
 static inline void generate_esc_pulses() {
+  const escEdge *edge = &escScheduleIsr->edges[escIndex];
+  PORTD = (PORTD | edge->set) & edge->keep;
+  escIndex++;
+  if (escIndex == escScheduleIsr->count) {
+    escIndex = 0;
+    takeNewPulses();  // the newest schedule, or the same one again
+  }
+  OCR1A = escScheduleIsr->edges[escIndex].tick;  // the next frame's first edge comes after TOP
+}
 
-  if (escPulseGenerationCycle == START_PULSES) {  // interupt has fired and we're starting the pulses
-    uint8_t currentEsc = escOrderIsr[escIndex];
-    if (currentEsc == 1) PORTD |= B00001000; // set bit/pin 3 HIGH
-    if (currentEsc == 2) PORTD |= B01000000; // set bit/pin 6 HIGH
-    if (currentEsc == 3) PORTD |= B00010000; // set bit/pin 4 HIGH
-    if (currentEsc == 4) PORTD |= B00100000; // set bit/pin 5 HIGH
-    escIndex++;
-    if (escIndex > 3) {
-      escIndex = 0;
-      OCR1A = escTicksEndIsr[0]; // set to end time of first pulse
-      escPulseGenerationCycle = END_PULSES;
+// the compare fires ESC_ISR_LEAD_TICKS ahead of an end so the interrupt can wait on the counter
+// for the exact tick, then it makes every other end due within ESC_EDGE_MERGE_TICKS the same way
+// the ends only ever clear pins, so keep alone does it
+static inline void generate_synchronous_pulses() {
+  const escSchedule *schedule = escScheduleIsr;
+  uint8_t index = escIndex;
+  uint16_t due = schedule->edges[index].tick;
+  do {
+    while ((int16_t)(TCNT1 - due) < 0) {}
+    PORTD &= schedule->edges[index].keep;
+    if (++index == schedule->count) {
+      TIMSK1 &= ~_BV(OCIE1A);  // quiet until processMotors has the next values
+      escPulsesRunning = false;
+      return;
     }
-    else {
-      OCR1A = escTicksStart[escIndex];  // next interrupt when the next pulse needs to start
-    }
-  }
+    due = schedule->edges[index].tick;
+  } while ((int16_t)(due - TCNT1) < (int16_t)ESC_EDGE_MERGE_TICKS);
+  escIndex = index;
+  OCR1A = due - ESC_ISR_LEAD_TICKS;
+  TIFR1 = _BV(OCF1A);  // a match passed while waiting is already done
+}
+
+static inline uint16_t escCompareFor(uint16_t tick) {
+  return tick > ESC_MIN_COMPARE_TICKS + ESC_ISR_LEAD_TICKS ? tick - ESC_ISR_LEAD_TICKS : ESC_MIN_COMPARE_TICKS;
+}
 
-  else if (escPulseGenerationCycle == END_PULSES) {  // interupt has fired and we're ending the pulses
-    uint8_t currentEsc = escOrderIsr[escIndex];
-    if (currentEsc == 1) PORTD &= B11110111;
-    if (currentEsc == 2) PORTD &= B10111111;
-    if (currentEsc == 3) PORTD &= B11101111;
-    if (currentEsc == 4) PORTD &= B11011111;
-    escIndex++;
-    if (escIndex > 3) {
-      OCR1A = CYCLE_TICKS;
-      escIndex = 0;
-      escPulseGenerationCycle = RESET; // reset back to beginning
-      // new data is available then update the ISR variables
-      if (!lockPulses && needUpdatePulses) {
-        escOrderIsr[0] = escOrderTemp[0];
-        escOrderIsr[1] = escOrderTemp[1];
-        escOrderIsr[2] = escOrderTemp[2];
-        escOrderIsr[3] = escOrderTemp[3];
-        escTicksEndIsr[0] = escTicksEndTemp[0];
-        escTicksEndIsr[1] = escTicksEndTemp[1];
-        escTicksEndIsr[2] = escTicksEndTemp[2];
-        escTicksEndIsr[3] = escTicksEndTemp[3];
-        needUpdatePulses = false;
-      }
+// right after processMotors, so the pulses go out as soon as the values exist: every pin goes
+// high here and Timer1 counts the widths from that write
+// a set still going out (a slower control loop than the pulses) keeps the new values for next time
+void startSynchronousPulses() {
+  if (escPulsesRunning) return;
+  takeNewPulses();  // the compare interrupt is off, loop() is the consumer for now
+  escIndex = 0;
+  escPulsesRunning = true;
+  OCR1A = escCompareFor(escScheduleIsr->edges[0].tick);
+  uint8_t oldSREG = SREG;
+  cli();
+  PORTD |= escScheduleIsr->startPins;
+  TCNT1 = 0;
+  // armed before interrupts are back on: a pending one may run past the first compare, which
+  // then has to be left pending to be serviced, not cleared, or the pins stay up till TCNT1 wraps
+  TIFR1 = _BV(OCF1A);
+  TIMSK1 |= _BV(OCIE1A);
+  SREG = oldSREG;
+}
+
+// sorted pulses (sortPulses) to edges: motors with the same pulse start and end together, the
+// others start PULSE_GAP apart as before, so no two ends can land on top of each other
+static void buildEdgeSchedule(escSchedule &schedule) {
+  uint8_t groupPins[4];
+  uint16_t groupEnd[4];
+  uint8_t groups = 0;
+  for (uint8_t i = 0; i < 4; i++) {
+    uint8_t pin = motorPortBit[escOrderMain[i] - 1];
+    if (groups > 0 && escTicks[i] == escTicks[i - 1]) {
+      groupPins[groups - 1] |= pin;
     }
     else {
-      OCR1A = escTicksEndIsr[escIndex];
+      groupPins[groups] = pin;
+      groupEnd[groups] = escTicks[i] + escTicksStart[groups];
+      groups++;
     }
   }
+  for (uint8_t g = 0; g < groups; g++) {
+    schedule.edges[g].tick = escTicksStart[g];
+    schedule.edges[g].set = groupPins[g];
+    schedule.edges[g].keep = 0xFF;
+    schedule.edges[groups + g].tick = groupEnd[g];
+    schedule.edges[groups + g].set = 0;
+    schedule.edges[groups + g].keep = ~groupPins[g];
+  }
+  schedule.count = groups * 2;
+  schedule.startPins = 0;
+}
 
-  else {  // i.e. escPulseGenerationCycle = RESET;
-    TCNT1 = 0;  // reset the timer
-    OCR1A = PULSE_GAP;  // start again after the standard gap
-    escPulseGenerationCycle = START_PULSES; // next time interupt fire we want to start the pulses
+// ESC_SYNCHRONOUS: sorted pulses to ends only, all counted from the one start; ends that are
+// closer than ESC_END_MERGE_TICKS to the first of their run go out together, halfway along it
+// built whatever ESC_PROTOCOL is, so quadcopter_bench can check it for both protocols
+void buildSynchronousSchedule(escSchedule &schedule) {
+  uint8_t count = 0;
+  uint8_t i = 0;
+  schedule.startPins = 0;
+  while (i < 4) {
+    uint8_t pins = 0;
+    uint16_t first = escTicks[i];
+    uint16_t last = first;
+    while (i < 4 && escTicks[i] - first < ESC_END_MERGE_TICKS) {
+      pins |= motorPortBit[escOrderMain[i] - 1];
+      last = escTicks[i];
+      i++;
+    }
+    schedule.edges[count].tick = first + ((last - first) >> 1) - ESC_END_LATE_TICKS;
+    schedule.edges[count].set = 0;
+    schedule.edges[count].keep = ~pins;
+    schedule.startPins |= pins;
+    count++;
   }
+  schedule.count = count;
+}
+
+// the ISR may fire at any point in here, it keeps going on the schedule it already has
+void makePulseInfoAvailableToISR() {
+#ifdef ESC_SYNCHRONOUS
+  buildSynchronousSchedule(escScheduleHandoff.startWrite());
+#else
+  buildEdgeSchedule(escScheduleHandoff.startWrite());
+#endif
+  escScheduleHandoff.publish();
+}
+
+// nothing to send until the first processMotors, one edge that changes no pins
+static void publishIdleSchedule() {
+  escSchedule &schedule = escScheduleHandoff.startWrite();
+  schedule.edges[0].tick = PULSE_GAP;
+  schedule.edges[0].set = 0;
+  schedule.edges[0].keep = 0xFF;
+  schedule.count = 1;
+  schedule.startPins = 0;
+  escScheduleHandoff.publish();
+  takeNewPulses();  // before the timer starts
+  escIndex = 0;
+}
+
+// ****************************************************************************************
+//        HARDWARE PWM (ESC_HARDWARE_PWM)
+//    the compare outputs make the edges, so they don't move with I2C or serial interrupts:
+//    Timer1 fast PWM with TOP in ICR1 for motors 1 and 2 (0.5us steps, 400Hz), Timer2 fast PWM
+//    for motor 3 (8us steps, 488Hz)
+//    motor 4 would need OC2A, which is the radio's MOSI, so Timer2 runs it in software instead:
+//    the overflow sets the pin and compare match A clears it, two short interrupts per frame
+//    the compare registers are double buffered by the timers (taken at BOTTOM), so a new set
+//    of pulses never cuts one short and no interrupt has to hand them over
+// ****************************************************************************************
+
+const uint16_t ESC_PWM_FRAME_TICKS = 5000;  // Timer1, 0.5us ticks
+const uint8_t ESC_PWM8_MAX = 254;  // Timer2, 8us ticks
+
+#ifdef ESC_HARDWARE_PWM
+static void setupPwmTimers() {
+  cli();
+  // Timer1 mode 14, OC1A/OC1B set at BOTTOM and cleared at the match, prescaler 8
+  TCCR1A = _BV(COM1A1) | _BV(COM1B1) | _BV(WGM11);
+  TCCR1B = _BV(WGM13) | _BV(WGM12) | _BV(CS11);
+  ICR1 = ESC_PWM_FRAME_TICKS - 1;
+  OCR1A = 0;
+  OCR1B = 0;
+  TCNT1 = 0;
+  TIMSK1 = 0;
+  // Timer2 mode 3 (TOP 0xFF), OC2B set at BOTTOM and cleared at the match, OC2A disconnected, prescaler 128
+  TCCR2A = _BV(COM2B1) | _BV(WGM21) | _BV(WGM20);
+  TCCR2B = _BV(CS22) | _BV(CS20);
+  OCR2A = 0;
+  OCR2B = 0;
+  TCNT2 = 0;
+  TIFR2 = _BV(OCF2A) | _BV(TOV2);  // clear any pending interrupts
+  TIMSK2 = _BV(OCIE2A) | _BV(TOIE2);
+  sei();
+}
+#endif
+
+// the output is high for OCR + 1 timer ticks, kept below TOP so it always comes down again
+static inline uint16_t pulseToPwm16(int pulse) {
+  return (uint16_t)constrain(pulse, 1, (ESC_PWM_FRAME_TICKS >> 1) - 1) * 2 - 1;
+}
+
+static inline uint8_t pulseToPwm8(int pulse) {
+  int ticks = ((pulse + 4) >> 3) - 1;
+  return (uint8_t)constrain(ticks, 0, ESC_PWM8_MAX);
+}
+
+// no interrupt writes Timer1 registers in this mode, so the 16 bit writes need no cli
+void writePwmOutputs() {
+  OCR1A = pulseToPwm16(motorPulse[0]);
+  OCR1B = pulseToPwm16(motorPulse[1]);
+  OCR2B = pulseToPwm8(motorPulse[2]);
+  OCR2A = pulseToPwm8(motorPulse[3]);
+}
+
+static inline void escPwmFrameStart() {
+  PORTD |= B01000000; // set bit/pin 6 HIGH
+}
+
+static inline void escPwmPulseEnd() {
+  PORTD &= B10111111;
 }
 
+#ifdef ESC_HARDWARE_PWM
+ISR(TIMER2_OVF_vect) {
+  CYCLE_MARK_BEGIN(CYCLE_STAGE_ESC_ISR);
+  escPwmFrameStart();
+  CYCLE_MARK_END(CYCLE_STAGE_ESC_ISR);
+}
+
+ISR(TIMER2_COMPA_vect) {
+  CYCLE_MARK_BEGIN(CYCLE_STAGE_ESC_ISR);
+  escPwmPulseEnd();
+  CYCLE_MARK_END(CYCLE_STAGE_ESC_ISR);
+}
+#elif defined(ESC_DSHOT)
+// no interrupt
+#elif defined(ESC_SYNCHRONOUS)
 ISR(TIMER1_COMPA_vect) {
+  CYCLE_MARK_BEGIN(CYCLE_STAGE_ESC_ISR);
+  generate_synchronous_pulses();
+  CYCLE_MARK_END(CYCLE_STAGE_ESC_ISR);
+}
+#else
+ISR(TIMER1_COMPA_vect) {
+  CYCLE_MARK_BEGIN(CYCLE_STAGE_ESC_ISR);
   generate_esc_pulses();
+  CYCLE_MARK_END(CYCLE_STAGE_ESC_ISR);
 }
+#endif
 
-// note that interupts are expected to be turned off when this is called
-void makePulseInfoAvailableToISR() {
-  lockPulses = true;
-  escOrderTemp[0] = escOrderMain[0];
-  escOrderTemp[1] = escOrderMain[1];
-  escOrderTemp[2] = escOrderMain[2];
-  escOrderTemp[3] = escOrderMain[3];
-  escTicksEndTemp[0] = escTicksEndMain[0];
-  escTicksEndTemp[1] = escTicksEndMain[1];
-  escTicksEndTemp[2] = escTicksEndMain[2];
-  escTicksEndTemp[3] = escTicksEndMain[3];
-  lockPulses = false;
-  needUpdatePulses = true;
+// ****************************************************************************************
+//        DSHOT (ESC_PROTOCOL_DSHOT150 / ESC_PROTOCOL_DSHOT300)
+//    16 bit frames, MSB first: 11 bit throttle (0 stop, 48-2047 throttle), telemetry request,
+//    4 bit CRC; a 1 is high for 3/4 of the bit, a 0 for 3/8
+//    the four frames are turned into one PORTD value per bit, the pins whose bit is 1, and all
+//    four motors are bit banged at once with interrupts off (53us DShot300, 107us DShot150)
+//    the loop is counted in cycles at 16MHz, so the bit is 107 or 53 cycles (+0.3% / -0.6%)
+// ****************************************************************************************
+
+const uint8_t DSHOT_BITS = 16;
+const uint8_t DSHOT150_BIT_CYCLES = 107, DSHOT150_ZERO_CYCLES = 40, DSHOT150_ONE_CYCLES = 80;
+const uint8_t DSHOT300_BIT_CYCLES = 53, DSHOT300_ZERO_CYCLES = 20, DSHOT300_ONE_CYCLES = 40;
+const uint16_t DSHOT_THROTTLE_MIN = 48, DSHOT_THROTTLE_MAX = 2047;
+const uint8_t DSHOT_MOTOR_MASK = B01111000;
+
+uint16_t dshotPackets[4];
+uint8_t dshotPortBits[DSHOT_BITS + 1];  // one spare, the loop reads one ahead
+
+// ZERO_THROTTLE and below stop the motor, the rest of the pulse range spreads over 48-2047
+static inline uint16_t pulseToDshot(int pulse) {
+  if (pulse <= ZERO_THROTTLE) return 0;
+  long value = DSHOT_THROTTLE_MIN + (long)(pulse - ZERO_THROTTLE) * (DSHOT_THROTTLE_MAX - DSHOT_THROTTLE_MIN) / 1000;
+  return (uint16_t)min(value, (long)DSHOT_THROTTLE_MAX);
+}
+
+static inline uint16_t dshotPacket(uint16_t value, bool telemetry) {
+  uint16_t frame = value << 1 | telemetry;
+  uint8_t crc = (frame ^ (frame >> 4) ^ (frame >> 8)) & 0x0F;
+  return frame << 4 | crc;
+}
+
+void buildDshotFrames() {
+  dshotPackets[0] = dshotPacket(pulseToDshot(motorPulse[0]), false);
+  dshotPackets[1] = dshotPacket(pulseToDshot(motorPulse[1]), false);
+  dshotPackets[2] = dshotPacket(pulseToDshot(motorPulse[2]), false);
+  dshotPackets[3] = dshotPacket(pulseToDshot(motorPulse[3]), false);
+  for (uint8_t i = 0; i < DSHOT_BITS; i++) {
+    uint16_t bitMask = 0x8000 >> i;
+    uint8_t ones = 0;
+    for (uint8_t motor = 0; motor < 4; motor++) {
+      if (dshotPackets[motor] & bitMask) ones |= motorPortBit[motor];
+    }
+    dshotPortBits[i] = ones;
+  }
+}
+
+#ifdef __AVR__
+// out high, ZeroCycles later drop the 0s, OneCycles later drop the rest, then the next bit:
+// an out takes 1 cycle, ld 2, dec 1 and a taken brne 2, the nops make up the difference
+template <uint8_t BitCycles, uint8_t ZeroCycles, uint8_t OneCycles>
+static inline void dshotBitBang(const uint8_t *portValues, uint8_t high, uint8_t low) {
+  uint8_t value;
+  uint8_t count = DSHOT_BITS;
+  asm volatile(
+    "ld %[value], Z+\n\t"
+    "1:\n\t"
+    "out %[port], %[high]\n\t"
+    ".rept %[zeroWait]\n\tnop\n\t.endr\n\t"
+    "out %[port], %[value]\n\t"
+    ".rept %[oneWait]\n\tnop\n\t.endr\n\t"
+    "out %[port], %[low]\n\t"
+    ".rept %[bitWait]\n\tnop\n\t.endr\n\t"
+    "ld %[value], Z+\n\t"
+    "dec %[count]\n\t"
+    "brne 1b\n\t"
+    : [value] "=&r" (value), [count] "+r" (count), "+z" (portValues)
+    : [port] "I" (_SFR_IO_ADDR(PORTD)), [high] "r" (high), [low] "r" (low),
+      [zeroWait] "n" (ZeroCycles - 1), [oneWait] "n" (OneCycles - ZeroCycles - 1),
+      [bitWait] "n" (BitCycles - OneCycles - 6));
+}
+#else
+// the host HAL records the edges at the cycles the AVR loop makes them
+template <uint8_t BitCycles, uint8_t ZeroCycles, uint8_t OneCycles>
+static inline void dshotBitBang(const uint8_t *portValues, uint8_t high, uint8_t low) {
+  portDWaveform(portValues, DSHOT_BITS, high, low, BitCycles, ZeroCycles, OneCycles);
+}
+#endif
+
+// the other PORTD pins keep the levels they had, nothing else writes PORTD with interrupts off
+template <uint8_t BitCycles, uint8_t ZeroCycles, uint8_t OneCycles>
+void sendDshotFrames() {
+  uint8_t portValues[DSHOT_BITS + 1];
+  uint8_t oldSREG = SREG;
+  cli();
+  uint8_t low = PORTD & ~DSHOT_MOTOR_MASK;
+  for (uint8_t i = 0; i <= DSHOT_BITS; i++) portValues[i] = low | dshotPortBits[i];
+  dshotBitBang<BitCycles, ZeroCycles, OneCycles>(portValues, low | DSHOT_MOTOR_MASK, low);
+  SREG = oldSREG;
+}
+
+// PWM 1000-2000us in 0.5us ticks, OneShot125 125-250us in 62.5ns ticks (the same numbers),
+// Multishot 5-25us in 62.5ns ticks
+static inline uint16_t pulseToMultishotTicks(int pulse) {
+  return (uint16_t)(((long)constrain(pulse, 1000, 2000) - 1000) * 8 / 25 + 80);
+}
+
+static inline uint16_t pulseToTicks(int pulse) {
+#if ESC_PROTOCOL == ESC_PROTOCOL_MULTISHOT
+  return pulseToMultishotTicks(pulse);
+#else
+  return pulse << 1;
+#endif
 }
 
 void calculateRequiredTicks() {
-  escTicks[0] = motor1pulse << 1;
-  escTicks[1] = motor2pulse << 1;
-  escTicks[2] = motor3pulse << 1;
-  escTicks[3] = motor4pulse << 1;
+  escTicks[0] = pulseToTicks(motorPulse[0]);
+  escTicks[1] = pulseToTicks(motorPulse[1]);
+  escTicks[2] = pulseToTicks(motorPulse[2]);
+  escTicks[3] = pulseToTicks(motorPulse[3]);
 }
 
 void resetOrder() {
@@ -198,25 +571,28 @@ void sortPulses() {
   }
 }
 
-void calcEndTimes() {
-  escTicksEndMain[0] = escTicks[0] + PULSE_GAP;
-  escTicksEndMain[1] = escTicks[1] + (2 * PULSE_GAP);
-  escTicksEndMain[2] = escTicks[2] + (3 * PULSE_GAP);
-  escTicksEndMain[3] = escTicks[3] + (4 * PULSE_GAP);
-}
-
 void recalculateMotorPulses() {
+#if defined(ESC_HARDWARE_PWM)
+  writePwmOutputs();
+#elif ESC_PROTOCOL == ESC_PROTOCOL_DSHOT150
+  buildDshotFrames();
+  sendDshotFrames<DSHOT150_BIT_CYCLES, DSHOT150_ZERO_CYCLES, DSHOT150_ONE_CYCLES>();
+#elif ESC_PROTOCOL == ESC_PROTOCOL_DSHOT300
+  buildDshotFrames();
+  sendDshotFrames<DSHOT300_BIT_CYCLES, DSHOT300_ZERO_CYCLES, DSHOT300_ONE_CYCLES>();
+#else
   resetOrder(); // reset escOrderMain
   calculateRequiredTicks(); // populate escTicks
   sortPulses(); // reorder escOrderMain and escTicks
-  calcEndTimes(); // what times should these finish - populate escTicksEndMain
-  makePulseInfoAvailableToISR();
+  makePulseInfoAvailableToISR(); // turn them into edges for the ISR
+#ifdef ESC_SYNCHRONOUS
+  startSynchronousPulses();
+#endif
+#endif
 }
 
 void processMotors(int throttle, float rateRollOutput, float ratePitchOutput, float rateYawOutput) {
-  calculateMotorInput(throttle, rateRollOutput, ratePitchOutput, rateYawOutput);
-  capMotorInputNearMaxThrottle();
-  capMotorInputNearMinThrottle(throttle);
+  mixMotors(mixerTable, mixerAirMode, throttle, (int) rateRollOutput, (int) ratePitchOutput, (int) rateYawOutput, motorPulse);
   recalculateMotorPulses();
 }
 
@@ -229,11 +605,14 @@ void setupMotors() {
   pinMode(pinMotor2, OUTPUT);
   pinMode(pinMotor3, OUTPUT);
   pinMode(pinMotor4, OUTPUT);
-  escTicks[1] = 2000;  // set starting pulse to 0.4micros (out of ESC range)
-  escTicks[2] = 2000;
-  escTicks[3] = 2000;
-  escTicks[4] = 2000;
+#if defined(ESC_HARDWARE_PWM)
+  setupPwmTimers();
+#elif defined(ESC_DSHOT)
+  PORTD &= ~DSHOT_MOTOR_MASK;  // no timer, the frames go out from processMotors
+#else
+  publishIdleSchedule();
   setupPulseTimer();
+#endif
 }
 
 // ****************************************************************************************
@@ -242,10 +621,7 @@ void setupMotors() {
 
 
 void setMotorsLow() {
-  motor1pulse = 1000;
-  motor2pulse = 1000;
-  motor3pulse = 1000;
-  motor4pulse = 1000;
+  for (uint8_t m = 0; m < MOTOR_COUNT; m++) motorPulse[m] = 1000;
   recalculateMotorPulses();
 }
 
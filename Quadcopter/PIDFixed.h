@@ -0,0 +1,210 @@
+// ****************************************************************************************
+// Fixed point version of the PID class in PID.h
+//    same behaviour (integral windup clamp, derivative on measurement, Compute(allTerms),
+//    gains prescaled by the sample time) but the per-cycle maths is 16x16->32 bit integer
+//    multiplies, which the AVR does in hardware, instead of software float
+//    the maths is in pidFixedState and the pidFixed functions, which PidBank.h runs the
+//    firmware's loops on with PID_FIXED_POINT in Parameters.h; the PIDFixed class wraps one
+//    of them behind PID's interface for the bench
+//    sample times are in MICROseconds, as PidBank's (PID.h takes millis)
+// ****************************************************************************************
+
+// FIXED POINT FORMATS
+// values (inputs, setpoints, outputs): Q11.4, 1/16 unit resolution, +/-2047 range
+// kp, kd: Q3.12, up to 7.99 (kd here is already divided by the sample time)
+// ki: Q0.16, up to 0.49 (already multiplied by the sample time, so always small)
+// products of a value with kp/kd land in Q16, the integral accumulates in Q20
+const byte PID_VALUE_FRAC_BITS = 4;
+const byte PID_GAIN_FRAC_BITS = 12;
+const byte PID_KI_FRAC_BITS = 16;
+const byte PID_OUTPUT_FRAC_BITS = PID_VALUE_FRAC_BITS + PID_GAIN_FRAC_BITS;
+const byte PID_ITERM_FRAC_BITS = PID_VALUE_FRAC_BITS + PID_KI_FRAC_BITS;
+const float PID_VALUE_SCALE = (float)(1 << PID_VALUE_FRAC_BITS);
+const float PID_VALUE_TO_FLOAT = 1.0f / PID_VALUE_SCALE;
+
+static inline int16_t saturate16(int32_t x) {
+  if (x > 32767) return 32767;
+  if (x < -32767) return -32767;
+  return (int16_t)x;
+}
+
+// gains are only converted in setup so float is fine here
+static inline int16_t gainToFixed(float gain, byte fracBits) {
+  float scaled = gain * (float)(1UL << fracBits);
+  if (scaled > 32767.0f) return 32767;
+  if (scaled < -32767.0f) return -32767;
+  return (int16_t)(scaled < 0 ? scaled - 0.5f : scaled + 0.5f);
+}
+
+static inline int16_t pidValueToFixed(float value) {
+  return saturate16((int32_t)(value * PID_VALUE_SCALE));
+}
+
+// one controller, gains already prescaled by the sample time
+struct pidFixedState {
+  int16_t kp;                  // Q3.12
+  int16_t ki;                  // Q0.16
+  int16_t kd;                  // Q3.12
+  int32_t iTerm;               // Q20
+  int16_t lastInput;           // Q11.4
+  int32_t outMin, outMax;      // Q16
+  int32_t iTermMin, iTermMax;  // Q20
+};
+
+static inline void pidFixedClampITerm(pidFixedState &pid) {
+  if (pid.iTerm > pid.iTermMax) pid.iTerm = pid.iTermMax;
+  else if (pid.iTerm < pid.iTermMin) pid.iTerm = pid.iTermMin;
+}
+
+// input, setpoint and returned output are all Q11.4
+// note the kp and kd products are not saturated, with the gain range above they can only
+// overflow when both error and dInput are over ~1000 units (deg/s) at full gain
+static inline int16_t pidFixedCompute(pidFixedState &pid, int16_t input, int16_t setpoint, bool allTerms) {
+  int16_t error = saturate16((int32_t)setpoint - input);
+  if (allTerms) {
+    pid.iTerm += (int32_t)pid.ki * error;
+    pidFixedClampITerm(pid);
+  }
+  int16_t dInput = saturate16((int32_t)input - pid.lastInput);
+  /*Compute PID Output*/
+  int32_t output = (int32_t)pid.kp * error - (int32_t)pid.kd * dInput;
+  if (allTerms) output += pid.iTerm >> (PID_ITERM_FRAC_BITS - PID_OUTPUT_FRAC_BITS);
+
+  if (output > pid.outMax) output = pid.outMax;
+  else if (output < pid.outMin) output = pid.outMin;
+  /*Remember some variables for next time*/
+  pid.lastInput = input;
+  return (int16_t)(output >> PID_GAIN_FRAC_BITS);
+}
+
+static inline void pidFixedSetOutputLimits(pidFixedState &pid, float Min, float Max) {
+  pid.outMin = (int32_t)pidValueToFixed(Min) << PID_GAIN_FRAC_BITS;
+  pid.outMax = (int32_t)pidValueToFixed(Max) << PID_GAIN_FRAC_BITS;
+  pid.iTermMin = pid.outMin << (PID_ITERM_FRAC_BITS - PID_OUTPUT_FRAC_BITS);
+  pid.iTermMax = pid.outMax << (PID_ITERM_FRAC_BITS - PID_OUTPUT_FRAC_BITS);
+}
+
+static inline void pidFixedSetTunings(pidFixedState &pid, float Kp, float Ki, float Kd, unsigned long sampleTimeMicros) {
+  float SampleTimeInSec = ((float)sampleTimeMicros) * 0.000001f;
+  pid.kp = gainToFixed(Kp, PID_GAIN_FRAC_BITS);
+  pid.ki = gainToFixed(Ki * SampleTimeInSec, PID_KI_FRAC_BITS);
+  pid.kd = gainToFixed(Kd / SampleTimeInSec, PID_GAIN_FRAC_BITS);
+}
+
+// bumpless switch to automatic: the integral takes over the output as it was
+static inline void pidFixedInitialize(pidFixedState &pid, float input, float output) {
+  pid.iTerm = (int32_t)pidValueToFixed(output) << PID_KI_FRAC_BITS;
+  pid.lastInput = pidValueToFixed(input);
+  pidFixedClampITerm(pid);
+}
+
+class PIDFixed
+{
+  public:
+    PIDFixed(float* Input, float* Output, float* Setpoint,
+             float Kp, float Ki, float Kd, int ControllerDirection, unsigned long sampleTimeMicros)
+    {
+      myOutput = Output;
+      myInput = Input;
+      mySetpoint = Setpoint;
+      inAuto = false;
+      SampleTime = sampleTimeMicros;
+      pid.outMin = 0;
+      pid.outMax = 0;
+      pid.iTermMin = 0;
+      pid.iTermMax = 0;
+      pid.iTerm = 0;
+      pid.lastInput = 0;
+      SetControllerDirection(ControllerDirection);
+      SetTunings(Kp, Ki, Kd);
+    }
+
+    void SetMode(int Mode)
+    {
+      bool newAuto = (Mode == AUTOMATIC);
+      if (newAuto && !inAuto)
+      { /*we just went from manual to auto*/
+        PIDFixed::Initialize();
+      }
+      inAuto = newAuto;
+    }
+
+    // drop in replacement for PID::Compute, converts at the float boundary
+    void Compute(bool allTerms=true)
+    {
+      int16_t output = ComputeFixed(pidValueToFixed(*myInput), pidValueToFixed(*mySetpoint), allTerms);
+      *myOutput = (float)output * PID_VALUE_TO_FLOAT;
+    }
+
+    // input, setpoint and returned output are all Q11.4
+    int16_t ComputeFixed(int16_t input, int16_t setpoint, bool allTerms=true)
+    {
+      return pidFixedCompute(pid, input, setpoint, allTerms);
+    }
+
+    void SetOutputLimits(float Min, float Max)
+    {
+      if (Min >= Max) return;
+      pidFixedSetOutputLimits(pid, Min, Max);
+
+      if (inAuto)
+      {
+        if (*myOutput > Max) *myOutput = Max;
+        else if (*myOutput < Min) *myOutput = Min;
+        pidFixedClampITerm(pid);
+      }
+    }
+
+    void SetTunings(float Kp, float Ki, float Kd)
+    {
+      if (Kp < 0 || Ki < 0 || Kd < 0) return;
+      dispKp = Kp;
+      dispKi = Ki;
+      dispKd = Kd;
+
+      pidFixedSetTunings(pid, Kp, Ki, Kd, SampleTime);
+
+      if (controllerDirection == REVERSE)
+      {
+        pid.kp = (0 - pid.kp);
+        pid.ki = (0 - pid.ki);
+        pid.kd = (0 - pid.kd);
+      }
+    }
+
+    void SetControllerDirection(int Direction)
+    {
+      if (inAuto && Direction != controllerDirection)
+      {
+        pid.kp = (0 - pid.kp);
+        pid.ki = (0 - pid.ki);
+        pid.kd = (0 - pid.kd);
+      }
+      controllerDirection = Direction;
+    }
+
+    // the float version rescales ki and kd by the ratio, here they are re-derived from the
+    // stored gains so rounding error does not build up over repeated calls
+    void SetSampleTime(unsigned long NewSampleTimeMicros)
+    {
+      if (NewSampleTimeMicros > 0)
+      {
+        SampleTime = NewSampleTimeMicros;
+        SetTunings(dispKp, dispKi, dispKd);
+      }
+    }
+
+  private:
+    void Initialize()
+    {
+      pidFixedInitialize(pid, *myInput, *myOutput);
+    }
+    pidFixedState pid;
+    float dispKp, dispKi, dispKd;  // gains as given, for re-deriving on sample time changes
+    int controllerDirection;
+    float *myInput;
+    float *myOutput;
+    float *mySetpoint;
+    unsigned long SampleTime;  // MICROseconds
+    bool inAuto;
+};
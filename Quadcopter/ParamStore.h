@@ -0,0 +1,133 @@
+// ****************************************************************************************
+// Parameter store in the EEPROM
+//    the calibration (MotionSensor.h) and the PID gains (PIDSettings.h) as one record:
+//    [version][sequence][parameters][crc16], the compiled values are the defaults
+//    wear levelling: the EEPROM is cut into as many slots as records fit, each save goes to
+//    the slot after the newest one with the sequence one up, so a slot is rewritten once every
+//    PARAM_SLOTS saves (and eeprom_update_block leaves bytes that are already right alone)
+//    atomic: the newest slot with a good CRC wins, so a save cut short by a reset or brown out
+//    leaves the previous record in charge
+//    a record of another PARAM_STORE_VERSION (another layout) is ignored
+//    param_tool shows and edits an EEPROM image (avrdude -U eeprom:r / eeprom:w), so gains can
+//    be changed without reflashing
+// ****************************************************************************************
+
+#include <avr/eeprom.h>
+
+const uint16_t PARAM_STORE_VERSION = 1;  // bump whenever paramSet changes
+
+// floats first and an even number of int16s, so there is no padding and an image written by
+// the aircraft reads the same on the host (both little endian IEEE floats)
+struct paramSet {
+  float offsetScale[6];
+  float offsetIntercept[6];
+  float offsetAngle[3];
+  float rateGains[NUM_AXES][3];
+  float attitudeGains[NUM_AXES][3];
+  int16_t magOffset[2];
+  int16_t calibratedTemperature;
+  int16_t calibratedOffsets[6];
+  int16_t spare;
+};
+
+struct paramRecord {
+  uint16_t version;
+  uint16_t sequence;
+  paramSet params;
+  uint16_t crc;  // CRC-16/CCITT of everything before it
+};
+
+const uint16_t PARAM_SLOT_SIZE = 160;  // fixed rather than sizeof, which the host rounds up
+const byte PARAM_SLOTS = (E2END + 1) / PARAM_SLOT_SIZE;
+static_assert(sizeof(paramSet) == 152 && sizeof(paramRecord) <= PARAM_SLOT_SIZE, "paramRecord layout changed");
+
+byte paramSlot = PARAM_SLOTS - 1;  // where the current record is, the next save goes after it
+uint16_t paramSequence = 0;
+bool paramsLoaded = false;  // false while running on the compiled defaults
+
+static inline uint8_t *paramSlotAddress(byte slot) {
+  return (uint8_t *)(uintptr_t)(slot * PARAM_SLOT_SIZE);
+}
+
+// straight from the EEPROM a byte at a time, so checking a slot needs no RAM for the record
+bool paramSlotValid(byte slot, uint16_t *sequence) {
+  const uint8_t *address = paramSlotAddress(slot);
+  uint16_t header[2];  // version, sequence
+  eeprom_read_block(header, address, sizeof(header));
+  if (header[0] != PARAM_STORE_VERSION) return false;
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = 0; i < offsetof(paramRecord, crc); i++) {
+    crc = crc16Update(crc, eeprom_read_byte(address + i));
+  }
+  uint16_t stored;
+  eeprom_read_block(&stored, address + offsetof(paramRecord, crc), sizeof(stored));
+  *sequence = header[1];
+  return crc == stored;
+}
+
+void gatherParams(paramSet *params) {
+  memcpy(params->offsetScale, offsetScale, sizeof(offsetScale));
+  memcpy(params->offsetIntercept, offsetIntercept, sizeof(offsetIntercept));
+  memcpy(params->offsetAngle, offsetAngle, sizeof(offsetAngle));
+  params->magOffset[0] = mxo;
+  params->magOffset[1] = myo;
+  params->calibratedTemperature = calibratedTemperature;
+  memcpy(params->calibratedOffsets, calibratedOffsets, sizeof(calibratedOffsets));
+  memcpy(params->rateGains, rateGains, sizeof(rateGains));
+  memcpy(params->attitudeGains, attitudeGains, sizeof(attitudeGains));
+}
+
+void scatterParams(const paramSet *params) {
+  memcpy(offsetScale, params->offsetScale, sizeof(offsetScale));
+  memcpy(offsetIntercept, params->offsetIntercept, sizeof(offsetIntercept));
+  memcpy(offsetAngle, params->offsetAngle, sizeof(offsetAngle));
+  updateAngleOffsets();
+  mxo = params->magOffset[0];
+  myo = params->magOffset[1];
+  calibratedTemperature = params->calibratedTemperature;
+  memcpy(calibratedOffsets, params->calibratedOffsets, sizeof(calibratedOffsets));
+  memcpy(rateGains, params->rateGains, sizeof(rateGains));
+  memcpy(attitudeGains, params->attitudeGains, sizeof(attitudeGains));
+}
+
+// before setupMotionSensor and setupPid, false leaves the compiled defaults
+bool loadParams() {
+  bool found = false;
+  for (byte slot = 0; slot < PARAM_SLOTS; slot++) {
+    uint16_t sequence;
+    if (!paramSlotValid(slot, &sequence)) continue;
+    if (!found || (int16_t)(sequence - paramSequence) > 0) {  // newer, across the wrap too
+      found = true;
+      paramSlot = slot;
+      paramSequence = sequence;
+    }
+  }
+  if (found) {
+    paramRecord record;
+    eeprom_read_block(&record, paramSlotAddress(paramSlot), offsetof(paramRecord, crc));
+    scatterParams(&record.params);
+  }
+  paramsLoaded = found;
+  return found;
+}
+
+// blocks for 3.4ms per byte that changes (up to ~0.5s), so only on the ground
+void saveParams() {
+  paramRecord record;
+  memset(&record, 0, sizeof(record));
+  record.version = PARAM_STORE_VERSION;
+  record.sequence = paramSequence + 1;
+  gatherParams(&record.params);
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = 0; i < offsetof(paramRecord, crc); i++) {
+    crc = crc16Update(crc, ((const uint8_t *)&record)[i]);
+  }
+  record.crc = crc;
+  byte slot = (paramSlot + 1) % PARAM_SLOTS;
+  // the CRC on its own and last, the block update may go through the bytes in either order
+  eeprom_update_block(&record, paramSlotAddress(slot), offsetof(paramRecord, crc));
+  eeprom_update_block(&record.crc, paramSlotAddress(slot) + offsetof(paramRecord, crc), sizeof(record.crc));
+  paramSlot = slot;
+  paramSequence = record.sequence;
+  paramsLoaded = true;
+}
@@ -1,17 +1,50 @@
 // CONTROL LOOP FREQUENCY
-const unsigned long receiverFreq = 50; // expressed in loop duration in milliseconds
+const unsigned long receiverFreq = 10; // radio link (failsafe) check, in milliseconds, packets are read on the radio's IRQ
 const unsigned long batteryFreq = 1000; // expressed in loop duration in milliseconds
 const unsigned long mainLoopFreq = 5000;  // expressed in loop duration in MICROseconds // 1250 -> 800Hz
 const unsigned long mainLoopFreqMillis = mainLoopFreq / 1000;  // PID class takes times in millis
+
+// MPU-6050 FIFO ACQUISITION
+// when defined gyro and accel samples are drained from the MPU-6050 FIFO in one burst per
+// data ready interrupt (sensor INT wired to pin 2) instead of being polled on a micros() schedule
+// the gyro loop then runs at the sensor's own sample rate: 1kHz (DLPF on) / (1 + MPU_SAMPLE_RATE_DIV)
+//#define MPU_FIFO_MODE
+#ifdef MPU_FIFO_MODE
+const byte MPU_SAMPLE_RATE_DIV = 0;
+const unsigned long gyroLoopFreq = 1000 * (1 + MPU_SAMPLE_RATE_DIV);  // MICROseconds, sensor sample period
+#else
 const unsigned long gyroLoopFreq = 1250;  // expressed in loop duration in MICROseconds // 1250 -> 800Hz
+#endif
 const unsigned long magLoopFreq = 20; // expressed in loop duration in milliseconds
 
+// TASK STATISTICS
+// uncomment to print each task's runs, overruns, skips and worst execution time, jitter and
+// response (DebugPrints.h) over Serial every taskStatisticsPeriod, then count afresh
+//#define TASK_STATISTICS
+const unsigned long taskStatisticsPeriod = 1000;  // expressed in milliseconds
+
+// SPLIT RATE CONTROL
+// when defined the rate PID and motor mixer run on every gyro sample (gyroLoopFreq)
+// and only accel fusion and the attitude PID run at mainLoopFreq
+// comment out to run everything at mainLoopFreq as before
+#define SPLIT_RATE_CONTROL
+#ifdef SPLIT_RATE_CONTROL
+const unsigned long rateLoopFreq = gyroLoopFreq;  // MICROseconds
+#else
+const unsigned long rateLoopFreq = mainLoopFreq;  // MICROseconds
+#endif
+const unsigned long attitudeLoopFreq = mainLoopFreq;  // MICROseconds
+
 // PID OUTPUT LIMITS
 const int pidRateMin = -150;  // MOTOR INPUT (PULSE LENGTH)
 const int pidRateMax = 150;  // MOTOR INPUT (PULSE LENGTH)
 const int pidAttitudeMin = -100;  // DEG/S
 const int pidAttitudeMax = 100;  // DEG/S
 
+// PID IMPLEMENTATION
+// uncomment to run the PID banks in fixed point (formats in PIDFixed.h) instead of float
+//#define PID_FIXED_POINT
+
 // PID GAINS
 const float rateRollKp = 1.2;
 const float rateRollKi = 0.0;
@@ -37,10 +70,53 @@ const float attitudeYawKd = 0.0;
 const int THROTTLE_LIMIT = 1600; // currently have no need of more power than this
 const int ZERO_THROTTLE = 1000;
 const int THROTTLE_MIN_SPIN = 1125;
-
+// MIXER
+// the frame layout (mixer tables in Motors.h), the ESC outputs drive four motors so only the quads fly
+#define MIXER_QUAD_X 0     // 1 front left, 2 front right, 3 back left, 4 back right
+#define MIXER_QUAD_PLUS 1  // 1 front, 2 right, 3 back, 4 left
+#define MIXER_HEX_X 2
+#define MIXER_Y6 3
+#define MIXER_FRAME MIXER_QUAD_X
+// uncomment to scale the PID corrections down when they need more than THROTTLE_MIN_SPIN to
+// THROTTLE_LIMIT, instead of only shifting them (which can push a motor past the limit)
+//#define MIXER_AIRMODE
+// ESC PROTOCOL
+// PWM pulses go out in a free running frame, the others right after each processMotors
+// (every gyro sample with SPLIT_RATE_CONTROL), the ESCs have to be set to the same protocol
+#define ESC_PROTOCOL_PWM 0           // 1000-2000us
+#define ESC_PROTOCOL_ONESHOT125 1    // 125-250us
+#define ESC_PROTOCOL_MULTISHOT 2     // 5-25us
+#define ESC_PROTOCOL_DSHOT150 3      // digital, 107us frames, no ESC calibration
+#define ESC_PROTOCOL_DSHOT300 4      // digital, 53us frames
+#define ESC_PROTOCOL ESC_PROTOCOL_PWM
+// ESC OUTPUT
+// uncomment to make the ESC pulses with the timer compare outputs (Motors.h) instead of the Timer1
+// interrupt walking the pins: motors on pins 9, 10, 3 and 6, the radio's CE/CSN move to pins 4 and 5
+// the outputs are not alike: motors 1 and 2 (Timer1) step in 0.5us, motors 3 and 4 (Timer2) in 8us,
+// so the back pair gets 125 steps over 1000-2000us instead of 2000 (up to 4us off), and motor 4
+// is still timed by interrupts (OC2A is the radio's MOSI), so it jitters as the software output did
+//#define ESC_HARDWARE_PWM
+
+// TELEMETRY
+// uncomment to stream binary records (Telemetry.h) over the UART, decode with telemetry_decode
+// the port then runs at telemetryBaud and any Serial.print output is skipped over by the decoder
+//#define TELEMETRY
+const unsigned long telemetryBaud = 1000000;  // exact at 16MHz, ~100kB/s
+const unsigned long telemetryPeriod = 2000;   // MICROseconds between records, ~47 bytes each on the wire
+// BLACKBOX
+// uncomment to record every flight to a serial flash chip (Blackbox.h, CS on pin 7)
+// flights are appended until the chip is full, decode a dump with blackbox_decode
+//#define BLACKBOX
+//#define BLACKBOX_ERASE_ON_BOOT  // wipes the previous flights, arming waits the seconds it takes
+const unsigned long blackboxPeriod = 2000;  // MICROseconds between records, ~30 bytes each
 
 // RADIO
-
+// failsafe once this many frames in a row have gone missing, the frame period is learnt from the
+// transmitter (RadioLink.h), before the first packets it is heartbeatTimeout (500ms)
+const byte failsafeFrames = 6;
+// highest data rate step the link may move up to when it is clean: 0 = 250kbps only, 1 = 1Mbps,
+// 2 = 2Mbps, the transmitter has to speak protocol version 2 to move at all
+const byte radioMaxRateStep = 2;
 
 // MOTION
 const byte DPLF_VALUE = 3;  // set low pass filter
@@ -49,6 +125,37 @@ const byte AFS_SEL = 2;  // 2 = accel full scale range +/-8g
 const float compFilterAlpha = 0.998f; // weight applied to gyro angle estimate
 const float accelAverageAlpha = 0.2f; // weight given to the new reading over the running average
 
+// SENSOR PIPELINE IMPLEMENTATION
+// uncomment to run gyro integration, accel averaging and the complementary filter in fixed point
+// (formats in MotionSensor.h) instead of float
+//#define SENSOR_FIXED_POINT
+
+// ATTITUDE ESTIMATOR
+// uncomment to replace the complementary filter with the quaternion AHRS (Ahrs.h, Mahony, fixed point)
+// quadcopter_bench compares the two on a replayed flight
+//#define AHRS_MAHONY
+const float ahrsKp = 0.5f;     // rad/s per unit of accel error (sine of the angle to gravity)
+const float ahrsKi = 0.05f;    // rad/s^2 per unit of error, the gyro bias estimate
+const float ahrsKpMag = 2.5f;  // rad/s per radian of heading error
+
+// GYRO BIAS
+// uncomment to boot on the temperature model offsets (no 3s calibration) and keep estimating the
+// gyro bias from then on, while still and in flight (MotionSensor.h)
+//#define GYRO_BIAS_ONLINE
+const float gyroBiasDrift = 0.5f;        // counts/s per sqrt(s), how fast the bias may wander with temperature
+const float gyroBiasStartError = 20.0f;  // counts rms, how far out the temperature model may be at boot
+const int16_t gyroStillThreshold = 65;   // counts (2 deg/s at FS_SEL = 2), every sample within it counts as still
+
+// ATAN2 ENGINE
+// used for the accel angles and the compass heading (MathsHelper.h), quadcopter_bench reports the error of each
+#define ATAN2_ENGINE_LOOKUP 0               // 256 segment table, truncated
+#define ATAN2_ENGINE_LOOKUP_INTERPOLATED 1  // 256 segment table, interpolated
+#define ATAN2_ENGINE_CORDIC 2               // 14 iterations
+#define ATAN2_ENGINE_POLYNOMIAL 3           // 7th order minimax
+// the truncated lookup is what has always flown; the interpolated one cuts the worst error from
+// 0.31 to 0.008 deg, a change to try on its own
+#define ATAN2_ENGINE ATAN2_ENGINE_LOOKUP
+
 
 // BATTERY
 
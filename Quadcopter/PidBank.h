@@ -0,0 +1,165 @@
+// ****************************************************************************************
+// Bank of PID controllers, one per axis
+//    same maths as PID.h (or PIDFixed.h's pidFixedCompute with PID_FIXED_POINT) but all axes
+//    are updated in one loop, each controller's state kept together in one struct instead of
+//    one object per axis reaching its data via pointers
+//    targets and actuals are written straight into the bank, outputs read straight out of it
+//    all controllers here are DIRECT so the REVERSE handling of PID.h is left out
+// ****************************************************************************************
+
+enum Axis {ROLL = 0, PITCH = 1, YAW = 2};
+const byte NUM_AXES = 3;
+
+// the float controller, as PID.h's members
+struct pidFloatState {
+  float kp, ki, kd;  // ki and kd prescaled by the sample time
+  float iTerm;
+  float lastInput;
+  float outMin, outMax;
+};
+
+template <byte N>
+class PidBank
+{
+  public:
+    float target[N];
+    float actual[N];
+    float output[N];
+
+    // sample time in MICROseconds so loops faster than 1kHz can be represented
+    PidBank(unsigned long sampleTimeMicros)
+    {
+      SampleTime = sampleTimeMicros;
+      inAuto = false;
+      for (byte i = 0; i < N; i++) {
+        target[i] = 0;
+        actual[i] = 0;
+        output[i] = 0;
+        dispKp[i] = 0;
+        dispKi[i] = 0;
+        dispKd[i] = 0;
+        pid[i] = {};
+      }
+    }
+
+    void SetMode(int Mode)
+    {
+      bool newAuto = (Mode == AUTOMATIC);
+      if (newAuto && !inAuto)
+      { /*we just went from manual to auto*/
+        Initialize();
+      }
+      inAuto = newAuto;
+    }
+
+#ifdef PID_FIXED_POINT
+    void Compute(bool allTerms=true)
+    {
+      for (byte i = 0; i < N; i++) {
+        int16_t out = pidFixedCompute(pid[i], pidValueToFixed(actual[i]), pidValueToFixed(target[i]), allTerms);
+        output[i] = (float)out * PID_VALUE_TO_FLOAT;
+      }
+    }
+#else
+    void Compute(bool allTerms=true)
+    {
+      for (byte i = 0; i < N; i++) {
+        pidFloatState &p = pid[i];
+        float input = actual[i];
+        float error = target[i] - input;
+        if (allTerms) {
+          p.iTerm += (p.ki * error);
+          if (p.iTerm > p.outMax) p.iTerm = p.outMax;
+          else if (p.iTerm < p.outMin) p.iTerm = p.outMin;
+        }
+        float dInput = (input - p.lastInput);
+        float out;
+        if (allTerms) out = p.kp * error + p.iTerm - p.kd * dInput;
+        else out = p.kp * error - p.kd * dInput;
+        if (out > p.outMax) out = p.outMax;
+        else if (out < p.outMin) out = p.outMin;
+        output[i] = out;
+        p.lastInput = input;
+      }
+    }
+#endif
+
+    void SetOutputLimits(byte axis, float Min, float Max)
+    {
+      if (Min >= Max) return;
+#ifdef PID_FIXED_POINT
+      pidFixedSetOutputLimits(pid[axis], Min, Max);
+#else
+      pid[axis].outMin = Min;
+      pid[axis].outMax = Max;
+#endif
+      if (inAuto)
+      {
+        if (output[axis] > Max) output[axis] = Max;
+        else if (output[axis] < Min) output[axis] = Min;
+        clampITerm(axis);
+      }
+    }
+
+    void SetTunings(byte axis, float Kp, float Ki, float Kd)
+    {
+      if (Kp < 0 || Ki < 0 || Kd < 0) return;
+      dispKp[axis] = Kp;
+      dispKi[axis] = Ki;
+      dispKd[axis] = Kd;
+
+#ifdef PID_FIXED_POINT
+      pidFixedSetTunings(pid[axis], Kp, Ki, Kd, SampleTime);
+#else
+      float SampleTimeInSec = ((float)SampleTime) * 0.000001f;
+      pid[axis].kp = Kp;
+      pid[axis].ki = Ki * SampleTimeInSec;
+      pid[axis].kd = Kd / SampleTimeInSec;
+#endif
+    }
+
+    // applies to every axis in the bank, the prescaled gains are re-derived from the stored ones
+    void SetSampleTime(unsigned long NewSampleTimeMicros)
+    {
+      if (NewSampleTimeMicros > 0)
+      {
+        SampleTime = NewSampleTimeMicros;
+        for (byte i = 0; i < N; i++) {
+          SetTunings(i, dispKp[i], dispKi[i], dispKd[i]);
+        }
+      }
+    }
+
+  private:
+    void Initialize()
+    {
+      for (byte i = 0; i < N; i++) {
+#ifdef PID_FIXED_POINT
+        pidFixedInitialize(pid[i], actual[i], output[i]);
+#else
+        pid[i].iTerm = output[i];
+        pid[i].lastInput = actual[i];
+        clampITerm(i);
+#endif
+      }
+    }
+
+    void clampITerm(byte axis)
+    {
+#ifdef PID_FIXED_POINT
+      pidFixedClampITerm(pid[axis]);
+#else
+      if (pid[axis].iTerm > pid[axis].outMax) pid[axis].iTerm = pid[axis].outMax;
+      else if (pid[axis].iTerm < pid[axis].outMin) pid[axis].iTerm = pid[axis].outMin;
+#endif
+    }
+
+    float dispKp[N], dispKi[N], dispKd[N];  // gains as given, for re-deriving on sample time changes
+#ifdef PID_FIXED_POINT
+    pidFixedState pid[N];
+#else
+    pidFloatState pid[N];
+#endif
+    unsigned long SampleTime;  // MICROseconds
+    bool inAuto;
+};
@@ -3,14 +3,27 @@
 #include <RF24.h> // https://github.com/nRF24/RF24
 
 #include "Parameters.h"
+#include "CycleMarkers.h"
+#include "Scheduler.h"
+#include "Handoff.h"
+#include "BinaryAngle.h"
 #include "MathsHelper.h"
 #include "PID.h"
+#include "PIDFixed.h"
+#include "PidBank.h"
 #include "BatteryMonitor.h"
+#include "I2cAsync.h"
 #include "I2cFunctions.h"
 #include "MotionSensor.h"
+#include "Ahrs.h"
+#include "RadioLink.h"
 #include "Receiver.h"
 #include "Motors.h"
 #include "PIDSettings.h"
+#include "Telemetry.h"
+#include "ParamStore.h"
+#include "SpiFlash.h"
+#include "Blackbox.h"
 #include "DebugPrints.h"
 
 // THROTTLE
@@ -28,132 +41,264 @@ enum State {NOT_ARMED, ARMED, ON_GROUND, TAKING_OFF, FLYING, LANDING, DISABLED,
 State state = NOT_ARMED;
 State previousState = NOT_ARMED;
 
-// CONTROL LOOPS
-unsigned long receiverLast = 0;
-unsigned long batteryLoopLast = 0;
-unsigned long mainLoopLast = 0;
-unsigned long gyroLoopLast = 0;
-unsigned long magLoopLast = 0;
-
-// DEBUGGING // PERFORMANCE CHECKING
-unsigned long lastPrint = 0;
-unsigned long functionTimeSum = 0;
-uint16_t functionTimeCounter = 0;
-unsigned long tStart;
-unsigned long tEnd;
-uint16_t loopCounter = 0;
-uint16_t gyroLoopCounter = 0;
-uint16_t receiverLoopCounter = 0;
-uint16_t mainLoopCounter = 0;
-uint16_t magLoopCounter = 0;
+// CONTROL LOOPS (Scheduler.h)
+// ids in registration order, see setupTasks
+byte taskGyro, taskMain, taskMag, taskReceiver, taskBattery, taskTelemetry, taskTelemetryPump, taskBlackbox;
+
+
+// ARMING (the setup state machine, stepped from loop until armed)
+// calibration, battery filter warm up and the radio handshake all move on together, the
+// starting attitude is sampled after the stick goes up (hands off the battery) while
+// waiting for it to come down again
+// progress goes back in the ack payload and on the status LED: steady until the radio is
+// heard from, then a fast blink while calibrating (keep it still), slow while waiting for the
+// throttle to go up and in between while waiting for it to come down
+enum BootProgress {BOOT_ARMED = 0, BOOT_CALIBRATING = 1, BOOT_WAIT_THROTTLE_UP = 2, BOOT_WAIT_THROTTLE_DOWN = 3};
+enum RadioStage {RADIO_WAITING, RADIO_WAIT_THROTTLE_UP, RADIO_WAIT_THROTTLE_DOWN};
+RadioStage radioStage = RADIO_WAITING;
+bool sensorsCalibrated = false;
+bool batteryReady = false;
+bool anglesInitialising = false;
+bool anglesInitialised = false;
+const unsigned int bootBlinkPeriod[4] = {0, 100, 500, 250};  // ms, by BootProgress
+unsigned long lastBlink = 0;
 
 
 void setup() {
   state = NOT_ARMED;
+#ifdef TELEMETRY
+  setupTelemetry();
+#else
   Serial.begin(115200);
+#endif
   pinMode(pinStatusLed, OUTPUT);
   digitalWrite(pinStatusLed, HIGH);
   setupBatteryMonitor();
   setupI2C();
-  setupMotionSensor();
+  loadParams();  // calibration and gains from the EEPROM, the compiled values if there are none
+  setupMotionSensor();  // the calibration itself is sampled in armingStep
   setupMag();
   setupRadio();
   setupPid();
-  // ARMING PROCEDURE
+#ifdef BLACKBOX
+  setupBlackbox();  // an erase goes on through the calibration
+#endif
+} // END SETUP
+
+
+
+void loop() {
+  if (state == NOT_ARMED) {
+    armingStep();
+    return;
+  }
+  manageModeChanges();
+  manageStateChanges();
+  i2cAsyncPoll();
+  schedulerRun();
+
+  // ****************************************************************************************
+  // DEBUGGING
+  // ****************************************************************************************
+
+#ifdef TASK_STATISTICS
+  static unsigned long lastPrint = 0;
+  if (millis() - lastPrint >= taskStatisticsPeriod) {
+    lastPrint = millis();
+    printTaskStatistics();
+    resetTaskStatistics();
+  }
+#endif
+
+} // END LOOP
+
+
+// one pass of the setup state machine, none of the steps wait
+void armingStep() {
+  if (!sensorsCalibrated) {
+    sensorsCalibrated = sensorCalibrationStep();
+    if (sensorsCalibrated && calibrationChanged) {
+      saveParams();  // ~0.5s, before the radio has anything to arm
+    }
+  }
+  if (!batteryReady) {
+    batteryReady = batteryWarmUpStep();
+  }
   // wait for radio connection and specific user input (stick up, stick down)
-  while (!checkRadioForInput()) {
+  if (checkRadioForInput()) {
+    if (radioStage == RADIO_WAITING) {
+      radioStage = RADIO_WAIT_THROTTLE_UP;
+    }
+    if (radioStage == RADIO_WAIT_THROTTLE_UP && rcPackage.throttle >= 200) {
+      radioStage = RADIO_WAIT_THROTTLE_DOWN;
+    }
   }
-  while (rcPackage.throttle < 200) {
-    checkRadioForInput();
+  // so that hands aren't still fiddling with the battery connection while the angles are taken
+  if (sensorsCalibrated && radioStage == RADIO_WAIT_THROTTLE_DOWN && !anglesInitialised) {
+    if (!anglesInitialising) {
+      startAngleInitialisation();
+      anglesInitialising = true;
+    }
+    anglesInitialised = angleInitialisationStep();
   }
-  initialiseCurrentAngles();  // so that hands aren't still fiddling with the battery connection while the gyros are calibrating
-  while (rcPackage.throttle > 50) {
-    checkRadioForInput();
+  if (!sensorsCalibrated) bootProgress = BOOT_CALIBRATING;
+  else if (radioStage != RADIO_WAIT_THROTTLE_DOWN) bootProgress = BOOT_WAIT_THROTTLE_UP;
+  else bootProgress = BOOT_WAIT_THROTTLE_DOWN;
+  updateAckStatusForTx();
+  showBootProgress();
+#ifdef BLACKBOX
+  if (!blackboxReady()) return;  // still erasing
+#endif
+  if (anglesInitialised && batteryReady && rcPackage.throttle <= 50) {
+    finishArming();
   }
-  // END ARMING
+}
+
+void showBootProgress() {
+  if (radioStage == RADIO_WAITING) return;  // LED stays on as setup left it
+  if (millis() - lastBlink >= bootBlinkPeriod[bootProgress]) {
+    lastBlink = millis();
+    digitalWrite(pinStatusLed, !digitalRead(pinStatusLed));
+  }
+}
+
+void finishArming() {
   setupMotors();
   state = ARMED;
+  bootProgress = BOOT_ARMED;
+  updateAckStatusForTx();
   checkHeartbeat(); // refresh
   pidRateModeOn();
-  unsigned long startTimeMillis = millis();
-  lastPrint = startTimeMillis; // for debug output
-  receiverLast = startTimeMillis;
-  batteryLoopLast = startTimeMillis;
-  magLoopLast = startTimeMillis;
-  unsigned long startTimeMicros = micros();
-  mainLoopLast = startTimeMicros;
-  gyroLoopLast = startTimeMicros;
+#ifdef BLACKBOX
+  startBlackboxLog();
+#endif
+  setupTasks();
+#ifdef MPU_FIFO_MODE
+  setupMpuFifo();  // after calibration, which still reads the data registers directly
+#endif
+  schedulerStart();
   state = ON_GROUND;
   digitalWrite(pinStatusLed, LOW);
   //  Serial.println(F("Setup complete"));
+}
 
-} // END SETUP
-
-
+// the deadline of each task is its period, so a job that is still running when the next
+// one is released counts as an overrun; ties go to the control path
+void setupTasks() {
+#ifdef MPU_FIFO_MODE
+  taskGyro = addTask(gyroFifoTask, 0, 0, 0);  // paced by the sensor's data ready interrupt
+#else
+  taskGyro = addTask(gyroTask, gyroLoopFreq, gyroLoopFreq, 0);
+#endif
+  taskMain = addTask(mainTask, mainLoopFreq, mainLoopFreq, 1);
+  taskReceiver = addTask(receiverTask, 0, 0, 2);  // paced by the radio's IRQ
+  taskMag = addTask(magTask, magLoopFreq * 1000, magLoopFreq * 1000, 3);
+  taskBattery = addTask(batteryTask, batteryFreq * 1000, batteryFreq * 1000, 4);
+#ifdef TELEMETRY
+  taskTelemetry = addTask(telemetryTask, telemetryPeriod, telemetryPeriod, 5);
+  taskTelemetryPump = addTask(telemetryPump, 0, 0, 6);
+#endif
+#ifdef BLACKBOX
+  taskBlackbox = addTask(blackboxTask, blackboxPeriod, blackboxPeriod, 5);
+#endif
+}
 
-void loop() {
-  loopCounter ++;
-  if (millis() - receiverLast >= receiverFreq) {
-    receiverLast += receiverFreq;
-    receiveAndProcessControlData();
-    receiverLoopCounter++;
+// sensor tasks queue their read on the first call, the TWI interrupt fetches the bytes while
+// the scheduler carries on and the data is processed on the poll where it has arrived
+// (startRead does nothing while the read is in flight, and retries after an error)
+bool gyroTask() {
+  if (!finishGyroRead()) {
+    startGyroRead();
+    return false;
   }
+  runGyroStage();
+  return true;
+}
 
-  manageModeChanges();
-  manageStateChanges();
-
-  if (micros() - gyroLoopLast >= gyroLoopFreq) {
-    gyroLoopLast += gyroLoopFreq;
-    readGyros();
-    processGyroData();
-    gyroLoopCounter++;
+#ifdef MPU_FIFO_MODE
+// gyro and accel both come out of the sensor FIFO, the main task uses the latest accel sample
+bool gyroFifoTask() {
+  byte fifoSamples = serviceMpuFifo();
+  for (byte i = 0; i < fifoSamples; i++) {
+    unpackFifoSample(i);
+    runGyroStage();
   }
+  return fifoSamples > 0;
+}
 
-  if (micros() - mainLoopLast >= mainLoopFreq) {
-    mainLoopLast += mainLoopFreq;
-    readAccels();
-    processAccelData();
-    combineGyroAccelData();
-    setTargetsAndRunPIDs();
-    processMotors(throttle, rateRollSettings.output, ratePitchSettings.output, rateYawSettings.output);
-    mainLoopCounter++;
+bool mainTask() {
+  runMainStage();
+  return true;
+}
+#else
+bool mainTask() {
+  if (!finishAccelRead()) {
+    startAccelRead();
+    return false;
   }
+  runMainStage();
+  return true;
+}
+#endif
 
-  if (millis() - magLoopLast >= magLoopFreq) {
-    magLoopLast += magLoopFreq;
-    readMag();
-    processMagData();
-    combineGyroMagHeadings();
-    magLoopCounter++;
+bool magTask() {
+  if (!finishMagRead()) {
+    startMagRead();
+    return false;
   }
+  processMagData();
+  CYCLE_MARK_BEGIN(CYCLE_STAGE_MAG_FUSION);
+  combineGyroMagHeadings();
+  CYCLE_MARK_END(CYCLE_STAGE_MAG_FUSION);
+  return true;
+}
 
-  if (millis() - batteryLoopLast >= batteryFreq) {
-    batteryLoopLast += batteryFreq;
-    calculateBatteryLevel();
-  }
+bool receiverTask() {
+  receiveAndProcessControlData();
+  return true;
+}
 
-  // ****************************************************************************************
-  // DEBUGGING
-  // ****************************************************************************************
+bool batteryTask() {
+  calculateBatteryLevel();
+  return true;
+}
 
-  //  if (millis() - lastPrint >= 1000) {
-  //    lastPrint += 1000;
-  //    Serial.print(loopCounter); Serial.print('\t');
-  //    Serial.print(gyroLoopCounter); Serial.print('\t');
-  //    Serial.print(mainLoopCounter); Serial.print('\t');
-  //    Serial.print(magLoopCounter); Serial.print('\t');
-  //    Serial.print(receiverLoopCounter); Serial.print('\n');
-  //    loopCounter = 0;
-  //    gyroLoopCounter = 0;
-  //    mainLoopCounter = 0;
-  //    magLoopCounter = 0;
-  //    receiverLoopCounter = 0;
-  //  }
+bool telemetryTask() {
+  telemetryLog(taskGyro, taskMain);
+  return true;
+}
 
-} // END LOOP
+// one record and at most one chunk programmed per run, so its cost per pass is bounded
+bool blackboxTask() {
+  blackboxLog(state << 4 | mode);
+  blackboxFlush();
+  return true;
+}
 
+// once per gyro sample
+void runGyroStage() {
+  CYCLE_MARK_BEGIN(CYCLE_STAGE_GYRO);
+  processGyroData();
+  CYCLE_MARK_END(CYCLE_STAGE_GYRO);
+#ifdef SPLIT_RATE_CONTROL
+  runRateLoop();
+#endif
+}
+
+// once per accel sample (mainLoopFreq)
+void runMainStage() {
+  CYCLE_MARK_BEGIN(CYCLE_STAGE_MAIN);
+  processAccelData();
+  combineGyroAccelData();
+  setTargetsAndRunAttitudePIDs();
+#ifndef SPLIT_RATE_CONTROL
+  runRateLoop();
+#endif
+  CYCLE_MARK_END(CYCLE_STAGE_MAIN);
+}
 
-void setTargetsAndRunPIDs() {
+// runs at attitudeLoopFreq, leaves the rate PID targets ready for the rate loop
+void setTargetsAndRunAttitudePIDs() {
   // If connection lost then modify throttle so that QC is descending slowly
   if (!rxHeartbeat) {
     calculateVerticalAccel();
@@ -165,19 +310,57 @@ void setTargetsAndRunPIDs() {
       setAutoLevelTargets();
     }
     if (mode != RATE) { // i.e. one of the ATTITUDE modes
-      setAttitudePidActual(currentAngles.roll, currentAngles.pitch, currentAngles.yaw);
+      attitudePid.actual[ROLL] = bam32ToDegrees(currentAngles.roll);
+      attitudePid.actual[PITCH] = bam32ToDegrees(currentAngles.pitch);
+      // yaw as seen from the target, so the PID error is the shortest way round even across +/-180
+      bam16 yawError = bamDifference(degreesToBam(attitudePid.target[YAW]), bam32ToBam16(currentAngles.yaw));
+      attitudePid.actual[YAW] = attitudePid.target[YAW] - bamToDegrees(yawError);
       pidAttitudeUpdate();
-      setRatePidTargets(attitudeRollSettings.output, attitudePitchSettings.output, attitudeYawSettings.output);
+      ratePid.target[ROLL] = attitudePid.output[ROLL];
+      ratePid.target[PITCH] = attitudePid.output[PITCH];
+      ratePid.target[YAW] = attitudePid.output[YAW];
       if (mode == ATTITUDE_RATEYAW) {
         overrideYawTarget();  // OVERIDE THE YAW ATTITUDE PID OUTPUT with controller output i.e. user controls yaw rate
       }
     }
-    setRatePidActual(valGyX, valGyY, valGyZ);
+  }
+}
+
+// runs at rateLoopFreq, on every gyro sample when SPLIT_RATE_CONTROL is defined
+void runRateLoop() {
+  CYCLE_MARK_BEGIN(CYCLE_STAGE_RATE);
+  if (state == FLYING) {
+    ratePid.actual[ROLL] = valGyX;
+    ratePid.actual[PITCH] = valGyY;
+    ratePid.actual[YAW] = valGyZ;
     pidRateUpdate();
   }
+  processMotors(throttle, ratePid.output[ROLL], ratePid.output[PITCH], ratePid.output[YAW]);
+  CYCLE_MARK_END(CYCLE_STAGE_RATE);
 }
 
 void receiveAndProcessControlData() {
+  static unsigned long lastLinkCheck = 0;
+  if (millis() - lastLinkCheck >= receiverFreq) {
+    lastLinkCheck = millis();
+    checkLink();
+  }
+  if (checkRadioForInput()) {
+    mode = getMode();
+    // MAP CONTROL VALUES
+    mapThrottle(&throttle);
+    if (mode != RATE) { // i.e. one of the ATTITUDE modes
+      mapRcToPidInput(&attitudePid.target[ROLL], &attitudePid.target[PITCH], &attitudePid.target[YAW], mode);
+      // yaw rate target will be overiden in setTargetsAndRunAttitudePIDs function for ATTITUDE_RATEYAW mode
+    }
+    else {  // RATE mode
+      mapRcToPidInput(&ratePid.target[ROLL], &ratePid.target[PITCH], &ratePid.target[YAW], mode);
+    }
+  }
+}
+
+// every receiverFreq, whether or not anything has come in
+void checkLink() {
   checkHeartbeat();  // must be done outside if(radio.available) loop
   if (!rxHeartbeat) {
     autoLevel = true;
@@ -186,24 +369,16 @@ void receiveAndProcessControlData() {
       setMotorsLow();
       digitalWrite(pinStatusLed, HIGH);
       state = DISABLED;
+#ifdef BLACKBOX
+      blackboxLog(state << 4 | mode);
+      blackboxFinish();
+#endif
       while (1);
     }
     else {
       autoLevel = false;  // this does not come from the controller anymore so needs to be re set even when comms resume
     }
   }
-  if (checkRadioForInput()) {
-    mode = getMode();
-    // MAP CONTROL VALUES
-    mapThrottle(&throttle);
-    if (mode != RATE) { // i.e. one of the ATTITUDE modes
-      mapRcToPidInput(&attitudeRollSettings.target, &attitudePitchSettings.target, &attitudeYawSettings.target, mode);
-      // yaw rate target will be overiden in setTargetsAndRunPIDs function for ATTITUDE_RATEYAW mode
-    }
-    else {  // RATE mode
-      mapRcToPidInput(&rateRollSettings.target, &ratePitchSettings.target, &rateYawSettings.target, mode);
-    }
-  }
 }
 
 void manageModeChanges() {
@@ -0,0 +1,236 @@
+// ****************************************************************************************
+// Radio link protocol, version 2
+//    the transmitter numbers every packet and protects it with a CRC-8; the receiver counts
+//    what went missing, came twice or came out of order and scores the link from that (the
+//    nRF24 has no RSSI, only the RPD bit: a carrier above -64dBm), then asks the transmitter
+//    for the data rate and retry count to use, in the ack payload
+//    the failsafe goes off once failsafeFrames frames in a row are missing; the frame period
+//    is learnt from the packets, so it follows whatever rate the transmitter sends at
+//    there are no radio calls in here: Receiver.h feeds it the packets, and quadcopter_bench
+//    runs it over a simulated lossy link
+//    version 1 packets (dataStruct in Receiver.h, additive checksum) are still accepted, with
+//    their alive byte as the sequence number, but they stay on step 0 (250kbps)
+// ****************************************************************************************
+
+const byte RADIO_PROTOCOL_VERSION = 2;
+
+// the control packet, 9 bytes, told apart from the 7 byte version 1 one by its length
+struct rcPacketV2 {
+  byte version;   // RADIO_PROTOCOL_VERSION
+  byte sequence;  // +1 for every new packet, the nRF24's own retries resend the same one
+  byte throttle;
+  byte roll;
+  byte pitch;
+  byte yaw;
+  byte control;   // as version 1 (Receiver.h)
+  byte link;      // bits 0/1: data rate step the transmitter sends at from its next packet on
+  byte crc;       // crc8() of the bytes before
+};
+
+// ack payload for a version 2 transmitter, a version 1 one still gets the status byte alone
+struct ackPacketV2 {
+  byte status;       // statusForAck (Receiver.h)
+  byte request;      // bits 0/1: data rate step wanted, bits 4-7: retry count wanted
+  byte linkQuality;  // 0-255, radioLinkState.quality
+};
+
+// DATA RATE STEPS
+//    the receiver asks for a step in every ack; the transmitter announces the step in packet.link
+//    and moves to it once that packet is acked, and the receiver follows when it reads it
+//    either side that hears nothing for linkFallbackFrames frames drops back to step 0, well
+//    before the failsafe, so a change that doesn't take costs a few frames
+//    the transmitter's ack wait has to cover the ack payload at each rate (RF24 setRetries delay,
+//    in 250us units above 250us); attempt is that wait plus the packet's time on air, in MICROseconds
+struct radioRateStep {
+  byte retryDelay;
+  uint16_t attempt;
+};
+const radioRateStep radioRateSteps[3] = {
+  {5, 2200},  // 250kbps: 1500us wait, the minimum with an ack payload
+  {1, 800},   // 1Mbps: 500us
+  {1, 700},   // 2Mbps: 500us
+};
+
+const unsigned long heartbeatTimeout = 500;  // ms, the failsafe until the frame period is known, and its ceiling
+const unsigned long failsafeMinimum = 50;    // ms, floor for very fast transmitters
+const byte linkFallbackFrames = 3;           // silent frames before dropping back to step 0
+const byte linkHoldFrames = 100;             // frames between data rate decisions
+const uint16_t linkQualityDown = 55705;      // 85%, step down below this
+const uint16_t linkQualityUp = 64880;        // 99%, step up above this ...
+const uint16_t linkSignalUp = 58982;         // 90% ... with the RPD bit on this often
+
+// CRC-8, polynomial 0x07: catches every error of up to 3 bits in a packet and any burst of up
+// to 8 bits; the version 1 sum misses two flips of the same bit in different bytes
+static inline byte crc8Update(byte crc, byte data) {
+  crc ^= data;
+  for (byte bit = 0; bit < 8; bit++) {
+    crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+  return crc;
+}
+
+byte crc8(const void *data, byte length) {
+  const byte *bytes = (const byte *)data;
+  byte crc = 0;
+  for (byte i = 0; i < length; i++) {
+    crc = crc8Update(crc, bytes[i]);
+  }
+  return crc;
+}
+
+// LINK STATE
+// quality and signal are running fractions of the frames, 65535 = all of them, each new frame
+// weighs 1/32 (a time constant of ~0.6s at 50Hz)
+struct radioLinkState {
+  bool synced;              // following the sequence numbers, off until the first packet and after a failsafe
+  byte sequence;            // of the newest packet taken
+  uint32_t missing;         // bit n set: sequence - 1 - n has not come in (yet)
+  unsigned long lastPacket; // millis
+  uint16_t period;          // frame period, 1/16 ms, 0 until two packets in a row have come in
+  uint16_t quality;         // frames that came in
+  byte missedScored;        // frames since the last packet already scored as missing
+  uint16_t signal;          // packets with the RPD bit set
+  byte rateStep;            // data rate step the radio listens on
+  byte requestStep;         // step asked of the transmitter
+  byte holdFrames;          // until the next data rate decision
+  unsigned long packets;
+  unsigned long lost;       // frames never seen, a late one is taken back off, an outage counted by time
+  unsigned long duplicates;
+  unsigned long reordered;  // came in after a newer one, counted but not used
+  unsigned long failsafes;
+  unsigned long rateChanges;
+};
+
+enum linkVerdict { LINK_NEW, LINK_DUPLICATE, LINK_OLD };
+
+static inline void linkScore(uint16_t *score, bool hit) {
+  if (hit) *score += (65535 - *score) >> 5;
+  else *score -= *score >> 5;
+}
+
+// frames due since the last packet that are over half a period late
+static unsigned long linkOverdueFrames(const radioLinkState &link, unsigned long now) {
+  if (!link.period || !link.packets) return 0;
+  unsigned long elapsed = now - link.lastPacket;
+  if (elapsed > 60000) elapsed = 60000;
+  elapsed *= 16;
+  if (elapsed <= link.period / 2u) return 0;
+  return (elapsed - link.period / 2u) / link.period;
+}
+
+// scores frames as missing as they go, so the quality falls through an outage instead of after it
+static void linkScoreMissing(radioLinkState &link, unsigned long missing) {
+  if (missing > 255) missing = 255;  // the score is long gone by then
+  while (link.missedScored < missing) {
+    linkScore(&link.quality, false);
+    link.missedScored++;
+  }
+}
+
+// every good packet goes through here, only LINK_NEW ones should reach the sticks
+linkVerdict linkTakePacket(radioLinkState &link, byte sequence, bool strongSignal, unsigned long now) {
+  if (link.synced) {
+    int8_t ahead = (int8_t)(sequence - link.sequence);
+    if (ahead <= 0) {
+      byte behind = -(ahead + 1);  // bit in missing
+      if (ahead == 0 || behind >= 32 || !(link.missing & (1UL << behind))) {
+        link.duplicates++;
+        return LINK_DUPLICATE;
+      }
+      link.missing &= ~(1UL << behind);
+      link.lost--;
+      link.reordered++;
+      return LINK_OLD;
+    }
+    byte gap = ahead - 1;
+    link.lost += gap;
+    link.missing = ahead >= 32 ? 0xFFFFFFFF : link.missing << ahead | ((1UL << gap) - 1);
+    linkScoreMissing(link, gap);
+    unsigned long elapsed = now - link.lastPacket;
+    if (elapsed && elapsed <= heartbeatTimeout) {  // packets drained together say nothing about the period
+      int16_t sample = elapsed * 16 / ahead;
+      if (link.period) link.period += (sample - (int16_t)link.period) / 8;
+      else link.period = sample;
+    }
+    link.holdFrames = link.holdFrames > ahead ? link.holdFrames - ahead : 0;
+  }
+  else {
+    // back after a failsafe, the sequence numbers can't be trusted across it so the time says
+    // how many frames went missing
+    unsigned long gap = linkOverdueFrames(link, now);
+    link.lost += gap;
+    linkScoreMissing(link, gap);
+    link.missing = 0;
+  }
+  link.missedScored = 0;
+  link.synced = true;
+  link.sequence = sequence;
+  link.lastPacket = now;
+  link.packets++;
+  linkScore(&link.quality, true);
+  linkScore(&link.signal, strongSignal);
+  return LINK_NEW;
+}
+
+// failsafeFrames and a half frame periods, so a gap of failsafeFrames - 1 frames never trips it
+unsigned long linkTimeout(const radioLinkState &link) {
+  if (!link.period) return heartbeatTimeout;
+  unsigned long timeout = ((unsigned long)link.period * (2 * failsafeFrames + 1)) >> 5;
+  return constrain(timeout, failsafeMinimum, heartbeatTimeout);
+}
+
+// false once the link is gone, which also drops the sequence tracking so the transmitter's
+// numbers are picked up afresh when it comes back
+bool linkAlive(radioLinkState &link, unsigned long now) {
+  linkScoreMissing(link, linkOverdueFrames(link, now));
+  if (now - link.lastPacket <= linkTimeout(link)) return true;
+  if (link.synced) {
+    link.synced = false;
+    link.failsafes++;
+  }
+  return false;
+}
+
+// true when the radio has to go back to step 0
+bool linkRateFallback(radioLinkState &link, unsigned long now) {
+  if (link.rateStep == 0 || !link.period) return false;
+  if (now - link.lastPacket <= ((unsigned long)link.period * linkFallbackFrames) >> 4) return false;
+  link.rateStep = 0;
+  link.requestStep = 0;
+  link.holdFrames = linkHoldFrames;
+  link.rateChanges++;
+  return true;
+}
+
+// on every new version 2 packet: one step down when frames go missing, one step up when the
+// link has been clean and strong for a while, then hold either way
+void linkPlanRate(radioLinkState &link) {
+  if (link.holdFrames) return;
+  if (link.rateStep > 0 && link.quality < linkQualityDown) {
+    link.requestStep = link.rateStep - 1;
+  }
+  else if (link.rateStep < radioMaxRateStep && link.quality > linkQualityUp && link.signal > linkSignalUp) {
+    link.requestStep = link.rateStep + 1;
+  }
+  else {
+    return;
+  }
+  link.holdFrames = linkHoldFrames;
+}
+
+// as many retries as fit in a frame at the step asked for, so a retried packet is never older
+// than the next one would be
+byte linkRetries(const radioLinkState &link) {
+  if (!link.period) return 15;
+  unsigned long attempts = ((unsigned long)link.period * 1000 >> 4) / radioRateSteps[link.requestStep].attempt;
+  return attempts > 16 ? 15 : attempts > 1 ? attempts - 1 : 0;
+}
+
+// the transmitter announces the step of its next packet, true when the radio has to move to it
+bool linkFollowTransmitter(radioLinkState &link, byte announcedStep) {
+  if (announcedStep == link.rateStep || announcedStep > radioMaxRateStep) return false;
+  link.rateStep = announcedStep;
+  link.holdFrames = linkHoldFrames;
+  link.rateChanges++;
+  return true;
+}
@@ -8,28 +8,60 @@
 // bit 6:
 // bit 7; 1 = TURN OFF MOTORS - reset required for re-enable // not implemented on current Tx
 
-// Acknowledgement byte
+// Acknowledgement byte (the first of ackPacketV2 for a version 2 transmitter, RadioLink.h)
 // bit 0: non-zero // for Tx to easily distinguish from no acknowledgement
 // bit 1: 1 = OK
 // bit 2: 1 = some error
-// bit 3:
-// bit 4:
+// bits 3/4: setup progress, 0 once armed (BootProgress in Quadcopter.ino)
 // bits 5/6/7: battery indicator (0-7)
 
 const byte address[6] = "1Node";
 const byte pipeNumber = 1;
+#ifdef ESC_HARDWARE_PWM
+RF24 radio(4, 5); // CE, CSN (9 and 10 are timer outputs for the ESCs)
+#else
 RF24 radio(9, 10); // CE, CSN (SPI SS)
+#endif
+const rf24_datarate_e radioRates[3] = {RF24_250KBPS, RF24_1MBPS, RF24_2MBPS};  // radioRateSteps in RadioLink.h
+radioLinkState radioLink;
+byte radioVersion = 0;  // of the transmitter's last packet
+
+// the nRF24 IRQ (active low) on a pin change interrupt: the ISR only notes that a packet is
+// in, the SPI read waits for the next pass of loop(), which drains the FIFO and keeps the
+// newest good packet, so the sticks are a loop pass old instead of up to receiverFreq
+const byte pinRadioIrq = A1;  // PC1, PCINT9
+
+struct radioStatistics {
+  unsigned long packets;     // good packets decoded
+  unsigned long superseded;  // good packets dropped for a newer one in the same drain
+  unsigned long badChecksum; // or bad CRC, or a length that is neither version
+  unsigned long lastLatency; // MICROseconds from the IRQ to the packet being decoded
+  unsigned long maxLatency;
+};
+radioStatistics radioStats;
+
+volatile bool radioPacketPending = false;
+volatile unsigned long radioIrqMicros = 0;  // first IRQ since the last drain
+
+ISR(PCINT1_vect) {
+  if (!(PINC & _BV(PINC1)) && !radioPacketPending) {  // falling edge, the other is the drain clearing it
+    radioIrqMicros = micros();
+    radioPacketPending = true;
+  }
+}
 
 byte statusForAck = 0; // send this back to transmitter as acknowledgement package
 const byte OK = 1;
+byte bootProgress = 0;  // set by the arming state machine
 
+// version 1 packet, and the sticks as decoded from either version
 struct dataStruct {
   byte throttle;
   byte roll;
   byte pitch;
   byte yaw;
   byte control; // for some control bits
-  byte alive; //this will increment every time the data is sent
+  byte alive; //this will increment every time the data is sent (the sequence number in version 2)
   byte checksum;
 } rcPackage;
 
@@ -39,17 +71,15 @@ const float attitudeMin = -30;  // DEGREES
 const float attitudeMax = 30;  // DEGREES
 
 bool rxHeartbeat = false;
-unsigned long lastRxReceived = 0;
-const unsigned long heartbeatTimeout = 500;
 
-byte calculateCheckSum() {
+byte calculateCheckSum(const dataStruct &packet) {
   byte sum = 0;
-  sum += rcPackage.throttle;
-  sum += rcPackage.pitch;
-  sum += rcPackage.roll;
-  sum += rcPackage.yaw;
-  sum += rcPackage.control;
-  sum += rcPackage.alive;
+  sum += packet.throttle;
+  sum += packet.pitch;
+  sum += packet.roll;
+  sum += packet.yaw;
+  sum += packet.control;
+  sum += packet.alive;
   sum = 1 - sum;
   return sum;
 }
@@ -62,7 +92,32 @@ void printPackage() {
   Serial.print(rcPackage.control); Serial.print('\t');
   Serial.print(rcPackage.alive); Serial.print('\t');
   Serial.print(rcPackage.checksum); Serial.print('\t');
-  Serial.print("CHKSUM_DIFF: "); Serial.println(rcPackage.checksum - calculateCheckSum());
+  Serial.print("CHKSUM_DIFF: "); Serial.print(rcPackage.checksum - calculateCheckSum(rcPackage)); Serial.print('\t');
+  Serial.print("V"); Serial.print(radioVersion); Serial.print(" LQ: "); Serial.println(radioLink.quality >> 8);
+}
+
+// the version comes from the length, 0 for a packet that fails its check
+// a version 2 packet is copied into the version 1 layout, with a checksum to match
+byte decodePacket(const byte *payload, byte length, dataStruct *sticks, byte *announcedStep) {
+  if (length == sizeof(rcPacketV2)) {
+    const rcPacketV2 *packet = (const rcPacketV2 *)payload;
+    if (packet->version != RADIO_PROTOCOL_VERSION || crc8(packet, sizeof(rcPacketV2) - 1) != packet->crc) return 0;
+    sticks->throttle = packet->throttle;
+    sticks->roll = packet->roll;
+    sticks->pitch = packet->pitch;
+    sticks->yaw = packet->yaw;
+    sticks->control = packet->control;
+    sticks->alive = packet->sequence;
+    sticks->checksum = calculateCheckSum(*sticks);
+    *announcedStep = packet->link & 0b11;
+    return 2;
+  }
+  if (length == sizeof(dataStruct)) {
+    memcpy(sticks, payload, sizeof(dataStruct));
+    *announcedStep = 0;
+    return sticks->checksum == calculateCheckSum(*sticks) ? 1 : 0;
+  }
+  return 0;
 }
 
 void setupRadio() {
@@ -71,46 +126,82 @@ void setupRadio() {
   radio.enableAckPayload();
   radio.enableDynamicPayloads();
   // RF24_250KBPS for 250kbs, RF24_1MBPS for 1Mbps, or RF24_2MBPS for 2Mbps // slower is more reliable and gives longer range
-  radio.setDataRate(RF24_250KBPS);
+  radio.setDataRate(RF24_250KBPS);  // step 0, a version 2 link moves from there (RadioLink.h)
   //   * @param delay How long to wait between each retry, in multiples of 250us,
   //   * max is 15.  0 means 250us, 15 means 4000us.
   //   * @param count How many retries before giving up, max 15
   //  radio.setRetries();   // default is setRetries(5,15) // note restrictions due to ack payload
+  // (retries are the transmitter's, a version 2 one takes them from the ack: linkRetries())
   radio.openReadingPipe(pipeNumber, address);
+  radio.maskIRQ(true, true, false);  // IRQ on received packets only, not on sent acks
   radio.startListening();
+  pinMode(pinRadioIrq, INPUT);
+  PCMSK1 |= _BV(PCINT9);
+  PCIFR = _BV(PCIF1);  // clear any pending interrupt
+  PCICR |= _BV(PCIE1);
 }
 
 void updateAckStatusForTx() {
   statusForAck = 0;
   statusForAck |= batteryLevel << 5;
   statusForAck |= OK << 1; // obviously need to change if not ok
+  statusForAck |= (bootProgress & 0b11) << 3;
   statusForAck |= 1; // set low bit to 1 always
 }
 
+// the packets are read once the IRQ has flagged them, reading clears the IRQ and the FIFO
+// can hold up to three, so it is drained and only the newest good one is kept
+// every good one goes through the link tracking (RadioLink.h), duplicates and stragglers
+// are counted there and never reach the sticks
 bool checkRadioForInput() {
-  if ( radio.available()) {
-    radio.read( &rcPackage, sizeof(rcPackage) );
-    // load acknowledgement payload for the next transmission (first transmission will not get any ack payload (but will get normal ack))
-    radio.writeAckPayload(1, &statusForAck, sizeof(statusForAck));
-    if (rcPackage.checksum != calculateCheckSum()) {
-      radio.flush_rx();
-      return false;
+  if (!radioPacketPending) return false;
+  unsigned long irqMicros = radioIrqMicros;
+  radioPacketPending = false;  // before the drain, a packet landing during it flags the next pass
+  bool received = false;
+  bool strongSignal = radio.testRPD();
+  unsigned long now = millis();
+  byte announcedStep = 0;
+  while (radio.available()) {
+    byte payload[sizeof(rcPacketV2)];
+    byte length = radio.getDynamicPayloadSize();
+    radio.read(payload, length > sizeof(payload) ? sizeof(payload) : length);
+    dataStruct packet;
+    byte step;
+    byte version = decodePacket(payload, length, &packet, &step);
+    if (!version) {
+      radioStats.badChecksum++;
+      continue;
     }
-    lastRxReceived = millis();
-    radio.flush_rx();
-    updateAckStatusForTx(); // for next time
-    return true;
+    if (linkTakePacket(radioLink, packet.alive, strongSignal, now) != LINK_NEW) continue;
+    if (received) radioStats.superseded++;
+    rcPackage = packet;
+    radioVersion = version;
+    announcedStep = step;
+    received = true;
   }
-  return false;
-}
-
-bool checkHeartbeat() {
-  if (millis() - lastRxReceived > heartbeatTimeout) {
-    rxHeartbeat = false;
+  if (!received) return false;
+  // load acknowledgement payload for the next transmission (first transmission will not get any ack payload (but will get normal ack))
+  if (radioVersion == RADIO_PROTOCOL_VERSION) {
+    linkPlanRate(radioLink);
+    ackPacketV2 ack = {statusForAck, (byte)(radioLink.requestStep | linkRetries(radioLink) << 4), (byte)(radioLink.quality >> 8)};
+    radio.writeAckPayload(pipeNumber, &ack, sizeof(ack));
+    if (linkFollowTransmitter(radioLink, announcedStep)) radio.setDataRate(radioRates[radioLink.rateStep]);
   }
   else {
-    rxHeartbeat = true;
+    radio.writeAckPayload(pipeNumber, &statusForAck, sizeof(statusForAck));
   }
+  radioStats.packets++;
+  radioStats.lastLatency = micros() - irqMicros;
+  if (radioStats.lastLatency > radioStats.maxLatency) radioStats.maxLatency = radioStats.lastLatency;
+  updateAckStatusForTx(); // for next time
+  return true;
+}
+
+// the failsafe: failsafeFrames frames missing in a row (RadioLink.h)
+bool checkHeartbeat() {
+  unsigned long now = millis();
+  if (linkRateFallback(radioLink, now)) radio.setDataRate(radioRates[0]);
+  rxHeartbeat = linkAlive(radioLink, now);
   return rxHeartbeat;
 }
 
@@ -0,0 +1,129 @@
+// ****************************************************************************************
+// Static deadline scheduler for the loop() tasks
+//    tasks are registered once in setup with a period, a deadline (relative to each release)
+//    and a priority; every pass of loop() runs the released job with the earliest absolute
+//    deadline, ties going to the lower priority number
+//    a job may wait on I/O (e.g. an I2cAsync read): its run function returns false and is
+//    polled again on every pass until it returns true, only then is the job complete
+//    a period of 0 makes an event task, polled every pass with no release or deadline
+//    statistics are always kept, they cost a few micros() calls per job
+// ****************************************************************************************
+
+const byte MAX_TASKS = 8;
+const byte NO_TASK = 0xFF;
+
+struct taskStatistics {
+  unsigned long runs;       // completed jobs
+  unsigned long overruns;   // completed later than release + deadline
+  unsigned long skipped;    // releases dropped because the task fell more than a period behind
+  uint16_t lastExec;        // MICROseconds of CPU time in run(), summed over the polls of one job
+  uint16_t maxExec;
+  uint16_t maxJitter;       // MICROseconds from release to the first call of run()
+  uint16_t maxResponse;     // MICROseconds from release to completion
+};
+
+struct task {
+  bool (*run)();            // true once the job is complete, false while it is waiting
+  unsigned long period;     // MICROseconds, 0 = event task
+  unsigned long deadline;   // MICROseconds after the release
+  byte priority;            // 0 is the most urgent
+  unsigned long release;    // of the current (or next) job
+  unsigned long execTime;   // of the current job so far
+  bool waiting;
+  struct taskStatistics stats;
+};
+
+struct task tasks[MAX_TASKS];
+byte numTasks = 0;
+unsigned long schedulerPasses = 0;
+
+// returns the task id (registration order), or NO_TASK if the table is full
+byte addTask(bool (*run)(), unsigned long period, unsigned long deadline, byte priority) {
+  if (numTasks == MAX_TASKS) return NO_TASK;
+  struct task *t = &tasks[numTasks];
+  t->run = run;
+  t->period = period;
+  t->deadline = deadline;
+  t->priority = priority;
+  t->release = 0;
+  t->execTime = 0;
+  t->waiting = false;
+  memset(&t->stats, 0, sizeof(t->stats));
+  return numTasks++;
+}
+
+// first release of every task is now, call at the end of setup
+void schedulerStart() {
+  unsigned long now = micros();
+  for (byte i = 0; i < numTasks; i++) {
+    tasks[i].release = now;
+    tasks[i].waiting = false;
+  }
+}
+
+static inline uint16_t saturateMicros(unsigned long us) {
+  return us > 0xFFFF ? 0xFFFF : (uint16_t)us;
+}
+
+static void runJob(struct task *t) {
+  unsigned long start = micros();
+  if (!t->waiting) {
+    t->execTime = 0;
+    if (t->period > 0) {
+      uint16_t jitter = saturateMicros(start - t->release);
+      if (jitter > t->stats.maxJitter) t->stats.maxJitter = jitter;
+    }
+  }
+  bool done = t->run();
+  unsigned long end = micros();
+  t->execTime += end - start;
+  t->waiting = !done && t->period > 0;
+  if (!done) return;
+
+  t->stats.runs++;
+  uint16_t exec = saturateMicros(t->execTime);
+  t->stats.lastExec = exec;
+  if (exec > t->stats.maxExec) t->stats.maxExec = exec;
+  if (t->period == 0) return;
+
+  unsigned long response = end - t->release;
+  if (response > t->deadline) t->stats.overruns++;
+  if (saturateMicros(response) > t->stats.maxResponse) t->stats.maxResponse = saturateMicros(response);
+  t->release += t->period;
+  if ((long)(end - t->release) >= (long)t->period) {
+    // more than a whole period behind, drop the missed releases rather than running them back to back
+    unsigned long missed = (end - t->release) / t->period;
+    t->stats.skipped += missed;
+    t->release += missed * t->period;
+  }
+}
+
+// call every pass of loop()
+void schedulerRun() {
+  schedulerPasses++;
+  // jobs waiting on I/O and event tasks are polled first, each poll is cheap until the data is in
+  for (byte i = 0; i < numTasks; i++) {
+    if (tasks[i].waiting || tasks[i].period == 0) runJob(&tasks[i]);
+  }
+  unsigned long now = micros();
+  byte best = NO_TASK;
+  unsigned long bestDeadline = 0;
+  for (byte i = 0; i < numTasks; i++) {
+    struct task *t = &tasks[i];
+    if (t->waiting || t->period == 0 || (long)(now - t->release) < 0) continue;  // not released yet
+    unsigned long absDeadline = t->release + t->deadline;
+    if (best == NO_TASK || (long)(absDeadline - bestDeadline) < 0
+        || (absDeadline == bestDeadline && t->priority < tasks[best].priority)) {
+      best = i;
+      bestDeadline = absDeadline;
+    }
+  }
+  if (best != NO_TASK) runJob(&tasks[best]);
+}
+
+void resetTaskStatistics() {
+  for (byte i = 0; i < numTasks; i++) {
+    memset(&tasks[i].stats, 0, sizeof(tasks[i].stats));
+  }
+  schedulerPasses = 0;
+}
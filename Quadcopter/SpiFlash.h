@@ -0,0 +1,94 @@
+// ****************************************************************************************
+// Serial NOR flash (W25Qxx and compatibles) on the SPI bus shared with the radio
+//    only what the blackbox needs: id, status, page program, read and chip erase
+//    program and erase return as soon as the command is clocked out, the chip then works
+//    on its own and flashBusy() says when the next one may be sent
+// ****************************************************************************************
+
+const byte pinFlashCs = 7;
+
+const byte FLASH_WRITE_ENABLE = 0x06;
+const byte FLASH_READ_STATUS = 0x05;
+const byte FLASH_READ_DATA = 0x03;
+const byte FLASH_PAGE_PROGRAM = 0x02;
+const byte FLASH_CHIP_ERASE = 0xC7;
+const byte FLASH_JEDEC_ID = 0x9F;
+const byte FLASH_STATUS_BUSY = 0x01;
+const uint16_t FLASH_PAGE_SIZE = 256;
+
+unsigned long flashSize = 0;  // bytes, 0 if no chip was found
+
+static inline void flashSelect() {
+  SPI.beginTransaction(SPISettings(8000000, MSBFIRST, SPI_MODE0));
+  digitalWrite(pinFlashCs, LOW);
+}
+
+static inline void flashDeselect() {
+  digitalWrite(pinFlashCs, HIGH);
+  SPI.endTransaction();
+}
+
+static void flashCommand(byte command, unsigned long address) {
+  SPI.transfer(command);
+  SPI.transfer(address >> 16);
+  SPI.transfer(address >> 8);
+  SPI.transfer(address);
+}
+
+// true if a chip answered, the capacity comes from the JEDEC id
+bool setupFlash() {
+  pinMode(pinFlashCs, OUTPUT);
+  digitalWrite(pinFlashCs, HIGH);
+  SPI.begin();
+  flashSelect();
+  SPI.transfer(FLASH_JEDEC_ID);
+  byte manufacturer = SPI.transfer(0);
+  SPI.transfer(0);  // memory type
+  byte capacity = SPI.transfer(0);
+  flashDeselect();
+  if (manufacturer == 0x00 || manufacturer == 0xFF || capacity < 16 || capacity > 24) {
+    flashSize = 0;
+    return false;
+  }
+  flashSize = 1UL << capacity;
+  return true;
+}
+
+bool flashBusy() {
+  flashSelect();
+  SPI.transfer(FLASH_READ_STATUS);
+  byte status = SPI.transfer(0);
+  flashDeselect();
+  return status & FLASH_STATUS_BUSY;
+}
+
+static void flashWriteEnable() {
+  flashSelect();
+  SPI.transfer(FLASH_WRITE_ENABLE);
+  flashDeselect();
+}
+
+// must not be busy, and data must not cross a page boundary
+void flashProgram(unsigned long address, const byte *data, uint16_t length) {
+  flashWriteEnable();
+  flashSelect();
+  flashCommand(FLASH_PAGE_PROGRAM, address);
+  for (uint16_t i = 0; i < length; i++) SPI.transfer(data[i]);
+  flashDeselect();
+}
+
+// blocking, setup only
+void flashRead(unsigned long address, byte *data, uint16_t length) {
+  flashSelect();
+  flashCommand(FLASH_READ_DATA, address);
+  for (uint16_t i = 0; i < length; i++) data[i] = SPI.transfer(0);
+  flashDeselect();
+}
+
+// starts the erase, which takes seconds: poll flashBusy()
+void flashEraseChip() {
+  flashWriteEnable();
+  flashSelect();
+  SPI.transfer(FLASH_CHIP_ERASE);
+  flashDeselect();
+}
@@ -0,0 +1,143 @@
+// ****************************************************************************************
+// Binary telemetry stream
+//    telemetryLog() snapshots the flight state into a packed record and frames it straight
+//    into a ring buffer: [type][record][crc16], COBS encoded and terminated by a 0x00
+//    telemetryPump() hands the buffered bytes to the UART only as far as Serial has room,
+//    so the TX interrupt drains them and neither function ever waits for the wire
+//    when the ring is full the record is dropped and counted instead
+//    decode on the host with telemetry_decode (tools/TelemetryDecode.cpp)
+// ****************************************************************************************
+
+const byte TELEMETRY_RECORD_FLIGHT = 1;
+const byte TELEMETRY_BUFFER_SIZE = 128;  // power of 2
+const byte TELEMETRY_BUFFER_MASK = TELEMETRY_BUFFER_SIZE - 1;
+
+// little endian as on the AVR, floats as Q11.4 (PID_VALUE_SCALE)
+struct __attribute__((packed)) telemetryRecord {
+  uint32_t time;           // micros()
+  int16_t angles[3];       // deg, roll pitch yaw
+  int16_t rateTarget[3];   // deg/s
+  int16_t rateActual[3];   // deg/s
+  int16_t rateOutput[3];   // pulse length offset
+  uint16_t motorPulse[4];  // MICROseconds
+  uint16_t gyroExec;       // MICROseconds, last gyro task job
+  uint16_t mainExec;       // MICROseconds, last main task job
+  byte overruns;           // all tasks, wraps
+  byte dropped;            // records lost to a full buffer, wraps
+};
+
+byte telemetryBuffer[TELEMETRY_BUFFER_SIZE];
+byte telemetryHead = 0;  // next free byte, only moved once a whole frame is in
+byte telemetryTail = 0;  // next byte for the UART
+byte telemetryDropped = 0;
+
+// the stream opens with a delimiter so the first frame is not glued to any text printed in setup
+void setupTelemetry() {
+  Serial.begin(telemetryBaud);
+  telemetryBuffer[0] = 0;
+  telemetryHead = 1;
+  telemetryTail = 0;
+}
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF), no table
+static inline uint16_t crc16Update(uint16_t crc, byte data) {
+  byte x = (crc >> 8) ^ data;
+  x ^= x >> 4;
+  return (crc << 8) ^ ((uint16_t)x << 12) ^ ((uint16_t)x << 5) ^ x;
+}
+
+// COBS encoder writing into the ring, each code byte is filled in once its block is known
+byte cobsWrite;
+byte cobsCodeIndex;
+byte cobsCode;
+
+static inline void cobsBegin() {
+  cobsWrite = telemetryHead;
+  cobsCodeIndex = cobsWrite;
+  cobsWrite = (cobsWrite + 1) & TELEMETRY_BUFFER_MASK;
+  cobsCode = 1;
+}
+
+static inline void cobsCloseBlock() {
+  telemetryBuffer[cobsCodeIndex] = cobsCode;
+  cobsCodeIndex = cobsWrite;
+  cobsWrite = (cobsWrite + 1) & TELEMETRY_BUFFER_MASK;
+  cobsCode = 1;
+}
+
+static inline void cobsPut(byte data) {
+  if (data == 0) {
+    cobsCloseBlock();
+    return;
+  }
+  telemetryBuffer[cobsWrite] = data;
+  cobsWrite = (cobsWrite + 1) & TELEMETRY_BUFFER_MASK;
+  if (++cobsCode == 0xFF) cobsCloseBlock();
+}
+
+static inline void cobsEnd() {
+  telemetryBuffer[cobsCodeIndex] = cobsCode;
+  telemetryBuffer[cobsWrite] = 0;
+  telemetryHead = (cobsWrite + 1) & TELEMETRY_BUFFER_MASK;  // publish the frame
+}
+
+byte telemetryFree() {
+  return (telemetryTail - telemetryHead - 1) & TELEMETRY_BUFFER_MASK;
+}
+
+// frames any record type, false (and counted) if there was no room
+bool telemetryWrite(byte type, const void *record, byte length) {
+  if (telemetryFree() < 1 + length + 2 + 2 + 1) {  // type, crc, COBS code bytes, delimiter
+    telemetryDropped++;
+    return false;
+  }
+  const byte *data = (const byte *)record;
+  uint16_t crc = crc16Update(0xFFFF, type);
+  cobsBegin();
+  cobsPut(type);
+  for (byte i = 0; i < length; i++) {
+    crc = crc16Update(crc, data[i]);
+    cobsPut(data[i]);
+  }
+  cobsPut(crc >> 8);
+  cobsPut(crc & 0xFF);
+  cobsEnd();
+  return true;
+}
+
+// the execution times come from the gyro and main tasks, by their addTask handles
+void telemetryLog(byte gyroTask, byte mainTask) {
+  struct telemetryRecord record;
+  record.time = micros();
+  record.angles[ROLL] = pidValueToFixed(bam32ToDegrees(currentAngles.roll));
+  record.angles[PITCH] = pidValueToFixed(bam32ToDegrees(currentAngles.pitch));
+  record.angles[YAW] = pidValueToFixed(bam32ToDegrees(currentAngles.yaw));
+  for (byte i = 0; i < NUM_AXES; i++) {
+    record.rateTarget[i] = pidValueToFixed(ratePid.target[i]);
+    record.rateActual[i] = pidValueToFixed(ratePid.actual[i]);
+    record.rateOutput[i] = pidValueToFixed(ratePid.output[i]);
+  }
+  record.motorPulse[0] = motorPulse[0];
+  record.motorPulse[1] = motorPulse[1];
+  record.motorPulse[2] = motorPulse[2];
+  record.motorPulse[3] = motorPulse[3];
+  record.gyroExec = tasks[gyroTask].stats.lastExec;
+  record.mainExec = tasks[mainTask].stats.lastExec;
+  byte overruns = 0;
+  for (byte i = 0; i < numTasks; i++) overruns += tasks[i].stats.overruns;
+  record.overruns = overruns;
+  record.dropped = telemetryDropped;
+  telemetryWrite(TELEMETRY_RECORD_FLIGHT, &record, sizeof(record));
+}
+
+// call often (it is a scheduler event task), true if anything was handed over
+bool telemetryPump() {
+  int room = Serial.availableForWrite();
+  bool sent = false;
+  while (room-- > 0 && telemetryTail != telemetryHead) {
+    Serial.write(telemetryBuffer[telemetryTail]);
+    telemetryTail = (telemetryTail + 1) & TELEMETRY_BUFFER_MASK;
+    sent = true;
+  }
+  return sent;
+}
@@ -0,0 +1,28 @@
+// ****************************************************************************************
+// Minimal timing harness for the host benchmarks
+//    runs a function many times and reports the mean wall time per call
+// ****************************************************************************************
+
+#ifndef BENCH_BENCH_H
+#define BENCH_BENCH_H
+
+#include <chrono>
+#include <stdio.h>
+
+const unsigned long BENCH_DEFAULT_ITERATIONS = 1000000;
+
+// sink for results so the optimiser cannot throw the work away
+extern volatile float benchSink;
+
+template <typename Fn>
+double benchmark(const char *name, Fn fn, unsigned long iterations = BENCH_DEFAULT_ITERATIONS) {
+  for (unsigned long i = 0; i < iterations / 10; i++) fn(i);  // warm up caches and branch predictors
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (unsigned long i = 0; i < iterations; i++) fn(i);
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  double nsPerCall = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+  if (name) printf("%-40s %10.2f ns/call\n", name, nsPerCall);  // NULL just returns the time
+  return nsPerCall;
+}
+
+#endif
@@ -0,0 +1,1600 @@
+// ****************************************************************************************
+// Host benchmarks for the flight control hot paths
+//    numbers are host wall time, useful for relative comparisons between implementations
+//    (cycle counts on the ATmega328P itself come from the simavr harness)
+// ****************************************************************************************
+
+#include "QuadcopterFirmware.h"
+#include "HalHost.h"
+#include "Bench.h"
+#include "TelemetryDecoder.h"
+#include "BlackboxDecoder.h"
+#include "DshotDecoder.h"
+#include "LinkSimulator.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+volatile float benchSink;
+
+// cheap deterministic pseudo sensor noise so each call sees different data
+static int16_t noise(unsigned long i, int16_t amplitude) {
+  return (int16_t)(((i * 2654435761UL) >> 16) % (2 * amplitude + 1)) - amplitude;
+}
+
+static void setupFirmware() {
+  hal::reset();
+  hal::i2cSetRegisters(MPU_ADDRESS, WHO_AM_I, &MPU_ADDRESS, 1);
+  hal::i2cSetRegister16(MPU_ADDRESS, ACCEL_ZOUT_H, 4096);  // 1g at +/-8g full scale
+  hal::twiAttachInterrupt(TWI_vect);
+  hal::i2cAttachFifo(MPU_ADDRESS, FIFO_R_W, FIFO_COUNTH);
+  setupMpuFifo();
+  setupPid();
+  pidRateModeOn();
+  pidAttitudeModeOn();
+}
+
+static void benchProcessGyroData(unsigned long i) {
+  gyX = noise(i, 400);
+  gyY = noise(i + 1, 400);
+  gyZ = noise(i + 2, 400);
+  lastReadingTime = thisReadingTime;
+  thisReadingTime += gyroLoopFreq;
+  processGyroData();
+  benchSink = currentAngles.roll;
+}
+
+static void benchProcessAccelData(unsigned long i) {
+  accX = noise(i, 300);
+  accY = noise(i + 1, 300);
+  accZ = 4096 + noise(i + 2, 300);
+  processAccelData();
+  benchSink = accelAngles.pitch;
+}
+
+static void benchCombineGyroMagHeadings(unsigned long i) {
+  magHeading = degreesToBam(170 + noise(i, 20));  // either side of +/-180
+  combineGyroMagHeadings();
+  benchSink = currentAngles.yaw;
+}
+
+// the gyro heading just left of +180, the compass just right of -180: the fused heading must go the 4 degrees round
+static void reportHeadingWrap() {
+  currentAngles.yaw = degreesToBam32(178);
+  magHeading = degreesToBam(-178);
+  float largestStep = 0;
+  for (int i = 0; i < 200; i++) {
+    bam32 before = currentAngles.yaw;
+    combineGyroMagHeadings();
+    float step = fabsf(bam32ToDegrees(bamDifference32(currentAngles.yaw, before)));
+    if (step > largestStep) largestStep = step;
+  }
+  printf("%-40s 178 -> %.3f deg (compass -178), largest step %.3f deg\n", "heading fusion across +/-180",
+         bam32ToDegrees(currentAngles.yaw), largestStep);
+}
+
+static void benchCombineGyroAccelData(unsigned long i) {
+  accelAngles.roll = degreesToBam32(noise(i, 30));
+  accelAngles.pitch = degreesToBam32(noise(i + 1, 30));
+  combineGyroAccelData();
+  benchSink = currentAngles.pitch;
+}
+
+static void benchPidRateUpdate(unsigned long i) {
+  ratePid.target[ROLL] = noise(i, 120);
+  ratePid.target[PITCH] = noise(i + 1, 120);
+  ratePid.target[YAW] = noise(i + 2, 120);
+  ratePid.actual[ROLL] = noise(i + 3, 120);
+  ratePid.actual[PITCH] = noise(i + 4, 120);
+  ratePid.actual[YAW] = noise(i + 5, 120);
+  pidRateUpdate();
+  benchSink = ratePid.output[ROLL];
+}
+
+// the layout the PidBank replaced: one PID object per axis linked by pointers to a settings struct
+struct pidSettings {
+  float actual;
+  float output;
+  float target;
+};
+
+static pidSettings objectRoll, objectPitch, objectYaw;
+static PID objectPidRoll(&objectRoll.actual, &objectRoll.output, &objectRoll.target, rateRollKp, rateRollKi, rateRollKd, DIRECT, mainLoopFreqMillis);
+static PID objectPidPitch(&objectPitch.actual, &objectPitch.output, &objectPitch.target, ratePitchKp, ratePitchKi, ratePitchKd, DIRECT, mainLoopFreqMillis);
+static PID objectPidYaw(&objectYaw.actual, &objectYaw.output, &objectYaw.target, rateYawKp, rateYawKi, rateYawKd, DIRECT, mainLoopFreqMillis);
+
+static void setupObjectPids() {
+  objectPidRoll.SetOutputLimits(pidRateMin, pidRateMax);
+  objectPidPitch.SetOutputLimits(pidRateMin, pidRateMax);
+  objectPidYaw.SetOutputLimits(pidRateMin, pidRateMax);
+  objectPidRoll.SetMode(AUTOMATIC);
+  objectPidPitch.SetMode(AUTOMATIC);
+  objectPidYaw.SetMode(AUTOMATIC);
+}
+
+static void benchPidObjectsRateUpdate(unsigned long i) {
+  objectRoll.target = noise(i, 120);
+  objectPitch.target = noise(i + 1, 120);
+  objectYaw.target = noise(i + 2, 120);
+  objectRoll.actual = noise(i + 3, 120);
+  objectPitch.actual = noise(i + 4, 120);
+  objectYaw.actual = noise(i + 5, 120);
+  objectPidRoll.Compute(false);
+  objectPidPitch.Compute(false);
+  objectPidYaw.Compute(false);
+  benchSink = objectRoll.output;
+}
+
+// standalone float and fixed point controllers fed identical data, for timing and equivalence
+struct PidPair {
+  float input, output, setpoint;
+  float inputFixed, outputFixed, setpointFixed;
+  PID pidFloat;
+  PIDFixed pidFixed;
+  PidPair(float kp, float ki, float kd, float limit)
+    : input(0), output(0), setpoint(0), inputFixed(0), outputFixed(0), setpointFixed(0),
+      pidFloat(&input, &output, &setpoint, kp, ki, kd, DIRECT, mainLoopFreqMillis),
+      pidFixed(&inputFixed, &outputFixed, &setpointFixed, kp, ki, kd, DIRECT, mainLoopFreq) {
+    pidFloat.SetOutputLimits(-limit, limit);
+    pidFixed.SetOutputLimits(-limit, limit);
+    pidFloat.SetMode(AUTOMATIC);
+    pidFixed.SetMode(AUTOMATIC);
+  }
+};
+
+static PidPair ratePair(rateRollKp, rateRollKi, rateRollKd, pidRateMax);
+static PidPair rateEquivalencePair(rateRollKp, rateRollKi, rateRollKd, pidRateMax);
+static PidPair attitudeEquivalencePair(attitudeRollKp, attitudeRollKi, attitudeRollKd, pidAttitudeMax);
+
+static void benchPidFloatCompute(unsigned long i) {
+  ratePair.setpoint = noise(i, 120);
+  ratePair.input = noise(i + 1, 120);
+  ratePair.pidFloat.Compute();
+  benchSink = ratePair.output;
+}
+
+static void benchPidFixedCompute(unsigned long i) {
+  ratePair.setpointFixed = noise(i, 120);
+  ratePair.inputFixed = noise(i + 1, 120);
+  ratePair.pidFixed.Compute();
+  benchSink = ratePair.outputFixed;
+}
+
+static void benchPidFixedComputeFixed(unsigned long i) {
+  benchSink = ratePair.pidFixed.ComputeFixed(noise(i, 120 * 16), noise(i + 1, 120 * 16));
+}
+
+// drives both controllers along the same slowly varying trajectory and reports the worst output difference
+static void reportPidEquivalence(const char *name, PidPair *pair, float amplitude, bool allTerms) {
+  float maxDiff = 0;
+  double sumSquares = 0;
+  const unsigned long steps = 20000;
+  for (unsigned long i = 0; i < steps; i++) {
+    float setpoint = amplitude * sinf(i * 0.003f);
+    float input = amplitude * sinf(i * 0.003f - 0.4f) + noise(i, 2) * 0.25f;
+    pair->setpoint = pair->setpointFixed = setpoint;
+    pair->input = pair->inputFixed = input;
+    pair->pidFloat.Compute(allTerms);
+    pair->pidFixed.Compute(allTerms);
+    float diff = fabsf(pair->output - pair->outputFixed);
+    if (diff > maxDiff) maxDiff = diff;
+    sumSquares += diff * diff;
+  }
+  printf("%-40s max %.4f  rms %.4f\n", name, maxDiff, sqrt(sumSquares / steps));
+}
+
+// queue, clock through the simulated TWI peripheral and unpack one gyro read
+static void benchAsyncGyroRead(unsigned long i) {
+  hal::i2cSetRegister16(MPU_ADDRESS, GYRO_XOUT_H, noise(i, 400));
+  startGyroRead();
+  hal::twiService();
+  finishGyroRead();
+  benchSink = gyX;
+}
+
+// two samples waiting per data ready interrupt: count read, one burst read, unpack both
+static void benchFifoBurstRead(unsigned long i) {
+  byte samples[2 * FIFO_SAMPLE_SIZE] = {0};
+  samples[6] = (uint16_t)noise(i, 400) >> 8;
+  samples[FIFO_SAMPLE_SIZE + 6] = (uint16_t)noise(i + 1, 400) >> 8;
+  hal::i2cFifoPush(samples, sizeof(samples));
+  hal::gpioInterrupt(digitalPinToInterrupt(pinMpuInterrupt));
+  byte n = 0;
+  while (n == 0) {
+    n = serviceMpuFifo();
+    hal::twiService();
+  }
+  for (byte k = 0; k < n; k++) unpackFifoSample(k);
+  benchSink = gyX;
+}
+
+// simulated bus time per gyro+accel sample, separate register reads vs FIFO bursts
+// ****************************************************************************************
+//        FLOAT vs FIXED POINT SENSOR PIPELINE
+//    a recorded 10s simulated flight: roll and pitch oscillations, a steady yaw turn, motor
+//    vibration on every sample and +/-50us of jitter on the gyro timestamps, the gyro consistent
+//    with the accel angles; the bench is built with the float pipeline selected (SENSOR_FIXED_POINT off)
+// ****************************************************************************************
+
+const unsigned long SENSOR_TICKS_PER_MAIN = mainLoopFreq / 1250;  // 800Hz gyro ticks per accel sample
+const unsigned long SENSOR_TRACE_TICKS = 8000;
+
+struct sensorSample {
+  int16_t gyro[3];
+  int16_t accel[3];  // only used on main loop ticks
+  uint16_t interval;
+};
+
+static sensorSample sensorTrace[SENSOR_TRACE_TICKS];
+
+// recorded once so the timings are of the pipeline only
+static void recordSensorTrace() {
+  for (unsigned long i = 0; i < SENSOR_TRACE_TICKS; i++) {
+    sensorSample *sample = &sensorTrace[i];
+    float t = i * 0.00125f;
+    sample->gyro[0] = (int16_t)(20 * 2 * M_PI * 0.5f * cosf(2 * M_PI * 0.5f * t) / gyroRes) + noise(i, 60);
+    sample->gyro[1] = (int16_t)(15 * 2 * M_PI * 0.3f * cosf(2 * M_PI * 0.3f * t + 1) / gyroRes) + noise(i + 1, 60);
+    sample->gyro[2] = (int16_t)(30 / gyroRes) + noise(i + 2, 60);
+    sample->interval = 1250 + noise(i + 3, 50);
+    float roll = (20 * sinf(2 * M_PI * 0.5f * t) + offsetAngle[0]) * DEG_TO_RAD;
+    float pitch = (15 * sinf(2 * M_PI * 0.3f * t + 1) + offsetAngle[1]) * DEG_TO_RAD;
+    sample->accel[0] = -(int16_t)(4096 * sinf(pitch)) + noise(i, 300) + accelXOffset;  // applyAccelOffsets flips X
+    sample->accel[1] = (int16_t)(4096 * sinf(roll)) + noise(i + 1, 300) + accelYOffset;
+    sample->accel[2] = (int16_t)(4096 * cosf(roll) * cosf(pitch)) + noise(i + 2, 300) + accelZOffset;
+  }
+}
+
+static void simulateGyroSample(unsigned long i) {
+  const sensorSample *sample = &sensorTrace[i % SENSOR_TRACE_TICKS];
+  gyX = sample->gyro[0];
+  gyY = sample->gyro[1];
+  gyZ = sample->gyro[2];
+  lastReadingTime = thisReadingTime;
+  thisReadingTime += sample->interval;
+  applyGyroOffsets();
+}
+
+static void simulateAccelSample(unsigned long i) {
+  const sensorSample *sample = &sensorTrace[i % SENSOR_TRACE_TICKS];
+  accX = sample->accel[0];
+  accY = sample->accel[1];
+  accZ = sample->accel[2];
+  applyAccelOffsets();
+}
+
+static void resetSensorState() {
+  currentAngles.roll = currentAngles.pitch = currentAngles.yaw = 0;
+  accXAve = accYAve = 0;
+  accZAve = 4096;
+  loadSensorStateFixed();
+}
+
+static void benchSensorTickFloat(unsigned long i) {
+  simulateGyroSample(i);
+  convertGyroReadingsToValues();
+  accumulateGyroChange();
+  if (i % SENSOR_TICKS_PER_MAIN == 0) {
+    simulateAccelSample(i);
+    accumulateAccelReadings();
+    calcAnglesAccel();
+    applyAngleOffsets();
+    combineGyroAccelData();
+  }
+  benchSink = currentAngles.roll;
+}
+
+static void benchSensorTickFixed(unsigned long i) {
+  simulateGyroSample(i);
+  convertGyroReadingsToValues();
+  accumulateGyroChangeFixed();
+  if (i % SENSOR_TICKS_PER_MAIN == 0) {
+    simulateAccelSample(i);
+    accumulateAccelReadingsFixed();
+    calcAnglesAccelFixed();
+    combineGyroAccelDataFixed();
+  }
+  benchSink = currentAngles.roll;
+}
+
+// both pipelines side by side on the same samples, each with its own copy of the angles,
+// compared at every main loop
+static void reportSensorEquivalence() {
+  resetSensorState();
+  struct angle floatAngles = currentAngles;
+  struct angle fixedAngles = currentAngles;
+  float maxDiff[3] = {0, 0, 0};
+  double sumSquares[3] = {0, 0, 0};
+  unsigned long compared = 0;
+  for (unsigned long i = 0; i < SENSOR_TRACE_TICKS; i++) {
+    simulateGyroSample(i);
+    convertGyroReadingsToValues();
+    currentAngles = floatAngles;
+    accumulateGyroChange();
+    floatAngles = currentAngles;
+    currentAngles = fixedAngles;
+    accumulateGyroChangeFixed();
+    fixedAngles = currentAngles;
+    if (i % SENSOR_TICKS_PER_MAIN != 0) continue;
+    simulateAccelSample(i);
+    currentAngles = floatAngles;
+    accumulateAccelReadings();
+    calcAnglesAccel();
+    applyAngleOffsets();
+    combineGyroAccelData();
+    floatAngles = currentAngles;
+    currentAngles = fixedAngles;
+    accumulateAccelReadingsFixed();
+    calcAnglesAccelFixed();
+    combineGyroAccelDataFixed();
+    fixedAngles = currentAngles;
+    float diff[3] = {bam32ToDegrees(bamDifference32(fixedAngles.roll, floatAngles.roll)),
+                     bam32ToDegrees(bamDifference32(fixedAngles.pitch, floatAngles.pitch)),
+                     bam32ToDegrees(bamDifference32(fixedAngles.yaw, floatAngles.yaw))};
+    for (byte axis = 0; axis < 3; axis++) {
+      if (fabsf(diff[axis]) > maxDiff[axis]) maxDiff[axis] = fabsf(diff[axis]);
+      sumSquares[axis] += diff[axis] * diff[axis];
+    }
+    compared++;
+  }
+  printf("%-40s roll max %.4f rms %.4f  pitch max %.4f rms %.4f  yaw max %.4f rms %.4f deg\n",
+         "sensor pipeline (10s simulated flight)", maxDiff[0], sqrt(sumSquares[0] / compared),
+         maxDiff[1], sqrt(sumSquares[1] / compared), maxDiff[2], sqrt(sumSquares[2] / compared));
+}
+
+static void reportSensorPipeline() {
+  resetSensorState();
+  double floatNs = benchmark("sensor pipeline per 800Hz tick (float)", benchSensorTickFloat);
+  resetSensorState();
+  double fixedNs = benchmark("sensor pipeline per 800Hz tick (fixed)", benchSensorTickFixed);
+  printf("%-40s %10.2f ns/tick on the host FPU, the AVR has none (see the gyro and main stages in simbench)\n",
+         "fixed point saving", floatNs - fixedNs);
+}
+
+// ****************************************************************************************
+//        ONLINE GYRO BIAS
+//    booting 30/-20/15 counts (about 1 deg/s) out, 1s still on the ground and then two minutes
+//    of the flight above (looped), with the bias drifting by 12 to 24 counts as the sensor warms
+//    up; the trace has no compass, so z is only corrected on the ground
+// ****************************************************************************************
+
+const unsigned long GYRO_BIAS_STILL_TICKS = 800;
+const unsigned long GYRO_BIAS_FLIGHT_TICKS = 12 * SENSOR_TRACE_TICKS;
+const float gyroBiasStart[3] = {30, -20, 15};
+const float gyroBiasWarmUp[3] = {0.2f, -0.2f, 0.1f};  // counts/s
+
+// one 800Hz tick of the float pipeline with the estimator hooked in as GYRO_BIAS_ONLINE does
+static void gyroBiasTick(unsigned long tick, const int16_t *gyro, const int16_t *accel, float *trueBias) {
+  for (byte axis = 0; axis < 3; axis++) {
+    trueBias[axis] = gyroBiasStart[axis] + gyroBiasWarmUp[axis] * tick * 0.00125f;
+  }
+  gyX = gyro[0] + (int16_t)lround(trueBias[0]);
+  gyY = gyro[1] + (int16_t)lround(trueBias[1]);
+  gyZ = gyro[2] + (int16_t)lround(trueBias[2]);
+  lastReadingTime = thisReadingTime;
+  thisReadingTime += 1250;
+  applyGyroOffsets();
+  sumGyroForBias();
+  convertGyroReadingsToValues();
+  accumulateGyroChange();
+  if (tick % SENSOR_TICKS_PER_MAIN == 0) {
+    accX = accel[0];
+    accY = accel[1];
+    accZ = accel[2];
+    applyAccelOffsets();
+    accumulateAccelReadings();
+    calcAnglesAccel();
+    applyAngleOffsets();
+    estimateGyroBias();
+    combineGyroAccelData();
+  }
+}
+
+static void reportGyroBias() {
+  // resting at the attitude the flight starts from, as finishAngleInitialisation leaves it
+  accX = sensorTrace[0].accel[0];
+  accY = sensorTrace[0].accel[1];
+  accZ = sensorTrace[0].accel[2];
+  applyAccelOffsets();
+  accXAve = accX;
+  accYAve = accY;
+  accZAve = accZ;
+  calcAnglesAccel();
+  applyAngleOffsets();
+  currentAngles = accelAngles;
+  gyXOffset = gyYOffset = gyZOffset = 0;  // what the temperature model gave
+  setupGyroBias();
+  float trueBias[3];
+  float stillError[3] = {0, 0, 0};
+  unsigned long stillLoops = 0;  // main loops taken as still, by the time stillError is taken
+  unsigned long tick = 0;
+  for (; tick < GYRO_BIAS_STILL_TICKS; tick++) {
+    const int16_t gyro[3] = {noise(tick, 7), noise(tick + 1, 7), noise(tick + 2, 7)};
+    const int16_t accel[3] = {(int16_t)(sensorTrace[0].accel[0] + noise(tick, 30)), (int16_t)(sensorTrace[0].accel[1] + noise(tick + 1, 30)),
+                              (int16_t)(sensorTrace[0].accel[2] + noise(tick + 2, 30))};
+    gyroBiasTick(tick, gyro, accel, trueBias);
+    if (tick <= GYRO_BIAS_STILL_TICKS / 2 && tick % SENSOR_TICKS_PER_MAIN == 0 && frameStill) stillLoops++;
+    if (tick == GYRO_BIAS_STILL_TICKS / 2) {
+      for (byte axis = 0; axis < 3; axis++) stillError[axis] = gyroBias[axis] - trueBias[axis];
+    }
+  }
+  float armedBias[3] = {gyroBias[0], gyroBias[1], gyroBias[2]};
+  double sumSquares[3] = {0, 0, 0}, frozenSumSquares[3] = {0, 0, 0};
+  unsigned long compared = 0;
+  for (unsigned long i = 0; i < GYRO_BIAS_FLIGHT_TICKS; i++, tick++) {
+    const sensorSample *sample = &sensorTrace[i % SENSOR_TRACE_TICKS];
+    gyroBiasTick(tick, sample->gyro, sample->accel, trueBias);
+    if (i < GYRO_BIAS_FLIGHT_TICKS / 2) continue;
+    for (byte axis = 0; axis < 3; axis++) {
+      sumSquares[axis] += (gyroBias[axis] - trueBias[axis]) * (gyroBias[axis] - trueBias[axis]);
+      frozenSumSquares[axis] += (armedBias[axis] - trueBias[axis]) * (armedBias[axis] - trueBias[axis]);
+    }
+    compared++;
+  }
+  if (stillLoops) {
+    printf("%-40s x %6.2f  y %6.2f  z %6.2f counts (started 30 -20 15 out, %lu still main loops)\n",
+           "bias error after 0.5s still", stillError[0], stillError[1], stillError[2], stillLoops);
+  }
+  else {
+    printf("%-40s never taken as still, no estimate\n", "bias error after 0.5s still");
+  }
+  printf("%-40s x %6.2f  y %6.2f  z %6.2f counts rms\n", "bias error in flight, tracked (2nd min)",
+         sqrt(sumSquares[0] / compared), sqrt(sumSquares[1] / compared), sqrt(sumSquares[2] / compared));
+  printf("%-40s x %6.2f  y %6.2f  z %6.2f counts rms (1 count = %.3f deg/s)\n", "bias error in flight, frozen (2nd min)",
+         sqrt(frozenSumSquares[0] / compared), sqrt(frozenSumSquares[1] / compared),
+         sqrt(frozenSumSquares[2] / compared), gyroRes);
+}
+
+// ****************************************************************************************
+//        COMPLEMENTARY FILTER vs QUATERNION AHRS
+//    a recorded 20s simulated flight where roll, pitch and yaw move together: +/-25 and +/-20
+//    degree oscillations during a 36 deg/s turn, a gyro bias the calibration missed, motor
+//    vibration, and a compass field inclined 63 degrees that tilts with the frame; both
+//    estimators start from the true attitude and are compared with it at every main loop
+//    after the first 2s
+//    the flight ends where it started (two full turns), so it can be flown again and again:
+//    the AHRS bias estimate takes a few time constants of ahrsKp / ahrsKi (10s, 50s for yaw
+//    with ahrsKpMag) to settle, so it is checked after flightBiasPasses of it
+// ****************************************************************************************
+
+const unsigned long FLIGHT_TRACE_TICKS = 16000;
+const unsigned long FLIGHT_TICKS_PER_MAG = magLoopFreq * 1000 / 1250;
+const unsigned long FLIGHT_SETTLE_TICKS = 1600;
+const double flightGyroBias[3] = {12, -8, 6};  // counts, 0.4 deg/s
+const byte flightBiasPasses = 9;
+const double flightBiasTolerance = 1;  // counts, deg/s is gyroRes times this
+
+struct flightSample {
+  int16_t gyro[3];
+  int16_t accel[3];
+  int16_t mag[3];
+  bam32 truth[3];  // ZYX roll, pitch, yaw, less the mounting offsets as both estimators report them
+};
+
+static flightSample flightTrace[FLIGHT_TRACE_TICKS];
+
+// v = conj(q) * v * q, earth to body
+static void rotateToBody(const double *q, const double *v, double *out) {
+  double r00 = 1 - 2 * (q[2] * q[2] + q[3] * q[3]), r01 = 2 * (q[1] * q[2] - q[0] * q[3]), r02 = 2 * (q[1] * q[3] + q[0] * q[2]);
+  double r10 = 2 * (q[1] * q[2] + q[0] * q[3]), r11 = 1 - 2 * (q[1] * q[1] + q[3] * q[3]), r12 = 2 * (q[2] * q[3] - q[0] * q[1]);
+  double r20 = 2 * (q[1] * q[3] - q[0] * q[2]), r21 = 2 * (q[2] * q[3] + q[0] * q[1]), r22 = 1 - 2 * (q[1] * q[1] + q[2] * q[2]);
+  out[0] = r00 * v[0] + r10 * v[1] + r20 * v[2];
+  out[1] = r01 * v[0] + r11 * v[1] + r21 * v[2];
+  out[2] = r02 * v[0] + r12 * v[1] + r22 * v[2];
+}
+
+// the attitude is set as Euler angles and the gyro gets the body rates that go with them
+static void recordFlightTrace() {
+  const double field[3] = {0.45 * 300, 0, -0.89 * 300};  // north and down, in counts
+  const double up[3] = {0, 0, 4096};
+  const int16_t gyroOffsets[3] = {gyXOffset, gyYOffset, gyZOffset};  // the calibration takes these off again
+  for (unsigned long i = 0; i < FLIGHT_TRACE_TICKS; i++) {
+    flightSample *sample = &flightTrace[i];
+    double t = i * 0.00125;
+    double roll = 25 * DEG_TO_RAD * sin(2 * M_PI * 0.5 * t);
+    double pitch = 20 * DEG_TO_RAD * sin(2 * M_PI * 0.3 * t + 1);
+    double yaw = 36 * DEG_TO_RAD * t + 30 * DEG_TO_RAD * sin(2 * M_PI * 0.2 * t);
+    double rollRate = 25 * DEG_TO_RAD * 2 * M_PI * 0.5 * cos(2 * M_PI * 0.5 * t);
+    double pitchRate = 20 * DEG_TO_RAD * 2 * M_PI * 0.3 * cos(2 * M_PI * 0.3 * t + 1);
+    double yawRate = 36 * DEG_TO_RAD + 30 * DEG_TO_RAD * 2 * M_PI * 0.2 * cos(2 * M_PI * 0.2 * t);
+    double rate[3] = {rollRate - yawRate * sin(pitch),
+                      pitchRate * cos(roll) + yawRate * sin(roll) * cos(pitch),
+                      yawRate * cos(roll) * cos(pitch) - pitchRate * sin(roll)};
+    for (byte axis = 0; axis < 3; axis++) {
+      sample->gyro[axis] = (int16_t)lround(rate[axis] / ahrsGyroRadians + flightGyroBias[axis]) + noise(i + axis, 60) + gyroOffsets[axis];
+    }
+    double cr = cos(roll / 2), sr = sin(roll / 2), cp = cos(pitch / 2), sp = sin(pitch / 2), cy = cos(yaw / 2), sy = sin(yaw / 2);
+    double q[4] = {cr * cp * cy + sr * sp * sy, sr * cp * cy - cr * sp * sy, cr * sp * cy + sr * cp * sy, cr * cp * sy - sr * sp * cy};
+    double body[3];
+    rotateToBody(q, up, body);
+    sample->accel[0] = (int16_t)lround(body[0]) + noise(i, 300) + accelXOffset;  // applyAccelOffsets flips X
+    sample->accel[1] = (int16_t)lround(body[1]) + noise(i + 1, 300) + accelYOffset;
+    sample->accel[2] = (int16_t)lround(body[2]) + noise(i + 2, 300) + accelZOffset;
+    rotateToBody(q, field, body);
+    sample->mag[0] = (int16_t)lround(body[0]) + noise(i, 2) + mxo;
+    sample->mag[1] = (int16_t)lround(body[1]) + noise(i + 1, 2) + myo;
+    sample->mag[2] = (int16_t)lround(body[2]) + noise(i + 2, 2);
+    sample->truth[0] = bamDifference32(degreesToBam32(roll * RAD_TO_DEG), offsetAngleBam[0]);
+    sample->truth[1] = bamDifference32(degreesToBam32(pitch * RAD_TO_DEG), offsetAngleBam[1]);
+    sample->truth[2] = degreesToBam32(fmod(yaw * RAD_TO_DEG + 180, 360) - 180);
+  }
+}
+
+static void simulateFlightGyro(unsigned long i) {
+  const flightSample *sample = &flightTrace[i % FLIGHT_TRACE_TICKS];
+  gyX = sample->gyro[0];
+  gyY = sample->gyro[1];
+  gyZ = sample->gyro[2];
+  lastReadingTime = thisReadingTime;
+  thisReadingTime += 1250;
+  applyGyroOffsets();
+  convertGyroReadingsToValues();
+}
+
+static void simulateFlightAccel(unsigned long i) {
+  const flightSample *sample = &flightTrace[i % FLIGHT_TRACE_TICKS];
+  accX = sample->accel[0];
+  accY = sample->accel[1];
+  accZ = sample->accel[2];
+  applyAccelOffsets();
+}
+
+static void simulateFlightMag(unsigned long i) {
+  const flightSample *sample = &flightTrace[i % FLIGHT_TRACE_TICKS];
+  mx = sample->mag[0];
+  my = sample->mag[1];
+  mz = sample->mag[2];
+  processMagData();
+}
+
+static void resetFlightState() {
+  currentAngles.roll = flightTrace[0].truth[0];
+  currentAngles.pitch = flightTrace[0].truth[1];
+  currentAngles.yaw = flightTrace[0].truth[2];
+  simulateFlightAccel(0);
+  accXAve = accX;
+  accYAve = accY;
+  accZAve = accZ;
+  loadSensorStateFixed();
+  yawOffsetAngle = 0;  // the flight starts facing north
+  simulateFlightMag(0);
+  ahrsSetAngles(&currentAngles);
+}
+
+static void benchFlightTickComplementary(unsigned long i) {
+  simulateFlightGyro(i);
+  accumulateGyroChange();
+  if (i % FLIGHT_TICKS_PER_MAG == 0) {
+    simulateFlightMag(i);
+    combineGyroMagHeadings();
+  }
+  if (i % SENSOR_TICKS_PER_MAIN == 0) {
+    simulateFlightAccel(i);
+    accumulateAccelReadings();
+    calcAnglesAccel();
+    applyAngleOffsets();
+    combineGyroAccelData();
+  }
+  benchSink = currentAngles.roll;
+}
+
+static void benchFlightTickAhrs(unsigned long i) {
+  simulateFlightGyro(i);
+  ahrsIntegrateGyro();
+  if (i % FLIGHT_TICKS_PER_MAG == 0) {
+    simulateFlightMag(i);
+  }
+  if (i % SENSOR_TICKS_PER_MAIN == 0) {
+    simulateFlightAccel(i);
+    accumulateAccelReadingsFixed();
+    ahrsCorrect();
+    ahrsUpdateAngles();
+  }
+  benchSink = currentAngles.roll;
+}
+
+static void reportEstimatorError(const char *name, void (*tick)(unsigned long)) {
+  resetFlightState();
+  float maxError[3] = {0, 0, 0};
+  double sumSquares[3] = {0, 0, 0};
+  unsigned long compared = 0;
+  for (unsigned long i = 0; i < FLIGHT_TRACE_TICKS; i++) {
+    tick(i);
+    if (i < FLIGHT_SETTLE_TICKS || i % SENSOR_TICKS_PER_MAIN != 0) continue;
+    const bam32 *truth = flightTrace[i].truth;
+    float error[3] = {bam32ToDegrees(bamDifference32(currentAngles.roll, truth[0])),
+                      bam32ToDegrees(bamDifference32(currentAngles.pitch, truth[1])),
+                      bam32ToDegrees(bamDifference32(currentAngles.yaw, truth[2]))};
+    for (byte axis = 0; axis < 3; axis++) {
+      if (fabsf(error[axis]) > maxError[axis]) maxError[axis] = fabsf(error[axis]);
+      sumSquares[axis] += error[axis] * error[axis];
+    }
+    compared++;
+  }
+  printf("%-40s roll max %6.2f rms %5.2f  pitch max %6.2f rms %5.2f  yaw max %6.2f rms %5.2f deg\n", name,
+         maxError[0], sqrt(sumSquares[0] / compared), maxError[1], sqrt(sumSquares[1] / compared),
+         maxError[2], sqrt(sumSquares[2] / compared));
+}
+
+static void reportAhrsBias() {
+  resetFlightState();
+  for (unsigned long i = 0; i < flightBiasPasses * FLIGHT_TRACE_TICKS; i++) {
+    benchFlightTickAhrs(i);
+  }
+  double estimate[3];
+  bool ok = true;
+  for (byte axis = 0; axis < 3; axis++) {
+    estimate[axis] = -ahrsBias[axis] / (double)(1L << AHRS_BIAS_FRAC_BITS);  // the feedback cancels the bias
+    if (fabs(estimate[axis] - flightGyroBias[axis]) > flightBiasTolerance) ok = false;
+  }
+  printf("%-40s %.2f %.2f %.2f deg/s after %us (true %.2f %.2f %.2f) %s\n", "AHRS gyro bias estimate",
+         estimate[0] * gyroRes, estimate[1] * gyroRes, estimate[2] * gyroRes,
+         (unsigned)(flightBiasPasses * FLIGHT_TRACE_TICKS / 800), flightGyroBias[0] * gyroRes,
+         flightGyroBias[1] * gyroRes, flightGyroBias[2] * gyroRes, ok ? "ok" : "OUT OF TOLERANCE");
+}
+
+static void reportAttitudeEstimators() {
+  reportEstimatorError("complementary filter (20s flight)", benchFlightTickComplementary);
+  reportEstimatorError("quaternion AHRS (20s flight)", benchFlightTickAhrs);
+  reportAhrsBias();
+  resetFlightState();
+  benchmark("estimator per 800Hz tick (complementary)", benchFlightTickComplementary);
+  resetFlightState();
+  benchmark("estimator per 800Hz tick (AHRS)", benchFlightTickAhrs);
+  benchmark("ahrsIntegrateGyro", [](unsigned long) { ahrsIntegrateGyro(); benchSink = ahrsQ[0]; });
+  benchmark("ahrsCorrect + ahrsUpdateAngles", [](unsigned long) { ahrsCorrect(); ahrsUpdateAngles(); benchSink = currentAngles.yaw; });
+}
+
+static void reportSampleBusTime() {
+  unsigned long start = micros();
+  for (int i = 0; i < 100; i++) {
+    startGyroRead();
+    startAccelRead();
+    hal::twiService();
+    finishGyroRead();
+    finishAccelRead();
+  }
+  printf("%-40s %7.1f us\n", "bus time/sample (gyro + accel reads)", (micros() - start) / 100.0);
+  start = micros();
+  for (int i = 0; i < 50; i++) benchFifoBurstRead(i);
+  printf("%-40s %7.1f us\n", "bus time/sample (FIFO, 2 per burst)", (micros() - start) / 100.0);
+}
+
+static void benchBlockingGyroRead(unsigned long i) {
+  hal::i2cSetRegister16(MPU_ADDRESS, GYRO_XOUT_H, noise(i, 400));
+  readGyros();
+  benchSink = gyX;
+}
+
+static void benchProcessMotors(unsigned long i) {
+  processMotors(1300 + noise(i, 200), noise(i + 1, 150), noise(i + 2, 150), noise(i + 3, 150));
+  benchSink = motorPulse[0];
+}
+
+// ****************************************************************************************
+//        MIXER
+//    the table mixer against the quad X code it replaced, over a sweep of throttle and PID
+//    outputs (it has to match bit for bit), then host time per mix for each frame and how
+//    often a motor ends up outside THROTTLE_MIN_SPIN to THROTTLE_LIMIT
+// ****************************************************************************************
+
+// calculateMotorInput, capMotorInputNearMaxThrottle and capMotorInputNearMinThrottle as they were
+static void legacyQuadXMix(int throttle, float roll, float pitch, float yaw, int *pulses) {
+  pulses[0] = throttle + (int) roll - (int) pitch + (int) yaw;
+  pulses[1] = throttle - (int) roll - (int) pitch - (int) yaw;
+  pulses[2] = throttle + (int) roll + (int) pitch - (int) yaw;
+  pulses[3] = throttle - (int) roll + (int) pitch + (int) yaw;
+  int adj = max(pulses[0], max(pulses[1], max(pulses[2], pulses[3]))) - THROTTLE_LIMIT;
+  if (adj > 0) {
+    for (int m = 0; m < 4; m++) pulses[m] -= adj;
+  }
+  if (throttle < THROTTLE_MIN_SPIN) {
+    for (int m = 0; m < 4; m++) pulses[m] = ZERO_THROTTLE;
+  }
+  else {
+    adj = THROTTLE_MIN_SPIN - min(pulses[0], min(pulses[1], min(pulses[2], pulses[3])));
+    if (adj > 0) {
+      for (int m = 0; m < 4; m++) pulses[m] += adj;
+    }
+  }
+}
+
+template <uint8_t Motors>
+static void reportMixerRange(const char *name, const mixerRow (&mixer)[Motors], bool airMode) {
+  unsigned long outOfRange = 0, cases = 0;
+  for (unsigned long i = 0; i < 200000; i++) {
+    int throttle = THROTTLE_MIN_SPIN + (int)(i % 600);
+    int roll = noise(i, pidRateMax), pitch = noise(i + 1, pidRateMax), yaw = noise(i + 2, pidRateMax);
+    int pulses[Motors];
+    mixMotors(mixer, airMode, throttle, roll, pitch, yaw, pulses);
+    cases++;
+    for (uint8_t m = 0; m < Motors; m++) {
+      if (pulses[m] < THROTTLE_MIN_SPIN || pulses[m] > THROTTLE_LIMIT) {
+        outOfRange++;
+        break;
+      }
+    }
+  }
+  double ns = benchmark(NULL, [&](unsigned long i) {
+    int pulses[Motors];
+    mixMotors(mixer, airMode, 1300 + noise(i, 200), noise(i + 1, 150), noise(i + 2, 150), noise(i + 3, 150), pulses);
+    benchSink = pulses[0];
+  });
+  printf("%-40s %10.2f %10lu/%lu\n", name, ns, outOfRange, cases);
+}
+
+static void reportMixer() {
+  unsigned long cases = 0, differences = 0;
+  for (int throttle = ZERO_THROTTLE; throttle <= 2000; throttle += 7) {
+    for (unsigned long i = 0; i < 400; i++) {
+      float roll = noise(i * 3 + throttle, 450) + 0.7f;
+      float pitch = noise(i * 3 + throttle + 1, 450) - 0.3f;
+      float yaw = noise(i * 3 + throttle + 2, 450) + 0.9f;
+      int legacy[4], table[4];
+      legacyQuadXMix(throttle, roll, pitch, yaw, legacy);
+      mixMotors(mixerQuadX, false, throttle, (int) roll, (int) pitch, (int) yaw, table);
+      cases++;
+      if (memcmp(legacy, table, sizeof(legacy)) != 0) differences++;
+    }
+  }
+  printf("%-40s %lu cases, %lu differences\n", "table mixer vs the old quad X code", cases, differences);
+  double legacyNs = benchmark(NULL, [](unsigned long i) {
+    int pulses[4];
+    legacyQuadXMix(1300 + noise(i, 200), noise(i + 1, 150), noise(i + 2, 150), noise(i + 3, 150), pulses);
+    benchSink = pulses[0];
+  });
+  printf("%-40s %10s %17s\n", "mixer (PID outputs up to pidRateMax)", "ns/mix", "out of range");
+  printf("%-40s %10.2f\n", "old quad X code", legacyNs);
+  reportMixerRange("quad X", mixerQuadX, false);
+  reportMixerRange("quad X (MIXER_AIRMODE)", mixerQuadX, true);
+  reportMixerRange("quad +", mixerQuadPlus, false);
+  reportMixerRange("quad + (MIXER_AIRMODE)", mixerQuadPlus, true);
+  reportMixerRange("hex X", mixerHexX, false);
+  reportMixerRange("hex X (MIXER_AIRMODE)", mixerHexX, true);
+  reportMixerRange("Y6", mixerY6, false);
+  reportMixerRange("Y6 (MIXER_AIRMODE)", mixerY6, true);
+}
+
+// ****************************************************************************************
+//        ESC OUTPUT
+//    interrupts per second and host time per interrupt for the Timer1 software pulses and for
+//    the hardware PWM backend (ESC_HARDWARE_PWM), the software frame played through a model of
+//    Timer1; AVR cycles per interrupt come from the cycle benchmark (ESC_ISR stage)
+// ****************************************************************************************
+
+// one simulated second of Timer1 compare interrupts, each fires when TCNT1 reaches OCR1A, the
+// counter going back to 0 after ICR1
+// also checks every pulse that comes out against the one asked for, in ticks
+static unsigned long escSoftwareInterruptsPerSecond(int throttle, float roll, float pitch, float yaw,
+                                                    uint16_t *worstError) {
+  setupMotors();
+  processMotors(throttle, roll, pitch, yaw);
+  const int asked[4] = {motorPulse[0], motorPulse[1], motorPulse[2], motorPulse[3]};
+  unsigned long frame = ICR1 + 1UL;
+  unsigned long ticks = 0, interrupts = 0;
+  unsigned long rise[4] = {0, 0, 0, 0};
+  uint8_t last = PORTD;
+  *worstError = 0;
+  while (ticks < 2000000UL) {  // 0.5us ticks
+    uint16_t count = TCNT1;
+    ticks += OCR1A > count ? OCR1A - count : OCR1A + frame - count;
+    TCNT1 = OCR1A;
+    generate_esc_pulses();
+    interrupts++;
+    for (uint8_t motor = 0; motor < 4; motor++) {
+      uint8_t pin = motorPortBit[motor];
+      if ((PORTD & pin) && !(last & pin)) rise[motor] = ticks;
+      if (!(PORTD & pin) && (last & pin) && rise[motor] > 0) {
+        uint16_t error = (uint16_t)abs((long)(ticks - rise[motor]) - pulseToTicks(asked[motor]));
+        if (error > *worstError) *worstError = error;
+      }
+    }
+    last = PORTD;
+  }
+  return interrupts;
+}
+
+// widest gap between the pulse asked for and the one the compare outputs make, over the throttle range
+static float pwmPulseError(bool eightBit) {
+  float worst = 0;
+  for (int pulse = ZERO_THROTTLE; pulse <= 2000; pulse++) {
+    float made = eightBit ? (pulseToPwm8(pulse) + 1) * 8.0f : (pulseToPwm16(pulse) + 1) * 0.5f;
+    worst = max(worst, fabsf(made - pulse));
+  }
+  return worst;
+}
+
+static void reportEscOutput() {
+  uint16_t worstError, hoverError;
+  unsigned long softwareInterrupts = escSoftwareInterruptsPerSecond(1400, 30, -20, 10, &worstError);
+  unsigned long hoverInterrupts = escSoftwareInterruptsPerSecond(1400, 0, 0, 0, &hoverError);
+  double softwareNs = benchmark(NULL, [](unsigned long) { generate_esc_pulses(); benchSink = OCR1A; });
+  double hardwareInterrupts = 16000000.0 / 128 / 256 * 2;  // Timer2 overflow and compare A, motor 4 only
+  double hardwareNs = benchmark(NULL, [](unsigned long i) {
+    if (i & 1) escPwmPulseEnd();
+    else escPwmFrameStart();
+    benchSink = PORTD;
+  });
+  printf("%-40s %6lu/s, %6.2f ns each, %7.1f us/s host\n", "ESC interrupts (Timer1 software)",
+         softwareInterrupts, softwareNs, softwareInterrupts * softwareNs / 1000);
+  printf("%-40s %6lu/s\n", "ESC interrupts (four equal pulses)", hoverInterrupts);
+  printf("%-40s %u ticks, %u with four equal pulses\n", "ESC pulse width error (Timer1 model)", worstError, hoverError);
+  printf("%-40s %6.0f/s, %6.2f ns each, %7.1f us/s host\n", "ESC interrupts (hardware PWM)",
+         hardwareInterrupts, hardwareNs, hardwareInterrupts * hardwareNs / 1000);
+  printf("%-40s motors 1/2 %.1f us, motors 3/4 %.1f us (1000-2000us)\n", "hardware PWM pulse quantisation",
+         pwmPulseError(false), pwmPulseError(true));
+}
+
+// ****************************************************************************************
+//        ONESHOT125 / MULTISHOT EDGE TIMING
+//    the schedule buildSynchronousSchedule makes for random sets of four pulses (some of them
+//    a few ticks apart) walked through a cycle model of startSynchronousPulses and the compare
+//    interrupt, doing what generate_synchronous_pulses does; each pulse is held against the
+//    width asked for
+//    the cycle counts are estimates off the instruction sequence on the ATmega328P, the cycle
+//    benchmark (esc_isr stage) measures the real interrupt
+// ****************************************************************************************
+
+const uint16_t escModelStartCycles = 4;   // the PORTD write to TCNT1 = 0 in startSynchronousPulses
+const uint16_t escModelEntryCycles = 40;  // compare match to the first look at TCNT1: response, vector, prologue
+const uint16_t escModelPollCycles = 8;    // one turn of the wait on TCNT1
+const uint16_t escModelWriteCycles = 6;   // the poll that sees the tick to the PORTD write
+const uint16_t escModelNextCycles = 18;   // a PORTD write to the first poll for the next end
+
+struct escTimingStats {
+  unsigned long pulses;
+  long worst;    // ticks, 62.5ns
+  double total;  // for the mean
+  unsigned long interrupts;
+};
+
+// Timer1 cycles (no prescaler) from TCNT1 = 0, the pins went up escModelStartCycles before it
+static void escModelSchedule(const escSchedule &schedule, const uint16_t *asked, escTimingStats *stats) {
+  uint8_t index = 0;
+  unsigned long now = escCompareFor(schedule.edges[0].tick) + escModelEntryCycles;
+  stats->interrupts++;
+  while (index < schedule.count) {
+    uint16_t due = schedule.edges[index].tick;
+    while (now < due) now += escModelPollCycles;
+    unsigned long write = now + escModelWriteCycles;
+    for (uint8_t motor = 0; motor < 4; motor++) {
+      if (schedule.edges[index].keep & motorPortBit[motor]) continue;
+      long error = (long)(write + escModelStartCycles) - asked[motor];
+      stats->pulses++;
+      stats->total += error;
+      if (labs(error) > labs(stats->worst)) stats->worst = error;
+    }
+    now = write + escModelNextCycles;
+    index++;
+    if (index < schedule.count && (long)schedule.edges[index].tick - (long)now >= (long)ESC_EDGE_MERGE_TICKS) {
+      now = schedule.edges[index].tick - ESC_ISR_LEAD_TICKS + escModelEntryCycles;  // back out, the next compare
+      stats->interrupts++;
+    }
+  }
+}
+
+static void reportSynchronousTiming(const char *name, uint16_t (*toTicks)(int), double ticksPerMicro) {
+  escTimingStats stats = {0, 0, 0, 0};
+  unsigned long sets = 100000;
+  for (unsigned long i = 0; i < sets; i++) {
+    int base = 1000 + (int)((i * 7919) % 1001);
+    uint16_t asked[4];
+    for (uint8_t motor = 0; motor < 4; motor++) {
+      // every other set has the four pulses within a few ticks of each other
+      motorPulse[motor] = constrain(i & 1 ? base + noise(i * 4 + motor, 3) : 1000 + noise(i * 4 + motor, 500) + 500, 1000, 2000);
+      asked[motor] = toTicks(motorPulse[motor]);
+      escTicks[motor] = asked[motor];
+    }
+    resetOrder();
+    sortPulses();
+    escSchedule schedule;
+    buildSynchronousSchedule(schedule);
+    escModelSchedule(schedule, asked, &stats);
+  }
+  printf("%-40s worst %+5.2f us, mean %+5.2f us, %.2f interrupts per set\n", name,
+         stats.worst / ticksPerMicro, stats.total / stats.pulses / ticksPerMicro, (double)stats.interrupts / sets);
+}
+
+static uint16_t oneShot125Ticks(int pulse) { return pulse << 1; }
+
+static void reportSynchronousEscOutput() {
+  printf("%-40s %s\n", "ESC pulse width error (cycle model)", "4 x 100000 pulses against the widths asked for");
+  reportSynchronousTiming("  OneShot125 (125-250us)", oneShot125Ticks, 16);
+  reportSynchronousTiming("  Multishot (5-25us)", pulseToMultishotTicks, 16);
+}
+
+// ****************************************************************************************
+//        DSHOT
+//    every frame the bit banging makes is read back off the recorded PORTD waveform: throttle
+//    values against pulseToDshot, the CRC, and each bit's period and high time against DShot
+//    the host stands in for the asm loop with the same cycle counts, the loop itself is unchecked here
+// ****************************************************************************************
+
+template <uint8_t BitCycles, uint8_t ZeroCycles, uint8_t OneCycles>
+static void reportDshot(const char *name, unsigned long bitsPerSecond) {
+  DshotDecoder decoder(bitsPerSecond);
+  hal::portEdge edges[DSHOT_BITS * 3];
+  const uint8_t otherPins = B10000100;  // pin 2 and 7 high, they have to stay that way
+  unsigned long frames = 0, mismatches = 0, crcErrors = 0, timingErrors = 0, otherPinChanges = 0;
+  double worstPeriod = 0, worstHigh = 0, frameMicros = 0;
+  for (unsigned long i = 0; i < 20000; i++) {
+    int pulses[4];
+    for (uint8_t motor = 0; motor < 4; motor++) {
+      pulses[motor] = i < 1200 ? 900 + (int)((i * 4 + motor) % 1200) : 1500 + noise(i * 4 + motor, 600);
+    }
+    motorPulse[0] = pulses[0];
+    motorPulse[1] = pulses[1];
+    motorPulse[2] = pulses[2];
+    motorPulse[3] = pulses[3];
+    PORTD = otherPins;
+    hal::portTraceStart(edges, DSHOT_BITS * 3);
+    buildDshotFrames();
+    sendDshotFrames<BitCycles, ZeroCycles, OneCycles>();
+    size_t count = hal::portTraced();
+    hal::portTraceStart(NULL, 0);
+    for (size_t e = 0; e < count; e++) {
+      if ((edges[e].value & ~DSHOT_MOTOR_MASK) != otherPins) otherPinChanges++;
+    }
+    for (uint8_t motor = 0; motor < 4; motor++) {
+      DshotFrame frame;
+      frames++;
+      if (!decoder.decode(edges, count, motorPortBit[motor], &frame)) {
+        mismatches++;
+        continue;
+      }
+      if (frame.value != pulseToDshot(pulses[motor]) || frame.telemetry) mismatches++;
+      if (!frame.crcOk) crcErrors++;
+      if (!frame.timingOk) timingErrors++;
+      worstPeriod = max(worstPeriod, frame.worstPeriodError);
+      worstHigh = max(worstHigh, frame.worstHighError);
+      frameMicros = frame.micros;
+    }
+  }
+  printf("%-40s %lu frames, %lu wrong values, %lu CRC errors, %lu timing errors, %lu other pin changes\n",
+         name, frames, mismatches, crcErrors, timingErrors, otherPinChanges);
+  printf("%-40s %.2f us frame, %.2f us with interrupts off, bit period %.2f%% out, high time %.2f%% out at worst\n",
+         "", frameMicros, DSHOT_BITS * BitCycles / 16.0, worstPeriod * 100, worstHigh * 100);
+}
+
+static void benchBuildDshotFrames(unsigned long i) {
+  motorPulse[0] = 1500 + noise(i, 500);
+  motorPulse[1] = 1500 + noise(i + 1, 500);
+  motorPulse[2] = 1500 + noise(i + 2, 500);
+  motorPulse[3] = 1500 + noise(i + 3, 500);
+  buildDshotFrames();
+  benchSink = dshotPortBits[0];
+}
+
+static void reportDshotOutput() {
+  printf("%-40s stop %u, %u at 1001us, %u at 2000us\n", "DShot throttle mapping",
+         pulseToDshot(ZERO_THROTTLE), pulseToDshot(ZERO_THROTTLE + 1), pulseToDshot(2000));
+  reportDshot<DSHOT150_BIT_CYCLES, DSHOT150_ZERO_CYCLES, DSHOT150_ONE_CYCLES>("DShot150 round trip", 150000);
+  reportDshot<DSHOT300_BIT_CYCLES, DSHOT300_ZERO_CYCLES, DSHOT300_ONE_CYCLES>("DShot300 round trip", 300000);
+  benchmark("buildDshotFrames", benchBuildDshotFrames);
+}
+
+// ****************************************************************************************
+//        HANDOFF
+//    a thread stands in for the ISR and takes records from Handoff.h as fast as it can while
+//    loop() publishes them: every record is checked for words from two different publishes
+//    (tearing) and for going back in time; the same check on one plain shared buffer shows
+//    the tearing it is able to catch
+//    both sides yield part way through now and then, so each gets switched out in the middle
+//    of a record, as loop() does when the ISR fires
+//    it is the memory ordering between two CPUs that it is there to catch, so it is skipped
+//    on one
+// ****************************************************************************************
+
+struct handoffRecord {
+  uint32_t sequence;
+  uint32_t words[7];  // derived from the sequence, so a mix of two records shows
+};
+
+static inline uint32_t handoffWord(uint32_t sequence, uint8_t k) {
+  return sequence * 2654435761u + k;
+}
+
+struct handoffStats {
+  unsigned long takes, fresh, torn, backwards;
+};
+
+static bool handoffConsistent(uint32_t sequence, const uint32_t *words) {
+  for (uint8_t k = 0; k < 7; k++) {
+    if (words[k] != handoffWord(sequence, k)) return false;
+  }
+  return true;
+}
+
+static handoffStats handoffStress(unsigned long publishes) {
+  static Handoff<handoffRecord> handoff;
+  volatile bool done = false;
+  handoffStats stats = {0, 0, 0, 0};
+  std::thread isr([&]() {
+    uint32_t last = 0;
+    while (!done) {
+      bool fresh = handoff.fresh();
+      const handoffRecord &record = handoff.take();
+      uint32_t words[7];
+      uint32_t sequence = record.sequence;
+      if ((stats.takes & 3) == 0) std::this_thread::yield();
+      HANDOFF_BARRIER();
+      for (uint8_t k = 0; k < 7; k++) words[k] = record.words[k];
+      HANDOFF_BARRIER();
+      stats.takes++;
+      if (fresh) stats.fresh++;
+      if (!handoffConsistent(sequence, words) || record.sequence != sequence) stats.torn++;
+      if (sequence < last) stats.backwards++;
+      last = sequence;
+    }
+  });
+  for (uint32_t sequence = 1; sequence <= publishes; sequence++) {
+    handoffRecord &record = handoff.startWrite();
+    record.sequence = sequence;
+    HANDOFF_BARRIER();
+    if ((sequence & 3) == 0) std::this_thread::yield();
+    for (uint8_t k = 0; k < 7; k++) record.words[k] = handoffWord(sequence, k);
+    handoff.publish();
+  }
+  done = true;
+  isr.join();
+  return stats;
+}
+
+static handoffStats unprotectedStress(unsigned long publishes) {
+  static volatile handoffRecord shared;
+  volatile bool done = false;
+  handoffStats stats = {0, 0, 0, 0};
+  std::thread isr([&]() {
+    while (!done) {
+      uint32_t words[7];
+      uint32_t sequence = shared.sequence;
+      if ((stats.takes & 3) == 0) std::this_thread::yield();
+      for (uint8_t k = 0; k < 7; k++) words[k] = shared.words[k];
+      stats.takes++;
+      if (!handoffConsistent(sequence, words)) stats.torn++;
+    }
+  });
+  for (uint32_t sequence = 1; sequence <= publishes; sequence++) {
+    shared.sequence = sequence;
+    if ((sequence & 3) == 0) std::this_thread::yield();
+    for (uint8_t k = 0; k < 7; k++) shared.words[k] = handoffWord(sequence, k);
+  }
+  done = true;
+  isr.join();
+  return stats;
+}
+
+static void reportHandoff() {
+  const unsigned long publishes = 1000000;
+  if (std::thread::hardware_concurrency() < 2) {
+    printf("%-40s SKIPPED, one CPU, the threads would only interleave\n", "handoff stress");
+    return;
+  }
+  handoffStats stats = handoffStress(publishes);
+  printf("%-40s %lu publishes, %lu takes (%lu fresh), %lu torn, %lu backwards\n",
+         "handoff stress (triple buffer)", publishes, stats.takes, stats.fresh, stats.torn, stats.backwards);
+  stats = unprotectedStress(publishes);
+  printf("%-40s %lu publishes, %lu reads, %lu torn\n", "handoff stress (one plain buffer)",
+         publishes, stats.takes, stats.torn);
+}
+
+// ****************************************************************************************
+//        RADIO LATENCY
+//    packets arrive at 50Hz at random points of loop() passes of 50-1300us, through the
+//    modelled IRQ pin: the time from each packet to the loop pass that decodes it, against
+//    the old 50ms receiverFreq poll that read the oldest packet in the FIFO and flushed the rest
+// ****************************************************************************************
+
+static void printLatencies(const char *name, std::vector<unsigned long> &latencies) {
+  std::sort(latencies.begin(), latencies.end());
+  size_t n = latencies.size();
+  printf("%-40s %8.2f %8.2f %8.2f %8.2f  (%lu packets)\n", name, latencies[n / 2] / 1000.0,
+         latencies[n * 9 / 10] / 1000.0, latencies[n * 99 / 100] / 1000.0, latencies[n - 1] / 1000.0,
+         (unsigned long)n);
+}
+
+static void reportRadioLatency() {
+  setupRadio();
+  hal::radioAttachIrq(pinRadioIrq, PCINT1_vect);
+  memset(&radioStats, 0, sizeof(radioStats));
+  std::vector<unsigned long> irqLatencies, pollLatencies;
+  const unsigned long packetPeriod = 20000, pollPeriod = 50000;  // receiverFreq before the IRQ
+  unsigned long start = micros();
+  unsigned long nextPacket = start + 7000, nextPoll = start + pollPeriod;
+  unsigned long oldestSincePoll = 0;
+  bool packetSincePoll = false;
+  byte alive = 0;
+  for (unsigned long pass = 0; micros() - start < 20000000UL; pass++) {
+    unsigned long passEnd = micros() + 50 + (unsigned long)(noise(pass, 625) + 625);
+    while ((long)(passEnd - nextPacket) > 0) {  // packets landing during this pass
+      hal::setMicros(nextPacket);
+      dataStruct packet = {128, 128, 128, 128, 0, alive++, 0};
+      packet.checksum = calculateCheckSum(packet);
+      hal::radioQueuePacket(&packet, sizeof(packet));
+      if (!packetSincePoll) oldestSincePoll = nextPacket;
+      packetSincePoll = true;
+      nextPacket += packetPeriod + noise(alive, 500);
+    }
+    hal::setMicros(passEnd);
+    if (checkRadioForInput()) irqLatencies.push_back(radioStats.lastLatency);
+    if ((long)(passEnd - nextPoll) >= 0) {  // where the old task would have polled
+      if (packetSincePoll) pollLatencies.push_back(passEnd - oldestSincePoll);
+      packetSincePoll = false;
+      nextPoll += pollPeriod;
+    }
+  }
+  printf("%-40s %8s %8s %8s %8s\n", "stick latency (ms)", "median", "90%", "99%", "max");
+  printLatencies("radio IRQ, next loop pass", irqLatencies);
+  printLatencies("polled every 50ms (before)", pollLatencies);
+  printf("%-40s %lu decoded, %lu superseded, %lu bad checksums, max %lu us\n", "radio statistics",
+         radioStats.packets, radioStats.superseded, radioStats.badChecksum, radioStats.maxLatency);
+}
+
+// ****************************************************************************************
+//        RADIO LINK
+//    the version 2 protocol over simulated lossy links (host/LinkSimulator.h), an hour each at
+//    50Hz: the receiver's counters against what the channel really did, the failsafe against
+//    the real gaps (false = went off with fewer than failsafeFrames frames missing, missed = a
+//    longer gap went by without it) and where the adaptive data rate settled
+//    a counter more than linkCountTolerance off the truth is flagged
+// ****************************************************************************************
+
+struct linkRun {
+  LinkTruth truth;
+  unsigned long outages, falseFailsafes, missedFailsafes;
+  unsigned long worstDetection;  // ms from the last packet to the failsafe
+  unsigned long ticksAt[3];      // ms spent listening at each data rate step
+  double qualityAfterCut;        // mean link quality 1s after each cut, 0-1
+};
+
+static linkRun runRadioLink(const LinkChannel &channel, unsigned long seconds, unsigned long cutEvery) {
+  setupRadio();
+  hal::radioAttachIrq(pinRadioIrq, PCINT1_vect);
+  memset(&radioLink, 0, sizeof(radioLink));
+  memset(&radioStats, 0, sizeof(radioStats));
+  linkRun run;
+  memset(&run, 0, sizeof(run));
+  LinkTransmitter transmitter(channel);
+  unsigned long start = micros() / 1000 + 1;
+  unsigned long nextFrame = start * 1000;
+  unsigned long lastIntact = start, failsafes = 0;
+  byte missing = 0;
+  bool detected = false;
+  for (unsigned long tick = 0; tick < seconds * 1000; tick++) {
+    unsigned long now = (start + tick) * 1000;
+    while ((long)(now - nextFrame) >= 0) {
+      hal::setMicros(nextFrame);
+      transmitter.cut = cutEvery && tick % (cutEvery * 1000) >= 10000 && tick % (cutEvery * 1000) < 11000;  // a second off each time
+      if (transmitter.sendFrame(128, radio.getDataRate())) {
+        if (missing > failsafeFrames && !detected) run.missedFailsafes++;
+        lastIntact = nextFrame / 1000;
+        missing = 0;
+        detected = false;
+      }
+      else if (++missing == failsafeFrames) {
+        run.outages++;
+      }
+      nextFrame += 20000 + (long)((transmitter.uniform() - 0.5) * 1000);
+    }
+    hal::setMicros(now);
+    checkRadioForInput();
+    if (tick % receiverFreq == 0) {
+      checkHeartbeat();
+      if (radioLink.failsafes != failsafes) {
+        failsafes = radioLink.failsafes;
+        detected = true;
+        if (missing < failsafeFrames) run.falseFailsafes++;
+        unsigned long detection = now / 1000 - lastIntact;
+        if (detection > run.worstDetection) run.worstDetection = detection;
+      }
+    }
+    for (byte step = 0; step < 3; step++) {
+      if (radio.getDataRate() == radioRates[step]) run.ticksAt[step]++;
+    }
+    if (cutEvery && tick % (cutEvery * 1000) == 12000) {
+      run.qualityAfterCut += radioLink.quality / 65535.0 / (seconds / cutEvery);
+    }
+  }
+  run.truth = transmitter.truth;
+  return run;
+}
+
+const double linkCountTolerance = 0.01;  // of the true count, or 2, whichever is more
+
+static bool linkCountOk(unsigned long counted, unsigned long truth) {
+  return fabs((double)counted - truth) <= max(2.0, truth * linkCountTolerance);
+}
+
+static void reportRadioLink(const char *name, const LinkChannel &channel, unsigned long cutEvery = 0) {
+  const unsigned long seconds = 3600;
+  linkRun run = runRadioLink(channel, seconds, cutEvery);
+  bool countsOk = linkCountOk(radioLink.lost, run.truth.lost) && linkCountOk(radioLink.duplicates, run.truth.duplicates)
+                  && linkCountOk(radioLink.reordered, run.truth.reordered)
+                  && linkCountOk(radioStats.badChecksum, run.truth.corrupted);
+  printf("%-40s %5.1f%% %7lu/%-7lu %5lu/%-5lu %5lu/%-5lu %5lu/%-5lu %s\n", name,
+         100.0 * (run.truth.sent - run.truth.lost) / run.truth.sent, radioLink.lost, run.truth.lost,
+         radioLink.duplicates, run.truth.duplicates, radioLink.reordered, run.truth.reordered,
+         radioStats.badChecksum, run.truth.corrupted, countsOk ? "ok" : "COUNTS OFF");
+  printf("%-40s %5lu %5lu %5lu %5lu %5lu ms %5lu %7.1f%% %5.1f%% %5.1f%% %5.0f%%\n", "", run.outages,
+         radioLink.failsafes, run.falseFailsafes, run.missedFailsafes, run.worstDetection,
+         radioLink.rateChanges, 100.0 * run.ticksAt[0] / (seconds * 1000),
+         100.0 * run.ticksAt[1] / (seconds * 1000), 100.0 * run.ticksAt[2] / (seconds * 1000),
+         100.0 * radioLink.quality / 65535);
+  if (cutEvery) printf("%-40s %.0f%% 1s after each cut\n", "", 100.0 * run.qualityAfterCut);
+}
+
+// random 1-3 bit flips of good packets, that either check lets through
+static void reportPacketChecks() {
+  LinkTransmitter random(LinkChannel{});
+  const unsigned long trials = 1000000;
+  unsigned long sumMisses = 0, crcMisses = 0;
+  for (unsigned long i = 0; i < trials; i++) {
+    dataStruct v1 = {(byte)i, (byte)(i >> 8), 127, 127, 4, (byte)(i >> 3), 0};
+    v1.checksum = calculateCheckSum(v1);
+    rcPacketV2 v2 = {RADIO_PROTOCOL_VERSION, (byte)(i >> 3), (byte)i, (byte)(i >> 8), 127, 127, 4, 0, 0};
+    v2.crc = crc8(&v2, sizeof(v2) - 1);
+    byte flips = 1 + (byte)(random.uniform() * 3);
+    dataStruct v1Before = v1;
+    rcPacketV2 v2Before = v2;
+    for (byte f = 0; f < flips; f++) {
+      unsigned bit = (unsigned)(random.uniform() * sizeof(v1) * 8);
+      ((byte *)&v1)[bit / 8] ^= 1 << (bit % 8);
+      bit = (unsigned)(random.uniform() * sizeof(v2) * 8);
+      ((byte *)&v2)[bit / 8] ^= 1 << (bit % 8);
+    }
+    bool v1Changed = memcmp(&v1, &v1Before, sizeof(v1)) != 0;  // not when the same bit flipped twice
+    bool v2Changed = memcmp(&v2, &v2Before, sizeof(v2)) != 0;
+    if (v1Changed && v1.checksum == calculateCheckSum(v1)) sumMisses++;
+    if (v2Changed && v2.crc == crc8(&v2, sizeof(v2) - 1)) crcMisses++;
+  }
+  printf("%-40s %lu of %lu (version 1 sum), %lu of %lu (CRC-8)\n", "corrupted packets let through",
+         sumMisses, trials, crcMisses, trials);
+}
+
+static void reportRadioLinks() {
+  printf("%-40s %6s %15s %11s %11s %11s  (counted/true)\n", "radio link, 1h at 50Hz", "frames", "lost",
+         "duplicates", "reordered", "bad CRC");
+  printf("%-40s %5s %5s %5s %5s %8s %5s %8s %6s %6s %5s\n", "", "gaps", "fs", "false", "missd", "detect",
+         "rate", "250k", "1M", "2M", "LQ");
+  LinkChannel clean = {{0.001, 0.002, 0.005}, 0, 1, 0.99, 0, 0, 0};
+  reportRadioLink("clean, strong signal", clean);
+  LinkChannel noisy = {{0.05, 0.15, 0.3}, 0.005, 0.5, 0.8, 0.001, 0.001, 0.001};
+  reportRadioLink("noisy, fades, dup/reorder/corrupt 0.1%", noisy);
+  LinkChannel weak = {{0.3, 0.7, 0.9}, 0.02, 0.5, 0.1, 0.001, 0.001, 0.001};
+  reportRadioLink("weak, fades", weak);
+  reportRadioLink("noisy, cut for 1s every 30s", noisy, 30);
+  printf("%-40s %lu ms at 20ms frames, %lu ms before (heartbeatTimeout)\n", "failsafe timeout",
+         linkTimeout(radioLink), heartbeatTimeout);
+  reportPacketChecks();
+}
+
+static void benchAtan2Lookup(unsigned long i) {
+  benchSink = atan2Lookup(noise(i, 16000), noise(i + 1, 16000));
+}
+
+static void benchAtan2LookupInterpolated(unsigned long i) {
+  benchSink = atan2LookupWithInterpolation(noise(i, 16000), noise(i + 1, 16000));
+}
+
+static void benchAtan2Cordic(unsigned long i) {
+  benchSink = atan2Cordic(noise(i, 16000), noise(i + 1, 16000));
+}
+
+static void benchAtan2Polynomial(unsigned long i) {
+  benchSink = atan2Polynomial(noise(i, 16000), noise(i + 1, 16000));
+}
+
+static void benchAtan2Float(unsigned long i) {
+  benchSink = atan2f(noise(i, 16000), noise(i + 1, 16000)) * RAD_TO_DEG;
+}
+
+// max / RMS error in degrees against double precision atan2 of the same integers, around circles of
+// the radii the firmware sees: the accel at 1g (4096), the compass (a few hundred) and near full scale
+static void reportAtan2Error(const char *name, float (*fn)(int, int), double nsPerCall) {
+  const int radii[] = {300, 4096, 16000};
+  double maxError = 0, sumSquares = 0;
+  unsigned long samples = 0;
+  for (unsigned r = 0; r < sizeof(radii) / sizeof(radii[0]); r++) {
+    for (int step = 0; step < 36000; step++) {
+      double angle = step * (M_PI / 18000);
+      int y = (int)lround(radii[r] * sin(angle));
+      int x = (int)lround(radii[r] * cos(angle));
+      double error = fabs(fn(y, x) - atan2((double)y, (double)x) * (180 / M_PI));
+      if (error > 180) error = 360 - error;  // +180 and -180 are the same heading
+      if (error > maxError) maxError = error;
+      sumSquares += error * error;
+      samples++;
+    }
+  }
+  if (nsPerCall > 0) printf("%-40s %10.2f", name, nsPerCall);
+  else printf("%-40s %10s", name, "-");  // accuracy only
+  printf(" %12.5f %12.5f\n", maxError, sqrt(sumSquares / samples));
+}
+
+template <long (*Fn)(int, int), long UnitsPerTurn>
+static float atan2AsDegrees(int y, int x) {
+  return Fn(y, x) * (360.0f / UnitsPerTurn);
+}
+
+static float atan2Float(int y, int x) {
+  return atan2f(y, x) * RAD_TO_DEG;
+}
+
+static void reportAtan2Engines() {
+  printf("%-40s %10s %12s %12s\n", "atan2 engine", "ns/call", "max err deg", "rms err deg");
+  reportAtan2Error("lookup 256 (truncated)", atan2Lookup, benchmark(NULL, benchAtan2Lookup));
+  reportAtan2Error("lookup 256 (interpolated)", atan2LookupWithInterpolation,
+                   benchmark(NULL, benchAtan2LookupInterpolated));
+  reportAtan2Error("lookup 64 (interpolated)", atan2AsDegrees<atan2LookupTableInterpolated<64, 65536>, 65536>, 0);
+  reportAtan2Error("lookup 1024 (interpolated)", atan2AsDegrees<atan2LookupTableInterpolated<1024, 65536>, 65536>, 0);
+  reportAtan2Error("lookup 256 1/1024 deg (interpolated)", atan2AsDegrees<atan2LookupTableInterpolated<256, 360L * 1024>, 360L * 1024>, 0);
+  reportAtan2Error("CORDIC (14 iterations)", atan2Cordic, benchmark(NULL, benchAtan2Cordic));
+  reportAtan2Error("CORDIC (10 iterations)", atan2AsDegrees<atan2CordicScaled<65536, 10>, 65536>, 0);
+  reportAtan2Error("polynomial (7th order)", atan2Polynomial, benchmark(NULL, benchAtan2Polynomial));
+  reportAtan2Error("atan2f", atan2Float, benchmark(NULL, benchAtan2Float));
+}
+
+static bool benchTaskDone() {
+  return true;
+}
+
+// scheduler overhead per loop() pass with the five flight tasks registered, 100us between passes
+static byte benchTaskGyro, benchTaskMain;
+
+static void setupBenchTasks() {
+  benchTaskGyro = addTask(benchTaskDone, gyroLoopFreq, gyroLoopFreq, 0);
+  benchTaskMain = addTask(benchTaskDone, mainLoopFreq, mainLoopFreq, 1);
+  addTask(benchTaskDone, receiverFreq * 1000, receiverFreq * 1000, 2);
+  addTask(benchTaskDone, magLoopFreq * 1000, magLoopFreq * 1000, 3);
+  addTask(benchTaskDone, batteryFreq * 1000, batteryFreq * 1000, 4);
+  schedulerStart();
+}
+
+static void benchSchedulerRun(unsigned long i) {
+  (void)i;
+  hal::advanceMicros(100);
+  schedulerRun();
+  benchSink = tasks[0].stats.runs;
+}
+
+static void benchTelemetryLog(unsigned long i) {
+  currentAngles.roll = degreesToBam32(noise(i, 30));
+  motorPulse[0] = 1300 + noise(i, 200);
+  telemetryLog(benchTaskGyro, benchTaskMain);
+  telemetryTail = telemetryHead;  // as if the UART had taken it all
+  benchSink = telemetryBuffer[1];
+}
+
+// simulated time a loop pass loses to debug output, then a capture decoded back to records
+static void reportTelemetry() {
+  Serial.begin(115200);
+  unsigned long start = micros();
+  for (int i = 0; i < 10; i++) printAllAngles();
+  printf("%-40s %7.1f us\n", "printAllAngles (115200 baud, blocking)", (micros() - start) / 10.0);
+
+  static uint8_t capture[1 << 16];
+  hal::serialSetCapture(capture, sizeof(capture));
+  setupTelemetry();
+  telemetryDropped = 0;
+  const int records = 1000;
+  unsigned long waited = 0;
+  for (int i = 0; i < records; i++) {
+    currentAngles.roll = degreesToBam32(noise(i, 30) * 0.1f);
+    ratePid.output[YAW] = noise(i + 1, 100) * 0.5f;
+    telemetryLog(benchTaskGyro, benchTaskMain);
+    for (unsigned long t = 0; t < telemetryPeriod; t += 100) {  // pump on every loop pass
+      unsigned long before = micros();
+      telemetryPump();
+      waited += micros() - before;
+      hal::advanceMicros(100);
+    }
+  }
+  TelemetryDecoder decoder;
+  telemetryRecord record;
+  unsigned long mismatches = 0;
+  size_t captured = hal::serialCaptured();
+  for (size_t i = 0; i < captured; i++) {
+    if (decoder.push(capture[i], &record)) {
+      int n = decoder.frames - 1;
+      float roll = bam32ToDegrees(degreesToBam32(noise(n, 30) * 0.1f));  // as stored in currentAngles
+      if (record.angles[ROLL] != pidValueToFixed(roll)) mismatches++;
+    }
+  }
+  hal::serialSetCapture(NULL, 0);
+  printf("%-40s %lu/%d records, %lu bad frames, %lu mismatches, %u dropped, %.1f bytes/record, %lu us blocked\n",
+         "telemetry round trip (1M baud, 500Hz)", decoder.frames, records, decoder.badFrames, mismatches,
+         telemetryDropped, (double)captured / records, waited);
+}
+
+static void benchBlackboxLog(unsigned long i) {
+  gyX = noise(i, 400);
+  currentAngles.roll = degreesToBam32(noise(i, 300) * 0.1f);
+  motorPulse[0] = 1300 + noise(i, 20);
+  blackboxLog(0);
+  blackboxPending = false;  // as if the flash had taken it
+  benchSink = blackboxFill;
+}
+
+// a simulated flight logged through the flash model at blackboxPeriod, then decoded back
+static void reportBlackbox(const char *imagePath) {
+  hal::reset();
+  hal::flashAttach(pinFlashCs, imagePath, 21);  // 2MB, W25Q16
+  blackboxEnabled = false;
+  blackboxFill = 0;
+  blackboxPending = false;
+  blackboxSinceIntra = BLACKBOX_INTRA_INTERVAL;
+  blackboxRecords = blackboxDropped = 0;
+  setupBlackbox();
+  startBlackboxLog();
+  unsigned long startAddress = blackboxAddress;
+  const int records = 5000;
+  for (int i = 0; i < records; i++) {
+    gyX = (int16_t)(200 * sinf(i * 0.01f)) + noise(i, 3);
+    gyY = noise(i + 1, 5);
+    currentAngles.roll = degreesToBam32(20 * sinf(i * 0.002f));
+    ratePid.output[ROLL] = gyX * 0.1f;
+    motorPulse[0] = 1300 + noise(i, 4);
+    rcPackage.throttle = 120 + (i / 500);
+    unsigned long start = micros();
+    blackboxLog(4 << 4);  // FLYING, RATE mode
+    blackboxFlush();
+    hal::setMicros(start + blackboxPeriod);
+  }
+  unsigned long finishStart = micros();
+  blackboxFinish();  // as on the failsafe disarm
+  unsigned long finishMicros = micros() - finishStart;
+  unsigned long written = blackboxAddress - startAddress;
+
+  BlackboxDecoder decoder;
+  decoder.load(hal::flashImage(), 1UL << 21);
+  BlackboxRecord record;
+  unsigned long decoded = 0, mismatches = 0;
+  while (decoder.next(&record)) {
+    if (record.log != (int)decoder.logs.size() - 1) continue;  // earlier flights in the image file
+    int i = decoded++;
+    if (record.fields[0] != (int16_t)((int16_t)(200 * sinf(i * 0.01f)) + noise(i, 3))) mismatches++;
+  }
+  printf("%-40s %lu/%d records, %lu mismatches, %lu dropped, %.1f bytes/record, %lu logs in image\n",
+         "blackbox round trip (500Hz, flash model)", decoded, records, mismatches, blackboxDropped,
+         (double)written / blackboxRecords, (unsigned long)decoder.logs.size());
+  printf("%-40s %lu us blocked\n", "blackboxFinish (last chunks programmed)", finishMicros);
+  hal::flashDetach();
+}
+
+// ****************************************************************************************
+//        PARAMETER STORE
+//    boot time of the sensor calibration with and without a stored one and of the starting
+//    attitude (simulated micros, mostly the sample spacing), wear of 1000 saves, every possible cut of a save, and a
+//    record from another version
+// ****************************************************************************************
+
+static unsigned long bootMotionSensor() {
+  calibrationChanged = false;
+  loadParams();
+  unsigned long start = micros();
+  setupMotionSensor();
+  while (!sensorCalibrationStep()) hal::advanceMicros(100);  // as armingStep steps it from loop
+  unsigned long elapsed = micros() - start;
+  if (calibrationChanged) saveParams();
+  return elapsed;
+}
+
+static void reportParamStore() {
+  hal::reset();
+  hal::i2cSetRegisters(MPU_ADDRESS, WHO_AM_I, &MPU_ADDRESS, 1);
+  hal::i2cSetRegister16(MPU_ADDRESS, TEMP_OUT_H, -2000);  // about 30C
+  paramSet compiled;
+  gatherParams(&compiled);
+  unsigned long firstBoot = bootMotionSensor();
+  calibratedTemperature = NO_CALIBRATION;  // so only the EEPROM can bring it back
+  unsigned long secondBoot = bootMotionSensor();
+  printf("%-40s first boot %lu ms, stored calibration %lu ms (%s)\n", "sensor calibration",
+         firstBoot / 1000, secondBoot / 1000, calibrationChanged ? "recalibrated" : "reused");
+  unsigned long start = micros();
+  startAngleInitialisation();
+  while (!angleInitialisationStep()) hal::advanceMicros(100);
+  printf("%-40s %lu ms (accel and compass side by side)\n", "starting attitude", (micros() - start) / 1000);
+
+  for (int i = 0; i < 1000; i++) {
+    rateGains[ROLL][KP] = 1.0f + i * 0.001f;
+    saveParams();
+  }
+  unsigned long maxWrites = 0;
+  for (uint16_t address = 0; address <= E2END; address++) {
+    maxWrites = max(maxWrites, hal::eepromWrites(address));
+  }
+  unsigned long slotWrites = hal::eepromWrites(offsetof(paramRecord, sequence));
+  printf("%-40s %d saves over %u slots, worst byte %lu writes (slot 0 sequence %lu)\n", "parameter store wear",
+         1000, PARAM_SLOTS, maxWrites, slotWrites);
+
+  // each cut leaves either the old record or, if every byte made it, the new one
+  unsigned long cuts = 0, failures = 0;
+  for (long cut = 0; cut <= (long)sizeof(paramRecord); cut++) {
+    rateGains[ROLL][KP] = 1.0f;
+    saveParams();
+    rateGains[ROLL][KP] = 2.0f;
+    attitudeGains[YAW][KD] = cut;  // a few more bytes that change
+    hal::eepromCutPowerAfter(cut);
+    saveParams();
+    hal::eepromCutPowerAfter(-1);
+    rateGains[ROLL][KP] = 0;
+    bool complete = loadParams() && rateGains[ROLL][KP] == 2.0f && attitudeGains[YAW][KD] == cut;
+    bool previous = paramsLoaded && rateGains[ROLL][KP] == 1.0f;
+    if (!complete && !previous) failures++;
+    cuts++;
+  }
+  printf("%-40s %lu cut saves, %lu lost both records\n", "parameter store power loss", cuts, failures);
+
+  uint16_t otherVersion = PARAM_STORE_VERSION + 1;
+  for (byte slot = 0; slot < PARAM_SLOTS; slot++) {
+    eeprom_update_block(&otherVersion, paramSlotAddress(slot), sizeof(otherVersion));
+  }
+  scatterParams(&compiled);
+  rateGains[ROLL][KP] = 5.0f;
+  bool loaded = loadParams();
+  printf("%-40s %s\n", "parameter store, other version", loaded ? "LOADED" : "ignored, compiled defaults kept");
+  scatterParams(&compiled);
+}
+
+int main(int argc, char **argv) {
+  const char *blackboxImage = NULL;  // --blackbox <file> keeps the flash image for blackbox_decode
+  if (argc == 3 && strcmp(argv[1], "--blackbox") == 0) blackboxImage = argv[2];
+
+  setupFirmware();
+  setupObjectPids();
+  printf("%-40s %10s\n", "function", "time");
+  benchmark("processGyroData", benchProcessGyroData);
+  benchmark("processAccelData", benchProcessAccelData);
+  benchmark("combineGyroAccelData", benchCombineGyroAccelData);
+  benchmark("combineGyroMagHeadings", benchCombineGyroMagHeadings);
+  reportHeadingWrap();
+  benchmark("pidRateUpdate", benchPidRateUpdate);
+  benchmark("pidRateUpdate (3 PID objects)", benchPidObjectsRateUpdate);
+  benchmark("processMotors", benchProcessMotors);
+  reportMixer();
+  reportEscOutput();
+  reportSynchronousEscOutput();
+  reportDshotOutput();
+  reportHandoff();
+  benchmark("atan2Lookup", benchAtan2Lookup);
+  benchmark("readGyros (blocking I2c)", benchBlockingGyroRead);
+  benchmark("start/finishGyroRead (TWI interrupt)", benchAsyncGyroRead);
+  printf("%-40s %lu completed, %lu errors, %lu timeouts, latency last %u max %u us (simulated bus)\n",
+         "async I2C statistics", i2cStats.completed, i2cStats.errors, i2cStats.timeouts,
+         i2cStats.lastLatency, i2cStats.maxLatency);
+  setupBenchTasks();
+  benchmark("schedulerRun (5 tasks)", benchSchedulerRun);
+  benchmark("telemetryLog", benchTelemetryLog);
+  reportTelemetry();
+  blackboxEnabled = true;  // chunks are thrown away, no flash needed
+  benchmark("blackboxLog", benchBlackboxLog);
+  benchmark("serviceMpuFifo (2 sample burst)", benchFifoBurstRead, 200000);
+  reportSampleBusTime();
+  reportRadioLatency();
+  reportRadioLinks();
+  benchmark("PID::Compute (float)", benchPidFloatCompute);
+  benchmark("PIDFixed::Compute (float boundary)", benchPidFixedCompute);
+  benchmark("PIDFixed::ComputeFixed", benchPidFixedComputeFixed);
+
+  printf("\n%-40s %s\n", "fixed vs float PID output", "difference");
+  reportPidEquivalence("rate PID (P+D)", &rateEquivalencePair, 120, false);
+  reportPidEquivalence("attitude PID (P+I+D)", &attitudeEquivalencePair, 30, true);
+
+  printf("\n");
+  reportAtan2Engines();
+
+  printf("\n%-40s %s\n", "fixed vs float sensor pipeline", "difference");
+  recordSensorTrace();
+  reportSensorEquivalence();
+  reportSensorPipeline();
+  reportGyroBias();
+
+  printf("\n%-40s %s\n", "attitude estimators", "error against the true attitude");
+  recordFlightTrace();
+  reportAttitudeEstimators();
+
+  printf("\n");
+  reportParamStore();
+  reportBlackbox(blackboxImage);
+  return 0;
+}
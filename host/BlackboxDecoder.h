@@ -0,0 +1,166 @@
+// ****************************************************************************************
+// Host side of the blackbox (Quadcopter/Blackbox.h)
+//    walks the chunks of a flash image and turns the frames back into records
+//    include after QuadcopterFirmware.h, which provides the format constants
+// ****************************************************************************************
+
+#ifndef HOST_BLACKBOX_DECODER_H
+#define HOST_BLACKBOX_DECODER_H
+
+#include <stdio.h>
+#include <vector>
+
+// in the order blackboxLog stores them
+static const char *const blackboxFieldNames[BLACKBOX_FIELDS] = {
+  "gyro_x", "gyro_y", "gyro_z",
+  "roll", "pitch", "yaw",
+  "rate_target_roll", "rate_target_pitch", "rate_target_yaw",
+  "rate_actual_roll", "rate_actual_pitch", "rate_actual_yaw",
+  "rate_output_roll", "rate_output_pitch", "rate_output_yaw",
+  "motor1", "motor2", "motor3", "motor4",
+  "rc_throttle", "rc_roll", "rc_pitch", "rc_yaw", "rc_control",
+  "status"
+};
+
+// fields stored as Q11.4 (PID_VALUE_SCALE)
+static inline bool blackboxFieldIsFixed(int field) {
+  return field >= 3 && field < 15;
+}
+
+struct BlackboxRecord {
+  int log;  // position of the log in the image, from 0
+  unsigned long time;
+  int16_t fields[BLACKBOX_FIELDS];
+};
+
+struct BlackboxDecoder {
+  std::vector<std::vector<uint8_t> > logs;  // chunk payloads of each log, concatenated
+  size_t logIndex;
+  size_t position;
+  bool haveReference;
+  BlackboxRecord previous;
+  unsigned long intraFrames, predictedFrames, skippedFrames, truncatedLogs;
+  bool corrupt;
+
+  BlackboxDecoder() : logIndex(0), position(0), haveReference(false), intraFrames(0),
+                      predictedFrames(0), skippedFrames(0), truncatedLogs(0), corrupt(false) {}
+
+  // collects the data of every written chunk, stopping at the first erased one
+  void load(const uint8_t *image, size_t size) {
+    for (size_t chunk = 0; chunk + BLACKBOX_CHUNK_SIZE <= size; chunk += BLACKBOX_CHUNK_SIZE) {
+      uint8_t header = image[chunk];
+      if (header == 0xFF) break;
+      uint8_t length = header & ~BLACKBOX_CHUNK_LOG_START;
+      if (length > BLACKBOX_CHUNK_DATA || (logs.empty() && !(header & BLACKBOX_CHUNK_LOG_START))) {
+        corrupt = true;
+        break;
+      }
+      if (header & BLACKBOX_CHUNK_LOG_START) logs.push_back(std::vector<uint8_t>());
+      logs.back().insert(logs.back().end(), image + chunk + 1, image + chunk + 1 + length);
+    }
+  }
+
+  size_t bytes() const {
+    size_t total = 0;
+    for (size_t i = 0; i < logs.size(); i++) total += logs[i].size();
+    return total;
+  }
+
+  bool readByte(uint8_t *value) {
+    if (position >= logs[logIndex].size()) return false;
+    *value = logs[logIndex][position++];
+    return true;
+  }
+
+  bool readVarint(uint32_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+      uint8_t data;
+      if (!readByte(&data)) return false;
+      *value |= (uint32_t)(data & 0x7F) << shift;
+      if (!(data & 0x80)) return true;
+    }
+    return false;
+  }
+
+  bool readSigned(int32_t *value) {
+    uint32_t zigzag;
+    if (!readVarint(&zigzag)) return false;
+    *value = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+    return true;
+  }
+
+  // one frame of the current log: 1 record, 0 header or skipped frame, -1 end of the log
+  int readFrame(BlackboxRecord *record) {
+    uint8_t type;
+    if (!readByte(&type)) return -1;
+    if (type == BLACKBOX_FRAME_HEADER) {
+      uint8_t version, fields;
+      uint32_t period;
+      if (position != 1 || !readByte(&version) || !readByte(&fields) || !readVarint(&period)
+          || version != BLACKBOX_VERSION || fields != BLACKBOX_FIELDS) {
+        corrupt = true;
+        return -1;
+      }
+      return 0;
+    }
+    if (type != BLACKBOX_FRAME_INTRA && type != BLACKBOX_FRAME_PREDICTED) {
+      corrupt = true;
+      return -1;
+    }
+    bool intra = type == BLACKBOX_FRAME_INTRA;
+    uint32_t time;
+    int32_t values[BLACKBOX_FIELDS];
+    bool complete = readVarint(&time);
+    for (int i = 0; complete && i < BLACKBOX_FIELDS; i++) complete = readSigned(&values[i]);
+    if (!complete) {
+      truncatedLogs++;  // the last chunk went with the power
+      return -1;
+    }
+    if (!intra && !haveReference) {
+      skippedFrames++;
+      return 0;
+    }
+    record->log = (int)logIndex;
+    record->time = intra ? time : previous.time + time;
+    for (int i = 0; i < BLACKBOX_FIELDS; i++) {
+      record->fields[i] = (int16_t)(intra ? values[i] : previous.fields[i] + values[i]);
+    }
+    if (intra) intraFrames++;
+    else predictedFrames++;
+    previous = *record;
+    haveReference = true;
+    return 1;
+  }
+
+  // next record of any log, false once all are read (or at corrupt data)
+  bool next(BlackboxRecord *record) {
+    while (logIndex < logs.size() && !corrupt) {
+      int result = readFrame(record);
+      if (result > 0) return true;
+      if (result < 0) {
+        logIndex++;
+        position = 0;
+        haveReference = false;
+      }
+    }
+    return false;
+  }
+};
+
+inline void blackboxPrintCsvHeader(FILE *out) {
+  fprintf(out, "log,time_us");
+  for (int i = 0; i < BLACKBOX_FIELDS; i++) fprintf(out, ",%s", blackboxFieldNames[i]);
+  fprintf(out, "\n");
+}
+
+inline void blackboxPrintCsv(FILE *out, const BlackboxRecord *record) {
+  fprintf(out, "%d,%lu", record->log, record->time);
+  for (int i = 0; i < BLACKBOX_FIELDS; i++) {
+    if (blackboxFieldIsFixed(i)) fprintf(out, ",%.4f", record->fields[i] * PID_VALUE_TO_FLOAT);
+    else fprintf(out, ",%d", record->fields[i]);
+  }
+  fprintf(out, "\n");
+}
+
+#endif
@@ -0,0 +1,72 @@
+// ****************************************************************************************
+// Host side of the DShot output (Quadcopter/Motors.h)
+//    turns a recorded PORTD waveform (hal::portTraceStart) back into one frame per motor pin,
+//    checking every bit against the DShot timing and every frame against its CRC
+//    include after HalHost.h
+// ****************************************************************************************
+
+#ifndef HOST_DSHOT_DECODER_H
+#define HOST_DSHOT_DECODER_H
+
+#include <math.h>
+
+struct DshotFrame {
+  uint16_t value;   // 11 bit throttle
+  bool telemetry;
+  bool crcOk;
+  bool timingOk;
+  double worstPeriodError;  // fraction of the nominal bit time
+  double worstHighError;    // fraction of the nominal bit time, against 37.5% or 75%
+  double micros;            // first rising edge to the last falling edge
+};
+
+struct DshotDecoder {
+  double bitCycles;          // nominal, 16MHz cycles (106.67 for DShot150, 53.33 for DShot300)
+  double periodTolerance;    // fraction of the bit time
+  double highTolerance;      // fraction of the bit time
+
+  explicit DshotDecoder(unsigned long bitsPerSecond)
+    : bitCycles(16e6 / bitsPerSecond), periodTolerance(0.02), highTolerance(0.05) {}
+
+  // false when the pin did not make exactly 16 pulses
+  bool decode(const hal::portEdge *edges, size_t count, uint8_t pinMask, DshotFrame *frame) const {
+    unsigned long long rising[16], falling[16];
+    uint8_t pulses = 0;
+    bool level = false;
+    for (size_t i = 0; i < count; i++) {
+      bool pin = edges[i].value & pinMask;
+      if (pin == level) continue;
+      level = pin;
+      if (pin) {
+        if (pulses == 16) return false;
+        rising[pulses] = edges[i].cycle;
+      } else {
+        falling[pulses++] = edges[i].cycle;
+      }
+    }
+    if (pulses != 16 || level) return false;
+
+    uint16_t packet = 0;
+    frame->worstPeriodError = 0;
+    frame->worstHighError = 0;
+    for (uint8_t bit = 0; bit < 16; bit++) {
+      double high = (double)(falling[bit] - rising[bit]) / bitCycles;
+      bool one = high > 0.5625;  // halfway between 37.5% and 75%
+      packet = packet << 1 | one;
+      frame->worstHighError = fmax(frame->worstHighError, fabs(high - (one ? 0.75 : 0.375)));
+      if (bit < 15) {
+        double period = (double)(rising[bit + 1] - rising[bit]) / bitCycles;
+        frame->worstPeriodError = fmax(frame->worstPeriodError, fabs(period - 1));
+      }
+    }
+    uint16_t data = packet >> 4;
+    frame->value = packet >> 5;
+    frame->telemetry = data & 1;
+    frame->crcOk = ((data ^ (data >> 4) ^ (data >> 8)) & 0x0F) == (packet & 0x0F);
+    frame->timingOk = frame->worstPeriodError <= periodTolerance && frame->worstHighError <= highTolerance;
+    frame->micros = (falling[15] - rising[0]) / 16.0;
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,121 @@
+// ****************************************************************************************
+// Host side of the radio link protocol (Quadcopter/RadioLink.h)
+//    a version 2 transmitter that does what the receiver asks in its acks, sending over a
+//    lossy channel: fades that lose whole frames, per attempt losses that get worse with the
+//    data rate, duplicated, reordered and corrupted packets, and outright cuts
+//    packets go into the host RF24 FIFO (hal::radioQueuePacket) and the transmitter reads
+//    the ack payload the firmware has loaded, as the nRF24 would send it back
+//    include after HalHost.h and the firmware headers
+// ****************************************************************************************
+
+#ifndef HOST_LINK_SIMULATOR_H
+#define HOST_LINK_SIMULATOR_H
+
+struct LinkChannel {
+  double attemptLoss[3];  // chance of each attempt going missing, per data rate step
+  double fadeStart;       // chance per frame of a fade that loses every attempt
+  double fadeEnd;         // chance per frame of the fade ending
+  double strongSignal;    // chance of the RPD bit being set
+  double duplicate;       // chances per packet that gets through
+  double reorder;
+  double corrupt;         // 1-3 bits flipped that the nRF24's own CRC let through
+};
+
+// what really happened, to hold the receiver's counters against
+struct LinkTruth {
+  unsigned long sent;
+  unsigned long lost;  // never reached the receiver intact, corrupted ones included
+  unsigned long duplicates;
+  unsigned long reordered;
+  unsigned long corrupted;
+};
+
+struct LinkTransmitter {
+  LinkChannel channel;
+  LinkTruth truth;
+  uint32_t state;
+  byte sequence;
+  byte step;        // data rate step it sends at
+  byte wanted;      // step announced in the next packet, from the last ack
+  byte retries;     // from the last ack
+  byte failedFrames;
+  bool fading;
+  bool cut;         // nothing gets through
+  bool holding;     // a packet held back to come in after the next one
+  rcPacketV2 held;
+
+  explicit LinkTransmitter(const LinkChannel &linkChannel)
+    : channel(linkChannel), truth(), state(0x2545F491), sequence(200), step(0), wanted(0), retries(15),
+      failedFrames(0), fading(false), cut(false), holding(false), held() {}
+
+  double uniform() {  // xorshift32
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state / 4294967296.0;
+  }
+
+  // one frame at the current micros(), true when its packet reached the receiver intact and on time
+  bool sendFrame(byte throttle, rf24_datarate_e receiverRate) {
+    rcPacketV2 packet = {RADIO_PROTOCOL_VERSION, sequence++, throttle, 127, 127, 127, 0b00000100, wanted, 0};
+    packet.crc = crc8(&packet, sizeof(packet) - 1);
+    truth.sent++;
+    fading = fading ? uniform() >= channel.fadeEnd : uniform() < channel.fadeStart;
+    bool acked = false;
+    if (!cut && !fading && radioRates[step] == receiverRate) {
+      for (byte attempt = 0; attempt <= retries && !acked; attempt++) {
+        acked = uniform() >= channel.attemptLoss[step];
+      }
+    }
+    if (!acked) {
+      truth.lost++;
+      if (++failedFrames >= linkFallbackFrames) {  // the same rule as the receiver's
+        step = 0;
+        wanted = 0;
+      }
+      return false;
+    }
+    failedFrames = 0;
+    // the ack carries what the firmware loaded after the previous packet
+    ackPacketV2 ack;
+    if (hal::radioLastAck(&ack, sizeof(ack)) == sizeof(ack)) {
+      wanted = ack.request & 0b11;
+      retries = ack.request >> 4;
+    }
+    step = packet.link;  // announced and acked, so it holds from the next packet on
+    hal::radioSetSignal(uniform() < channel.strongSignal);
+
+    bool intact = true;
+    if (uniform() < channel.corrupt) {
+      rcPacketV2 sent = packet;
+      byte flips = 1 + (byte)(uniform() * 3);
+      for (byte i = 0; i < flips; i++) {
+        unsigned bit = (unsigned)(uniform() * sizeof(packet) * 8);
+        ((byte *)&packet)[bit / 8] ^= 1 << (bit % 8);
+      }
+      intact = memcmp(&packet, &sent, sizeof(packet)) == 0;  // the same bit twice
+      if (!intact) {
+        truth.corrupted++;
+        truth.lost++;
+      }
+    }
+    if (intact && !holding && uniform() < channel.reorder) {
+      held = packet;
+      holding = true;
+      truth.reordered++;
+      return false;
+    }
+    hal::radioQueuePacket(&packet, sizeof(packet));
+    if (intact && uniform() < channel.duplicate) {
+      hal::radioQueuePacket(&packet, sizeof(packet));
+      truth.duplicates++;
+    }
+    if (holding) {
+      hal::radioQueuePacket(&held, sizeof(held));
+      holding = false;
+    }
+    return intact;
+  }
+};
+
+#endif
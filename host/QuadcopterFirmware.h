@@ -0,0 +1,38 @@
+// ****************************************************************************************
+// Pulls the firmware headers into a host translation unit in the same order as Quadcopter.ino
+//    the headers define globals, so include this from exactly one .cpp per executable
+// ****************************************************************************************
+
+#ifndef HOST_QUADCOPTER_FIRMWARE_H
+#define HOST_QUADCOPTER_FIRMWARE_H
+
+#include <Arduino.h>
+#include <I2C.h>
+#include <SPI.h>
+#include <RF24.h>
+
+#include "Parameters.h"
+#include "CycleMarkers.h"
+#include "Scheduler.h"
+#include "Handoff.h"
+#include "BinaryAngle.h"
+#include "MathsHelper.h"
+#include "PID.h"
+#include "PIDFixed.h"
+#include "PidBank.h"
+#include "BatteryMonitor.h"
+#include "I2cAsync.h"
+#include "I2cFunctions.h"
+#include "MotionSensor.h"
+#include "Ahrs.h"
+#include "RadioLink.h"
+#include "Receiver.h"
+#include "Motors.h"
+#include "PIDSettings.h"
+#include "Telemetry.h"
+#include "ParamStore.h"
+#include "SpiFlash.h"
+#include "Blackbox.h"
+#include "DebugPrints.h"
+
+#endif
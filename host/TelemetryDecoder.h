@@ -0,0 +1,82 @@
+// ****************************************************************************************
+// Host side of the telemetry stream (Quadcopter/Telemetry.h)
+//    splits a byte stream on the 0x00 delimiters, undoes the COBS encoding and checks the CRC
+//    include after QuadcopterFirmware.h, which provides the record layout and crc16Update
+// ****************************************************************************************
+
+#ifndef HOST_TELEMETRY_DECODER_H
+#define HOST_TELEMETRY_DECODER_H
+
+#include <stdio.h>
+#include <string.h>
+
+const size_t TELEMETRY_MAX_FRAME = 256;
+
+struct TelemetryDecoder {
+  uint8_t frame[TELEMETRY_MAX_FRAME];
+  size_t length;
+  unsigned long frames;
+  unsigned long badFrames;  // COBS, length or CRC errors, an unknown type, or text printed before the stream
+
+  TelemetryDecoder() : length(0), frames(0), badFrames(0) {}
+
+  // returns true when data completes a valid flight record
+  bool push(uint8_t data, telemetryRecord *record) {
+    if (data != 0) {
+      if (length < TELEMETRY_MAX_FRAME) frame[length] = data;
+      length++;
+      return false;
+    }
+    size_t frameLength = length;
+    length = 0;
+    if (frameLength == 0) return false;
+    uint8_t decoded[TELEMETRY_MAX_FRAME];
+    size_t n = decode(frameLength, decoded);
+    if (n != 1 + sizeof(telemetryRecord) + 2 || decoded[0] != TELEMETRY_RECORD_FLIGHT) {
+      badFrames++;
+      return false;
+    }
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < n - 2; i++) crc = crc16Update(crc, decoded[i]);
+    if (crc != (uint16_t)(decoded[n - 2] << 8 | decoded[n - 1])) {
+      badFrames++;
+      return false;
+    }
+    memcpy(record, decoded + 1, sizeof(telemetryRecord));
+    frames++;
+    return true;
+  }
+
+  // COBS decode of frame[0..frameLength), 0 if malformed
+  size_t decode(size_t frameLength, uint8_t *out) {
+    if (frameLength > TELEMETRY_MAX_FRAME) return 0;
+    size_t in = 0, n = 0;
+    while (in < frameLength) {
+      uint8_t code = frame[in++];
+      if (code == 0 || in + code - 1 > frameLength) return 0;
+      for (uint8_t i = 1; i < code; i++) out[n++] = frame[in++];
+      if (code != 0xFF && in < frameLength) out[n++] = 0;
+    }
+    return n;
+  }
+};
+
+inline void telemetryPrintCsvHeader(FILE *out) {
+  fprintf(out, "time_us,roll,pitch,yaw,"
+               "rate_target_roll,rate_target_pitch,rate_target_yaw,"
+               "rate_actual_roll,rate_actual_pitch,rate_actual_yaw,"
+               "rate_output_roll,rate_output_pitch,rate_output_yaw,"
+               "motor1,motor2,motor3,motor4,gyro_exec_us,main_exec_us,overruns,dropped\n");
+}
+
+inline void telemetryPrintCsv(FILE *out, const telemetryRecord *r) {
+  fprintf(out, "%lu", (unsigned long)r->time);
+  for (int i = 0; i < 3; i++) fprintf(out, ",%.4f", r->angles[i] * PID_VALUE_TO_FLOAT);
+  for (int i = 0; i < 3; i++) fprintf(out, ",%.4f", r->rateTarget[i] * PID_VALUE_TO_FLOAT);
+  for (int i = 0; i < 3; i++) fprintf(out, ",%.4f", r->rateActual[i] * PID_VALUE_TO_FLOAT);
+  for (int i = 0; i < 3; i++) fprintf(out, ",%.4f", r->rateOutput[i] * PID_VALUE_TO_FLOAT);
+  for (int i = 0; i < 4; i++) fprintf(out, ",%u", r->motorPulse[i]);
+  fprintf(out, ",%u,%u,%u,%u\n", r->gyroExec, r->mainExec, r->overruns, r->dropped);
+}
+
+#endif
@@ -0,0 +1,154 @@
+// ****************************************************************************************
+// Host (Linux) stand-in for the parts of the Arduino core used by the firmware
+//    time, GPIO, ADC, AVR timer/port registers and Serial
+//    the simulated state behind these is driven from HalHost.h
+// ****************************************************************************************
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include "binary.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+using std::min;
+using std::max;
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+
+#define PI 3.1415926535897932384626433832795
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+#define RAD_TO_DEG 57.295779513082320876798154814105
+
+#define F(string_literal) (string_literal)
+#define _BV(bitNo) (1 << (bitNo))
+#define bit(b) (1UL << (b))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// TIME
+unsigned long micros();
+unsigned long millis();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// GPIO & ADC
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+long map(long x, long in_min, long in_max, long out_min, long out_max);
+
+// INTERRUPTS
+void cli();
+void sei();
+#define ISR(vector) extern "C" void vector()
+#define digitalPinToInterrupt(p) ((p) == 2 ? 0 : ((p) == 3 ? 1 : -1))
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(), int mode);
+void detachInterrupt(uint8_t interruptNum);
+
+// stands in for cycle counted inline asm (the DShot bit banging in Motors.h): each bit drives
+// PORTD to high, then portValues[i] zeroCycles later, then low oneCycles later, every bitCycles
+void portDWaveform(const uint8_t *portValues, uint8_t bits, uint8_t high, uint8_t low,
+                   uint8_t bitCycles, uint8_t zeroCycles, uint8_t oneCycles);
+
+// AVR REGISTERS (ATmega328P names, plain memory on the host)
+extern volatile uint8_t PORTB, DDRB, PINB;
+extern volatile uint8_t PORTD, DDRD, PIND;
+extern volatile uint8_t PINC, PCICR, PCIFR, PCMSK1;
+extern volatile uint8_t SREG;
+extern volatile uint8_t TCCR1A, TCCR1B, TIFR1, TIMSK1;
+extern volatile uint16_t TCNT1, OCR1A, OCR1B, ICR1;
+extern volatile uint8_t TCCR2A, TCCR2B, TIFR2, TIMSK2, TCNT2, OCR2A, OCR2B;
+extern volatile uint8_t ADCSRA;
+extern volatile uint8_t TWBR, TWSR, TWCR, TWDR;
+
+// bit positions
+#define PCIE1 1
+#define PCIF1 1
+#define PCINT9 1
+#define PINC1 1
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM10 0
+#define WGM11 1
+#define WGM12 3
+#define WGM13 4
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM20 0
+#define WGM21 1
+#define WGM22 3
+#define COM2B0 4
+#define COM2B1 5
+#define COM2A0 6
+#define COM2A1 7
+#define TOV2 0
+#define OCF2A 1
+#define OCF2B 2
+#define TOIE2 0
+#define OCIE2A 1
+#define OCIE2B 2
+#define COM1B0 4
+#define COM1B1 5
+#define COM1A0 6
+#define COM1A1 7
+#define OCF1A 1
+#define OCF1B 2
+#define OCIE1A 1
+#define OCIE1B 2
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define TWINT 7
+#define TWEA 6
+#define TWSTA 5
+#define TWSTO 4
+#define TWWC 3
+#define TWEN 2
+#define TWIE 0
+
+// SERIAL
+class HardwareSerial {
+  public:
+    void begin(unsigned long baud);
+    size_t write(uint8_t c);  // waits (advances the clock) while the TX buffer is full, like the real one
+    int availableForWrite();
+    size_t print(const char *s);
+    size_t print(char c);
+    size_t print(int n);
+    size_t print(unsigned int n);
+    size_t print(long n);
+    size_t print(unsigned long n);
+    size_t print(double n, int digits = 2);
+    size_t println();
+    template <typename T> size_t println(T value) {
+      size_t n = print(value);
+      return n + println();
+    }
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,832 @@
+// ****************************************************************************************
+// Host implementation of the hardware abstraction layer
+// ****************************************************************************************
+
+#include "HalHost.h"
+#include "I2C.h"
+#include "SPI.h"
+#include "RF24.h"
+#include "avr/eeprom.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ****************************************************************************************
+//        SIMULATED STATE
+// ****************************************************************************************
+
+namespace {
+
+const uint8_t NUM_I2C_DEVICES = 128;
+const uint8_t I2C_BUFFER_SIZE = 32;
+const uint8_t RADIO_QUEUE_SIZE = 8;
+const uint8_t RADIO_PAYLOAD_SIZE = 32;
+const uint8_t NUM_PINS = 20;
+const uint8_t NUM_EXTERNAL_INTERRUPTS = 2;
+const uint16_t I2C_FIFO_SIZE = 1024;
+
+unsigned long nowMicros = 0;
+
+uint8_t i2cRegisters[NUM_I2C_DEVICES][256];
+uint8_t i2cBuffer[I2C_BUFFER_SIZE];
+uint8_t i2cBufferLength = 0;
+uint8_t i2cBufferIndex = 0;
+bool i2cFailing = false;
+unsigned long i2cTransactions = 0;
+
+bool i2cFifoAttached = false;
+uint8_t i2cFifoDevice = 0;
+uint8_t i2cFifoDataRegister = 0;
+uint8_t i2cFifoCountRegister = 0;
+uint8_t i2cFifo[I2C_FIFO_SIZE];
+uint16_t i2cFifoHead = 0;
+uint16_t i2cFifoLength = 0;
+
+uint8_t radioQueue[RADIO_QUEUE_SIZE][RADIO_PAYLOAD_SIZE];
+uint8_t radioQueueLength[RADIO_QUEUE_SIZE];
+uint8_t radioHead = 0;
+uint8_t radioCount = 0;
+uint8_t radioAck[RADIO_PAYLOAD_SIZE];
+uint8_t radioAckLength = 0;
+rf24_datarate_e radioDataRate = RF24_1MBPS;
+bool radioRxReady = false;  // RX_DR, the IRQ pin is low while it is set (and not masked)
+bool radioRxMasked = false;
+bool radioStrongSignal = true;
+uint8_t radioIrqPin = 0xFF;
+void (*radioIrqIsr)() = NULL;
+
+int adcValues[NUM_PINS];
+uint8_t pinValues[NUM_PINS];
+
+void radioSetRxReady(bool ready) {
+  bool wasLow = radioRxReady && !radioRxMasked;
+  radioRxReady = ready;
+  bool low = radioRxReady && !radioRxMasked;
+  if (low == wasLow || radioIrqPin >= NUM_PINS) return;
+  pinValues[radioIrqPin] = low ? LOW : HIGH;
+  if (radioIrqPin >= 14) {
+    if (low) PINC &= ~(1 << (radioIrqPin - 14));
+    else PINC |= 1 << (radioIrqPin - 14);
+  }
+  if (radioIrqIsr) radioIrqIsr();
+}
+void (*externalInterrupts[NUM_EXTERNAL_INTERRUPTS])() = {NULL, NULL};
+
+const unsigned long TWI_BYTE_MICROS = 23;  // 9 bit times at 400kHz
+
+enum TwiBusState {TWI_BUS_IDLE, TWI_BUS_STARTED, TWI_BUS_TRANSMIT, TWI_BUS_RECEIVE};
+TwiBusState twiBusState = TWI_BUS_IDLE;
+uint8_t twiDevice = 0;
+uint8_t twiPointer = 0;
+bool twiPointerSet = false;
+void (*twiIsr)() = NULL;
+
+const unsigned long FLASH_PAGE_PROGRAM_MICROS = 700;
+const unsigned long FLASH_CHIP_ERASE_MICROS = 5000000;
+const unsigned long FLASH_PAGE_SIZE = 256;
+
+uint8_t *flashMemory = NULL;
+unsigned long flashSize = 0;
+uint8_t flashSizeLog2 = 0;
+uint8_t flashCsPin = 0xFF;
+char flashPath[256];
+bool flashSelected = false;
+bool flashWriteEnabled = false;
+unsigned long flashBusyUntil = 0;
+uint8_t flashCommand = 0;
+unsigned long flashByteCount = 0;  // bytes since chip select went low
+unsigned long flashAddress = 0;
+
+const uint16_t EEPROM_SIZE = E2END + 1;
+const unsigned long EEPROM_WRITE_MICROS = 3400;  // erase and write, per byte
+
+uint8_t eepromMemory[EEPROM_SIZE];
+unsigned long eepromWriteCount[EEPROM_SIZE];
+char eepromPath[256];
+long eepromWritesLeft = -1;
+
+bool flashBusy() {
+  return (long)(flashBusyUntil - nowMicros) > 0;
+}
+
+void flashSelect() {
+  flashSelected = true;
+  flashByteCount = 0;
+}
+
+void flashDeselect() {
+  flashSelected = false;
+  if (flashByteCount == 0 || flashBusy()) return;
+  if (flashCommand == 0x06) {
+    flashWriteEnabled = true;
+  }
+  else if (flashCommand == 0x02 && flashWriteEnabled && flashByteCount > 4) {
+    flashBusyUntil = nowMicros + FLASH_PAGE_PROGRAM_MICROS;
+    flashWriteEnabled = false;
+  }
+  else if (flashCommand == 0xC7 && flashWriteEnabled) {
+    memset(flashMemory, 0xFF, flashSize);
+    flashBusyUntil = nowMicros + FLASH_CHIP_ERASE_MICROS;
+    flashWriteEnabled = false;
+  }
+}
+
+uint8_t flashTransfer(uint8_t data) {
+  unsigned long n = flashByteCount++;
+  if (n == 0) {
+    flashCommand = data;
+    return 0xFF;
+  }
+  switch (flashCommand) {
+    case 0x9F:  // JEDEC id, Winbond W25Q
+      return n == 1 ? 0xEF : (n == 2 ? 0x40 : (n == 3 ? flashSizeLog2 : 0xFF));
+    case 0x05:
+      return (flashBusy() ? 0x01 : 0) | (flashWriteEnabled ? 0x02 : 0);
+    case 0x03:
+    case 0x02:
+      if (n <= 3) {
+        flashAddress = (flashAddress << 8 | data) & (flashSize - 1);
+        return 0xFF;
+      }
+      if (flashCommand == 0x03) {
+        uint8_t value = flashMemory[flashAddress];
+        flashAddress = (flashAddress + 1) & (flashSize - 1);
+        return value;
+      }
+      if (flashWriteEnabled && !flashBusy()) {
+        flashMemory[flashAddress] &= data;  // programming only clears bits
+        // wraps within the page like the real part
+        flashAddress = (flashAddress & ~(FLASH_PAGE_SIZE - 1)) | ((flashAddress + 1) & (FLASH_PAGE_SIZE - 1));
+      }
+      return 0xFF;
+    default:
+      return 0xFF;
+  }
+}
+
+hal::portEdge *portTrace = NULL;
+size_t portTraceSize = 0;
+size_t portTraceLength = 0;
+
+void portTraceWrite(unsigned long long cycle, uint8_t value) {
+  PORTD = value;
+  if (portTrace && portTraceLength < portTraceSize) {
+    portTrace[portTraceLength].cycle = cycle;
+    portTrace[portTraceLength].value = value;
+    portTraceLength++;
+  }
+}
+
+bool serialEcho = false;
+unsigned long serialBytes = 0;
+uint8_t *serialCapture = NULL;
+size_t serialCaptureSize = 0;
+size_t serialCaptureLength = 0;
+
+// the UART TX buffer of the Arduino core, drained at the baud rate in simulated time
+const int SERIAL_TX_BUFFER_SIZE = 64;
+double serialByteMicros = 10e6 / 115200;
+double serialTxBusyUntil = 0;  // when the last queued byte has left the shift register
+
+int serialTxQueued() {
+  double pending = serialTxBusyUntil - (double)nowMicros;
+  return pending > 0 ? (int)ceil(pending / serialByteMicros) : 0;
+}
+
+void i2cFifoUpdateCount() {
+  i2cRegisters[i2cFifoDevice][i2cFifoCountRegister] = i2cFifoLength >> 8;
+  i2cRegisters[i2cFifoDevice][(uint8_t)(i2cFifoCountRegister + 1)] = i2cFifoLength & 0xFF;
+}
+
+// one register read, popping the FIFO when it is the FIFO data register
+// the register pointer only moves on for ordinary registers
+uint8_t i2cReadRegister(uint8_t device, uint8_t *pointer) {
+  if (i2cFifoAttached && device == i2cFifoDevice && *pointer == i2cFifoDataRegister) {
+    if (i2cFifoLength == 0) return 0;
+    uint8_t value = i2cFifo[i2cFifoHead];
+    i2cFifoHead = (i2cFifoHead + 1) % I2C_FIFO_SIZE;
+    i2cFifoLength--;
+    i2cFifoUpdateCount();
+    return value;
+  }
+  return i2cRegisters[device][(*pointer)++];
+}
+
+}
+
+// ****************************************************************************************
+//        CONTROL INTERFACE
+// ****************************************************************************************
+
+namespace hal {
+
+void setMicros(unsigned long now) {
+  nowMicros = now;
+}
+
+void advanceMicros(unsigned long us) {
+  nowMicros += us;
+}
+
+void i2cSetRegisters(uint8_t address, uint8_t firstRegister, const uint8_t *data, uint8_t length) {
+  for (uint8_t i = 0; i < length; i++) {
+    i2cRegisters[address & 0x7F][(uint8_t)(firstRegister + i)] = data[i];
+  }
+}
+
+void i2cSetRegister16(uint8_t address, uint8_t firstRegister, int16_t value) {
+  uint8_t data[2] = {(uint8_t)((uint16_t)value >> 8), (uint8_t)value};
+  i2cSetRegisters(address, firstRegister, data, 2);
+}
+
+uint8_t i2cGetRegister(uint8_t address, uint8_t registerAddress) {
+  return i2cRegisters[address & 0x7F][registerAddress];
+}
+
+void i2cSetFailing(bool failing) {
+  i2cFailing = failing;
+}
+
+unsigned long i2cTransactionCount() {
+  return i2cTransactions;
+}
+
+void i2cAttachFifo(uint8_t address, uint8_t dataRegister, uint8_t countRegisterH) {
+  i2cFifoAttached = true;
+  i2cFifoDevice = address & 0x7F;
+  i2cFifoDataRegister = dataRegister;
+  i2cFifoCountRegister = countRegisterH;
+  i2cFifoHead = 0;
+  i2cFifoLength = 0;
+  i2cFifoUpdateCount();
+}
+
+void i2cFifoPush(const uint8_t *data, uint16_t length) {
+  for (uint16_t i = 0; i < length && i2cFifoLength < I2C_FIFO_SIZE; i++) {
+    i2cFifo[(i2cFifoHead + i2cFifoLength) % I2C_FIFO_SIZE] = data[i];
+    i2cFifoLength++;
+  }
+  i2cFifoUpdateCount();
+}
+
+uint16_t i2cFifoCount() {
+  return i2cFifoLength;
+}
+
+void radioQueuePacket(const void *data, uint8_t length) {
+  if (radioCount == RADIO_QUEUE_SIZE) return;  // the nRF24 FIFO is full, packet lost
+  if (length > RADIO_PAYLOAD_SIZE) length = RADIO_PAYLOAD_SIZE;
+  uint8_t slot = (radioHead + radioCount) % RADIO_QUEUE_SIZE;
+  memcpy(radioQueue[slot], data, length);
+  radioQueueLength[slot] = length;
+  radioCount++;
+  radioSetRxReady(true);
+}
+
+uint8_t radioPendingPackets() {
+  return radioCount;
+}
+
+uint8_t radioLastAck(void *buf, uint8_t length) {
+  if (length > radioAckLength) length = radioAckLength;
+  memcpy(buf, radioAck, length);
+  return length;
+}
+
+void radioSetSignal(bool strong) {
+  radioStrongSignal = strong;
+}
+
+void radioAttachIrq(uint8_t pin, void (*isr)()) {
+  radioIrqPin = pin;
+  radioIrqIsr = isr;
+  if (pin < NUM_PINS) pinValues[pin] = HIGH;
+  if (pin >= 14 && pin < NUM_PINS) PINC |= 1 << (pin - 14);
+}
+
+void twiAttachInterrupt(void (*isr)()) {
+  twiIsr = isr;
+}
+
+void twiService() {
+  while ((TWCR & _BV(TWINT)) && (TWCR & _BV(TWEN))) {
+    uint8_t control = TWCR;
+    TWCR = control & ~_BV(TWINT);
+    if (control & _BV(TWSTO)) {
+      twiBusState = TWI_BUS_IDLE;
+      TWCR &= ~_BV(TWSTO);
+      if (!(control & _BV(TWSTA))) break;  // a plain stop does not raise the interrupt
+    }
+    if (control & _BV(TWSTA)) {
+      TWSR = (twiBusState == TWI_BUS_IDLE) ? 0x08 : 0x10;  // START or repeated START
+      twiBusState = TWI_BUS_STARTED;
+      TWCR &= ~_BV(TWSTA);
+    }
+    else if (twiBusState == TWI_BUS_STARTED) {
+      bool read = TWDR & 1;
+      twiDevice = (TWDR >> 1) & 0x7F;
+      i2cTransactions++;
+      if (i2cFailing) {
+        TWSR = read ? 0x48 : 0x20;  // SLA NACK
+      }
+      else if (read) {
+        TWSR = 0x40;
+        twiBusState = TWI_BUS_RECEIVE;
+      }
+      else {
+        TWSR = 0x18;
+        twiBusState = TWI_BUS_TRANSMIT;
+        twiPointerSet = false;
+      }
+      nowMicros += TWI_BYTE_MICROS;
+    }
+    else if (twiBusState == TWI_BUS_TRANSMIT) {
+      if (!twiPointerSet) {
+        twiPointer = TWDR;  // first byte written selects the register
+        twiPointerSet = true;
+      }
+      else {
+        i2cRegisters[twiDevice][twiPointer++] = TWDR;
+      }
+      TWSR = 0x28;
+      nowMicros += TWI_BYTE_MICROS;
+    }
+    else if (twiBusState == TWI_BUS_RECEIVE) {
+      TWDR = i2cReadRegister(twiDevice, &twiPointer);
+      TWSR = (control & _BV(TWEA)) ? 0x50 : 0x58;
+      nowMicros += TWI_BYTE_MICROS;
+    }
+    if ((control & _BV(TWIE)) && twiIsr) twiIsr();
+  }
+}
+
+void adcSet(uint8_t pin, int value) {
+  if (pin < NUM_PINS) adcValues[pin] = value;
+}
+
+bool flashAttach(uint8_t csPin, const char *path, uint8_t sizeLog2) {
+  flashDetach();
+  flashSize = 1UL << sizeLog2;
+  flashSizeLog2 = sizeLog2;
+  flashMemory = (uint8_t *)malloc(flashSize);
+  if (!flashMemory) return false;
+  memset(flashMemory, 0xFF, flashSize);
+  flashPath[0] = 0;
+  if (path) {
+    snprintf(flashPath, sizeof(flashPath), "%s", path);
+    FILE *file = fopen(path, "rb");
+    if (file) {
+      size_t length = fread(flashMemory, 1, flashSize, file);
+      (void)length;  // a short file is an image of a smaller part, the rest stays erased
+      fclose(file);
+    }
+  }
+  flashCsPin = csPin;
+  flashSelected = false;
+  flashWriteEnabled = false;
+  flashBusyUntil = 0;
+  return true;
+}
+
+bool eepromAttach(const char *path) {
+  eepromDetach();
+  memset(eepromMemory, 0xFF, sizeof(eepromMemory));
+  eepromPath[0] = 0;
+  if (!path) return true;
+  snprintf(eepromPath, sizeof(eepromPath), "%s", path);
+  FILE *file = fopen(path, "rb");
+  if (file) {
+    size_t length = fread(eepromMemory, 1, sizeof(eepromMemory), file);
+    (void)length;  // a short file leaves the rest erased
+    fclose(file);
+  }
+  return true;
+}
+
+void eepromDetach() {
+  if (eepromPath[0]) {
+    FILE *file = fopen(eepromPath, "wb");
+    if (file) {
+      fwrite(eepromMemory, 1, sizeof(eepromMemory), file);
+      fclose(file);
+    }
+  }
+  eepromPath[0] = 0;
+}
+
+const uint8_t *eepromImage() {
+  return eepromMemory;
+}
+
+unsigned long eepromWrites(uint16_t address) {
+  return address < EEPROM_SIZE ? eepromWriteCount[address] : 0;
+}
+
+void eepromCutPowerAfter(long bytes) {
+  eepromWritesLeft = bytes;
+}
+
+void flashDetach() {
+  if (!flashMemory) return;
+  if (flashPath[0]) {
+    FILE *file = fopen(flashPath, "wb");
+    if (file) {
+      fwrite(flashMemory, 1, flashSize, file);
+      fclose(file);
+    }
+  }
+  free(flashMemory);
+  flashMemory = NULL;
+  flashCsPin = 0xFF;
+}
+
+const uint8_t *flashImage() {
+  return flashMemory;
+}
+
+uint8_t gpioGet(uint8_t pin) {
+  return pin < NUM_PINS ? pinValues[pin] : LOW;
+}
+
+void gpioInterrupt(uint8_t interruptNum) {
+  if (interruptNum < NUM_EXTERNAL_INTERRUPTS && externalInterrupts[interruptNum]) {
+    externalInterrupts[interruptNum]();
+  }
+}
+
+void portTraceStart(portEdge *buffer, size_t size) {
+  portTrace = buffer;
+  portTraceSize = size;
+  portTraceLength = 0;
+}
+
+size_t portTraced() {
+  return portTraceLength;
+}
+
+void serialSetEcho(bool echo) {
+  serialEcho = echo;
+}
+
+unsigned long serialBytesWritten() {
+  return serialBytes;
+}
+
+void serialSetCapture(uint8_t *buffer, size_t size) {
+  serialCapture = buffer;
+  serialCaptureSize = size;
+  serialCaptureLength = 0;
+}
+
+size_t serialCaptured() {
+  return serialCaptureLength;
+}
+
+void reset() {
+  nowMicros = 0;
+  memset(i2cRegisters, 0, sizeof(i2cRegisters));
+  i2cBufferLength = 0;
+  i2cBufferIndex = 0;
+  i2cFailing = false;
+  i2cTransactions = 0;
+  i2cFifoAttached = false;
+  i2cFifoHead = 0;
+  i2cFifoLength = 0;
+  radioHead = 0;
+  radioCount = 0;
+  radioAckLength = 0;
+  radioDataRate = RF24_1MBPS;
+  radioRxReady = false;
+  radioRxMasked = false;
+  radioStrongSignal = true;
+  radioIrqPin = 0xFF;
+  radioIrqIsr = NULL;
+  PINC = 0;
+  memset(adcValues, 0, sizeof(adcValues));
+  memset(pinValues, 0, sizeof(pinValues));
+  memset(externalInterrupts, 0, sizeof(externalInterrupts));
+  serialBytes = 0;
+  flashDetach();
+  eepromDetach();
+  memset(eepromMemory, 0xFF, sizeof(eepromMemory));
+  memset(eepromWriteCount, 0, sizeof(eepromWriteCount));
+  eepromWritesLeft = -1;
+  serialCapture = NULL;
+  serialCaptureLength = 0;
+  portTrace = NULL;
+  portTraceLength = 0;
+  serialTxBusyUntil = 0;
+  TWCR = 0;
+  twiBusState = TWI_BUS_IDLE;
+}
+
+}
+
+// ****************************************************************************************
+//        ARDUINO CORE
+// ****************************************************************************************
+
+volatile uint8_t PORTB, DDRB, PINB;
+volatile uint8_t PINC, PCICR, PCIFR, PCMSK1;
+volatile uint8_t PORTD, DDRD, PIND;
+volatile uint8_t SREG;
+volatile uint8_t TCCR1A, TCCR1B, TIFR1, TIMSK1;
+volatile uint16_t TCNT1, OCR1A, OCR1B, ICR1;
+volatile uint8_t TCCR2A, TCCR2B, TIFR2, TIMSK2, TCNT2, OCR2A, OCR2B;
+volatile uint8_t ADCSRA;
+volatile uint8_t TWBR, TWSR, TWCR, TWDR;
+
+HardwareSerial Serial;
+I2C I2c;
+SPIClass SPI;
+
+unsigned long micros() {
+  return nowMicros;
+}
+
+unsigned long millis() {
+  return nowMicros / 1000;
+}
+
+void delay(unsigned long ms) {
+  nowMicros += ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us) {
+  nowMicros += us;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  (void)pin;
+  (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  if (pin >= NUM_PINS) return;
+  if (pin == flashCsPin && flashMemory) {
+    if (!val && !flashSelected) flashSelect();
+    else if (val && flashSelected) flashDeselect();
+  }
+  pinValues[pin] = val ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin) {
+  return hal::gpioGet(pin);
+}
+
+int analogRead(uint8_t pin) {
+  return pin < NUM_PINS ? adcValues[pin] : 0;
+}
+
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(), int mode) {
+  (void)mode;  // hal::gpioInterrupt stands in for whichever edge was asked for
+  if (interruptNum < NUM_EXTERNAL_INTERRUPTS) externalInterrupts[interruptNum] = userFunc;
+}
+
+void detachInterrupt(uint8_t interruptNum) {
+  if (interruptNum < NUM_EXTERNAL_INTERRUPTS) externalInterrupts[interruptNum] = NULL;
+}
+
+long map(long x, long in_min, long in_max, long out_min, long out_max) {
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+void cli() {
+  SREG &= ~0x80;
+}
+
+void sei() {
+  SREG |= 0x80;
+}
+
+void portDWaveform(const uint8_t *portValues, uint8_t bits, uint8_t high, uint8_t low,
+                   uint8_t bitCycles, uint8_t zeroCycles, uint8_t oneCycles) {
+  unsigned long long start = (unsigned long long)nowMicros * 16;
+  for (uint8_t i = 0; i < bits; i++) {
+    unsigned long long bitStart = start + (unsigned long long)i * bitCycles;
+    portTraceWrite(bitStart, high);
+    portTraceWrite(bitStart + zeroCycles, portValues[i]);
+    portTraceWrite(bitStart + oneCycles, low);
+  }
+  nowMicros += ((unsigned long)bits * bitCycles + 15) / 16;
+}
+
+// ****************************************************************************************
+//        EEPROM
+// ****************************************************************************************
+
+uint8_t eeprom_read_byte(const uint8_t *address) {
+  uintptr_t offset = (uintptr_t)address;
+  return offset < EEPROM_SIZE ? eepromMemory[offset] : 0xFF;
+}
+
+void eeprom_read_block(void *destination, const void *source, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    ((uint8_t *)destination)[i] = eeprom_read_byte((const uint8_t *)source + i);
+  }
+}
+
+// only bytes that differ are programmed, as avr-libc does
+void eeprom_update_byte(uint8_t *address, uint8_t value) {
+  uintptr_t offset = (uintptr_t)address;
+  if (offset >= EEPROM_SIZE || eepromMemory[offset] == value) return;
+  if (eepromWritesLeft == 0) return;  // the power is gone
+  if (eepromWritesLeft > 0) eepromWritesLeft--;
+  eepromMemory[offset] = value;
+  eepromWriteCount[offset]++;
+  nowMicros += EEPROM_WRITE_MICROS;
+}
+
+void eeprom_update_block(const void *source, void *destination, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    eeprom_update_byte((uint8_t *)destination + i, ((const uint8_t *)source)[i]);
+  }
+}
+
+// ****************************************************************************************
+//        SERIAL
+// ****************************************************************************************
+
+void HardwareSerial::begin(unsigned long baud) {
+  serialByteMicros = 10e6 / baud;  // start + 8 data + stop
+  serialTxBusyUntil = 0;
+}
+
+int HardwareSerial::availableForWrite() {
+  return SERIAL_TX_BUFFER_SIZE - 1 - serialTxQueued();
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  if (availableForWrite() <= 0) {  // blocks until the TX interrupt has made room
+    nowMicros = (unsigned long)ceil(serialTxBusyUntil - (SERIAL_TX_BUFFER_SIZE - 2) * serialByteMicros);
+  }
+  double start = serialTxBusyUntil > nowMicros ? serialTxBusyUntil : (double)nowMicros;
+  serialTxBusyUntil = start + serialByteMicros;
+  serialBytes++;
+  if (serialCapture && serialCaptureLength < serialCaptureSize) serialCapture[serialCaptureLength++] = c;
+  if (serialEcho) putchar(c);
+  return 1;
+}
+
+size_t HardwareSerial::print(const char *s) {
+  size_t n = 0;
+  while (*s) n += write((uint8_t)*s++);
+  return n;
+}
+
+size_t HardwareSerial::print(char c) {
+  return write((uint8_t)c);
+}
+
+size_t HardwareSerial::print(int n) {
+  return print((long)n);
+}
+
+size_t HardwareSerial::print(unsigned int n) {
+  return print((unsigned long)n);
+}
+
+size_t HardwareSerial::print(long n) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%ld", n);
+  return print(buf);
+}
+
+size_t HardwareSerial::print(unsigned long n) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%lu", n);
+  return print(buf);
+}
+
+size_t HardwareSerial::print(double n, int digits) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return print(buf);
+}
+
+size_t HardwareSerial::println() {
+  return print("\r\n");
+}
+
+// ****************************************************************************************
+//        I2C
+// ****************************************************************************************
+
+void I2C::begin() {}
+void I2C::end() {}
+void I2C::timeOut(uint16_t timeOut) { (void)timeOut; }
+void I2C::setSpeed(uint8_t fast) { (void)fast; }
+
+// returns 0 on success like the real library
+uint8_t I2C::write(uint8_t address, uint8_t registerAddress, uint8_t data) {
+  i2cTransactions++;
+  if (i2cFailing) return 1;
+  i2cRegisters[address & 0x7F][registerAddress] = data;
+  return 0;
+}
+
+uint8_t I2C::read(uint8_t address, uint8_t registerAddress, uint8_t numberBytes) {
+  i2cTransactions++;
+  i2cBufferIndex = 0;
+  i2cBufferLength = 0;
+  if (i2cFailing) return 1;
+  if (numberBytes > I2C_BUFFER_SIZE) numberBytes = I2C_BUFFER_SIZE;
+  uint8_t pointer = registerAddress;
+  for (uint8_t i = 0; i < numberBytes; i++) {
+    i2cBuffer[i] = i2cReadRegister(address & 0x7F, &pointer);
+  }
+  i2cBufferLength = numberBytes;
+  return 0;
+}
+
+uint8_t I2C::available() {
+  return i2cBufferLength - i2cBufferIndex;
+}
+
+uint8_t I2C::receive() {
+  if (i2cBufferIndex >= i2cBufferLength) return 0;
+  return i2cBuffer[i2cBufferIndex++];
+}
+
+// ****************************************************************************************
+//        SPI
+// ****************************************************************************************
+
+uint8_t SPIClass::transfer(uint8_t data) {
+  nowMicros += 1;  // a byte at 8MHz, so a loop polling the flash status sees time pass
+  if (flashMemory && flashSelected) return flashTransfer(data);
+  return 0xFF;
+}
+
+// ****************************************************************************************
+//        RF24
+// ****************************************************************************************
+
+RF24::RF24(uint16_t cePin, uint16_t csPin) {
+  (void)cePin;
+  (void)csPin;
+}
+
+bool RF24::begin() { return true; }
+void RF24::setPALevel(uint8_t level) { (void)level; }
+void RF24::setRetries(uint8_t delay, uint8_t count) { (void)delay; (void)count; }
+void RF24::enableAckPayload() {}
+void RF24::enableDynamicPayloads() {}
+void RF24::openReadingPipe(uint8_t number, const uint8_t *address) { (void)number; (void)address; }
+void RF24::startListening() {}
+void RF24::stopListening() {}
+bool RF24::testRPD() { return radioStrongSignal; }
+
+bool RF24::setDataRate(rf24_datarate_e speed) {
+  radioDataRate = speed;
+  return true;
+}
+
+rf24_datarate_e RF24::getDataRate() {
+  return radioDataRate;
+}
+
+bool RF24::available() {
+  return radioCount > 0;
+}
+
+bool RF24::available(uint8_t *pipeNum) {
+  if (pipeNum) *pipeNum = 1;
+  return available();
+}
+
+uint8_t RF24::getDynamicPayloadSize() {
+  return radioCount ? radioQueueLength[radioHead] : 0;
+}
+
+void RF24::read(void *buf, uint8_t len) {
+  if (radioCount == 0) return;
+  uint8_t copyLength = len < radioQueueLength[radioHead] ? len : radioQueueLength[radioHead];
+  memcpy(buf, radioQueue[radioHead], copyLength);
+  radioHead = (radioHead + 1) % RADIO_QUEUE_SIZE;
+  radioCount--;
+  radioSetRxReady(false);  // the library clears RX_DR after each read
+}
+
+void RF24::writeAckPayload(uint8_t pipe, const void *buf, uint8_t len) {
+  (void)pipe;
+  if (len > RADIO_PAYLOAD_SIZE) len = RADIO_PAYLOAD_SIZE;
+  memcpy(radioAck, buf, len);
+  radioAckLength = len;
+}
+
+void RF24::maskIRQ(bool tx_ok, bool tx_fail, bool rx_ready) {
+  (void)tx_ok;  // no transmit side here
+  (void)tx_fail;
+  bool ready = radioRxReady;
+  radioSetRxReady(false);
+  radioRxMasked = rx_ready;
+  radioSetRxReady(ready);
+}
+
+uint8_t RF24::flush_rx() {
+  radioHead = 0;
+  radioCount = 0;
+  return 0;
+}
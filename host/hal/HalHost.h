@@ -0,0 +1,90 @@
+// ****************************************************************************************
+// Control side of the host hardware abstraction layer
+//    lets host tools and benchmarks drive the simulated clock, I2C devices, radio and ADC
+//    that the firmware headers see through Arduino.h, I2C.h and RF24.h
+// ****************************************************************************************
+
+#ifndef HOST_HAL_HOST_H
+#define HOST_HAL_HOST_H
+
+#include "Arduino.h"
+
+namespace hal {
+
+// TIME
+// the firmware clock only moves when told to (or through delay()), so runs are repeatable
+void setMicros(unsigned long now);
+void advanceMicros(unsigned long us);
+
+// I2C
+void i2cSetRegisters(uint8_t address, uint8_t firstRegister, const uint8_t *data, uint8_t length);
+void i2cSetRegister16(uint8_t address, uint8_t firstRegister, int16_t value); // big endian, as the sensors use
+uint8_t i2cGetRegister(uint8_t address, uint8_t registerAddress);
+void i2cSetFailing(bool failing);  // reads return no data while set
+unsigned long i2cTransactionCount();
+
+// a FIFO behind one register of a device (e.g. the MPU-6050 FIFO_R_W)
+// reading that register pops bytes instead of auto-incrementing, and the big endian byte
+// count is kept up to date at countRegisterH/countRegisterH+1
+void i2cAttachFifo(uint8_t address, uint8_t dataRegister, uint8_t countRegisterH);
+void i2cFifoPush(const uint8_t *data, uint16_t length);  // bytes beyond the FIFO size are lost
+uint16_t i2cFifoCount();
+
+// TWI peripheral model for interrupt driven I2C (I2cAsync.h)
+// on the host a write to TWCR with TWINT set is a pending bus action; twiService() carries
+// each one out against the same register files, advances the clock by the bus time and
+// calls the attached TWI interrupt handler, until the firmware stops requesting actions
+void twiAttachInterrupt(void (*isr)());
+void twiService();
+
+// SERIAL NOR FLASH (W25Qxx command subset: 9F 05 06 03 02 C7, on the SPI bus)
+// 1 << sizeLog2 bytes, kept in the file at path when it is not NULL (created erased if missing)
+// page programs and erases keep the device busy for their datasheet time in simulated micros
+bool flashAttach(uint8_t csPin, const char *path, uint8_t sizeLog2);
+void flashDetach();  // writes the image back to its file
+const uint8_t *flashImage();
+
+// EEPROM (avr/eeprom.h), erased (0xFF) after reset
+// kept in the file at path when it is not NULL, a raw image as avrdude -U eeprom:r:<file>:r reads it
+bool eepromAttach(const char *path);
+void eepromDetach();  // writes the image back to its file
+const uint8_t *eepromImage();
+unsigned long eepromWrites(uint16_t address);  // byte programs since reset, for wear levelling
+void eepromCutPowerAfter(long bytes);  // later writes are lost, -1 for never (a reset mid-save)
+
+// RADIO
+void radioQueuePacket(const void *data, uint8_t length);
+uint8_t radioPendingPackets();
+uint8_t radioLastAck(void *buf, uint8_t length);
+void radioSetSignal(bool strong);  // what testRPD() reports (the carrier above -64dBm), true after reset
+// the IRQ drives pin (an analog pin, PINC) and calls isr on both edges, as a pin change interrupt
+void radioAttachIrq(uint8_t pin, void (*isr)());
+
+// ADC & GPIO
+void adcSet(uint8_t pin, int value);
+uint8_t gpioGet(uint8_t pin);
+void gpioInterrupt(uint8_t interruptNum);  // calls the handler given to attachInterrupt, if any
+
+// PORTD WAVEFORM
+// bit banged output (portDWaveform) is recorded as the value PORTD takes and the CPU cycle
+// (16MHz, counted from micros() 0) it takes it at, as long as the buffer has room
+struct portEdge {
+  unsigned long long cycle;
+  uint8_t value;
+};
+void portTraceStart(portEdge *buffer, size_t size);
+size_t portTraced();
+
+// SERIAL
+void serialSetEcho(bool echo);  // off by default so benchmarks are not timing stdout
+unsigned long serialBytesWritten();
+// bytes written from now on are also copied to buffer, as long as it has room
+void serialSetCapture(uint8_t *buffer, size_t size);
+size_t serialCaptured();
+
+// reset every simulated peripheral to power-on state
+void reset();
+
+}
+
+#endif
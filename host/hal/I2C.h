@@ -0,0 +1,25 @@
+// ****************************************************************************************
+// Host stand-in for the DSS Circuits I2C master library
+//    each device address is backed by a 256 byte register file (see HalHost.h)
+// ****************************************************************************************
+
+#ifndef HOST_I2C_H
+#define HOST_I2C_H
+
+#include "Arduino.h"
+
+class I2C {
+  public:
+    void begin();
+    void end();
+    void timeOut(uint16_t timeOut);
+    void setSpeed(uint8_t fast);
+    uint8_t write(uint8_t address, uint8_t registerAddress, uint8_t data);
+    uint8_t read(uint8_t address, uint8_t registerAddress, uint8_t numberBytes);
+    uint8_t available();
+    uint8_t receive();
+};
+
+extern I2C I2c;
+
+#endif
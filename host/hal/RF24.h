@@ -0,0 +1,40 @@
+// ****************************************************************************************
+// Host stand-in for the nRF24 RF24 library
+//    packets are queued with hal::radioQueuePacket() and read back by the firmware
+//    ack payloads written by the firmware can be inspected with hal::radioLastAck()
+//    the IRQ pin follows RX_DR as on the real part: low from the first packet queued until a
+//    read clears it, even if more packets are left
+// ****************************************************************************************
+
+#ifndef HOST_RF24_H
+#define HOST_RF24_H
+
+#include "Arduino.h"
+
+typedef enum { RF24_PA_MIN = 0, RF24_PA_LOW, RF24_PA_HIGH, RF24_PA_MAX, RF24_PA_ERROR } rf24_pa_dbm_e;
+typedef enum { RF24_1MBPS = 0, RF24_2MBPS, RF24_250KBPS } rf24_datarate_e;
+
+class RF24 {
+  public:
+    RF24(uint16_t cePin, uint16_t csPin);
+    bool begin();
+    void setPALevel(uint8_t level);
+    bool setDataRate(rf24_datarate_e speed);
+    rf24_datarate_e getDataRate();
+    void setRetries(uint8_t delay, uint8_t count);
+    void enableAckPayload();
+    void enableDynamicPayloads();
+    void maskIRQ(bool tx_ok, bool tx_fail, bool rx_ready);
+    void openReadingPipe(uint8_t number, const uint8_t *address);
+    void startListening();
+    void stopListening();
+    bool available();
+    bool available(uint8_t *pipeNum);
+    uint8_t getDynamicPayloadSize();
+    void read(void *buf, uint8_t len);
+    void writeAckPayload(uint8_t pipe, const void *buf, uint8_t len);
+    uint8_t flush_rx();
+    bool testRPD();
+};
+
+#endif
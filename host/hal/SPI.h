@@ -0,0 +1,38 @@
+// ****************************************************************************************
+// Host stand-in for the Arduino SPI library
+//    the radio is modelled at the RF24 level so nothing of it is clocked out here
+//    bytes transferred while the chip select given to hal::flashAttach() is low go to the
+//    simulated serial NOR flash, anything else reads back as 0xFF
+// ****************************************************************************************
+
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+#include "Arduino.h"
+
+#define MSBFIRST 1
+#define LSBFIRST 0
+#define SPI_MODE0 0x00
+
+class SPISettings {
+  public:
+    SPISettings() {}
+    SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) {
+      (void)clock;
+      (void)bitOrder;
+      (void)dataMode;
+    }
+};
+
+class SPIClass {
+  public:
+    void begin() {}
+    void end() {}
+    void beginTransaction(SPISettings settings) { (void)settings; }
+    void endTransaction() {}
+    uint8_t transfer(uint8_t data);
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,20 @@
+// ****************************************************************************************
+// Host stand-in for the avr-libc EEPROM functions
+//    1KB as on the ATmega328P, kept by HalHost (optionally in a file, see hal::eepromAttach)
+//    every byte that actually changes costs the 3.4ms programming time in simulated micros
+// ****************************************************************************************
+
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define E2END 0x3FF
+
+uint8_t eeprom_read_byte(const uint8_t *address);
+void eeprom_read_block(void *destination, const void *source, size_t length);
+void eeprom_update_byte(uint8_t *address, uint8_t value);
+void eeprom_update_block(const void *source, void *destination, size_t length);
+
+#endif
@@ -0,0 +1,19 @@
+// ****************************************************************************************
+// Host stand-in for avr-libc program memory access
+//    flash and RAM share one address space on the host
+// ****************************************************************************************
+
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte_near(address) (*(const uint8_t *)(address))
+#define pgm_read_word_near(address) (*(const uint16_t *)(address))
+#define pgm_read_dword_near(address) (*(const uint32_t *)(address))
+#define pgm_read_byte(address) pgm_read_byte_near(address)
+#define pgm_read_word(address) pgm_read_word_near(address)
+#define pgm_read_dword(address) pgm_read_dword_near(address)
+
+#endif
@@ -0,0 +1,271 @@
+// ****************************************************************************************
+// Cycle accurate benchmark of the real ATmega328P image under simavr
+//    the image must be built with -DCYCLE_BENCH so the stage markers in CycleMarkers.h are live
+//    usage: quadcopter_cyclebench <image.elf> <cycle_budget.txt> [--write-budget]
+//    exits non-zero if any stage's worst case exceeds its budget
+// ****************************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_core.h"
+
+#include "SimParts.h"
+
+const uint32_t CPU_FREQUENCY = 16000000;
+const avr_io_addr_t GPIOR0_DATA_ADDRESS = 0x3E;  // I/O 0x1E + 0x20
+const uint8_t STAGE_END_FLAG = 0x80;
+const uint8_t NUM_STAGES = 6;  // index 0 unused, matches CycleMarkers.h
+const uint8_t MAX_NESTING = 4;
+const uint8_t BUDGET_MARGIN_PERCENT = 10;  // headroom added by --write-budget
+
+// simulated flight script, in seconds of simulated time
+const double ARM_STICK_UP_UNTIL = 5.0;    // long enough to cover the boot calibration
+const double ARM_STICK_DOWN_UNTIL = 6.0;
+const double SIMULATION_END = 10.0;
+const double PACKET_INTERVAL = 0.02;
+
+// sensor addresses (must agree with MotionSensor.h)
+const uint8_t MPU_ADDRESS = 0x68;
+const uint8_t MAG_ADDRESS = 0x1E;
+
+struct StageStats {
+  const char *name;
+  unsigned long samples;
+  uint64_t total;
+  uint64_t min;
+  uint64_t max;
+  uint64_t budget;
+  bool hasBudget;
+};
+
+struct OpenStage {
+  uint8_t stage;
+  uint64_t start;
+  uint64_t nested;  // cycles spent in nested marked stages (i.e. the ESC ISR) to exclude
+};
+
+static StageStats stats[NUM_STAGES] = {
+  {"", 0, 0, 0, 0, 0, false},
+  {"gyro", 0, 0, 0, 0, 0, false},
+  {"main", 0, 0, 0, 0, 0, false},
+  {"mag_fusion", 0, 0, 0, 0, 0, false},
+  {"esc_isr", 0, 0, 0, 0, 0, false},
+  {"rate", 0, 0, 0, 0, 0, false},
+};
+
+static OpenStage openStages[MAX_NESTING];
+static uint8_t openDepth = 0;
+static unsigned long markerErrors = 0;
+
+// ****************************************************************************************
+//        STAGE MARKERS
+// ****************************************************************************************
+
+static void recordStage(uint8_t stage, uint64_t cycles) {
+  StageStats *s = &stats[stage];
+  if (s->samples == 0 || cycles < s->min) s->min = cycles;
+  if (cycles > s->max) s->max = cycles;
+  s->total += cycles;
+  s->samples++;
+}
+
+static void markerWrite(avr_t *avr, avr_io_addr_t addr, uint8_t value, void *param) {
+  (void)param;
+  avr->data[addr] = value;
+  uint8_t stage = value & ~STAGE_END_FLAG;
+  if (stage == 0 || stage >= NUM_STAGES) {
+    markerErrors++;
+    return;
+  }
+  if (!(value & STAGE_END_FLAG)) {
+    if (openDepth == MAX_NESTING) {
+      markerErrors++;
+      openDepth = 0;
+      return;
+    }
+    openStages[openDepth].stage = stage;
+    openStages[openDepth].start = avr->cycle;
+    openStages[openDepth].nested = 0;
+    openDepth++;
+    return;
+  }
+  if (openDepth == 0 || openStages[openDepth - 1].stage != stage) {
+    markerErrors++;
+    openDepth = 0;
+    return;
+  }
+  openDepth--;
+  uint64_t elapsed = avr->cycle - openStages[openDepth].start;
+  recordStage(stage, elapsed - openStages[openDepth].nested);
+  if (openDepth > 0) openStages[openDepth - 1].nested += elapsed;
+}
+
+// ****************************************************************************************
+//        BUDGET FILE
+// ****************************************************************************************
+
+static bool readBudget(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) return false;
+  char line[128];
+  while (fgets(line, sizeof(line), file)) {
+    char name[64];
+    unsigned long long budget;
+    if (line[0] == '#') continue;
+    if (sscanf(line, "%63s %llu", name, &budget) != 2) continue;
+    for (uint8_t i = 1; i < NUM_STAGES; i++) {
+      if (strcmp(name, stats[i].name) == 0) {
+        stats[i].budget = budget;
+        stats[i].hasBudget = true;
+      }
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+static bool writeBudget(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file) return false;
+  fprintf(file, "# worst case cycles per stage on the ATmega328P @ 16MHz, measured under simavr\n");
+  fprintf(file, "# regenerate with: quadcopter_cyclebench <image.elf> <this file> --write-budget\n");
+  fprintf(file, "# stage        max_cycles\n");
+  for (uint8_t i = 1; i < NUM_STAGES; i++) {
+    uint64_t budget = stats[i].max + (stats[i].max * BUDGET_MARGIN_PERCENT) / 100;
+    fprintf(file, "%-14s %llu\n", stats[i].name, (unsigned long long)budget);
+  }
+  fclose(file);
+  return true;
+}
+
+// ****************************************************************************************
+//        SIMULATED INPUTS
+// ****************************************************************************************
+
+static void setupSensors(TwiRegisterDevice *mpu, TwiRegisterDevice *mag) {
+  mpu->registers[117] = MPU_ADDRESS;    // WHO_AM_I
+  twiDeviceSet16(mpu, 59, 0);           // ACCEL_X
+  twiDeviceSet16(mpu, 61, 0);           // ACCEL_Y
+  twiDeviceSet16(mpu, 63, 4096);        // ACCEL_Z, 1g at +/-8g
+  twiDeviceSet16(mpu, 65, -1500);       // TEMP
+  twiDeviceSet16(mpu, 67, 12);          // GYRO_X
+  twiDeviceSet16(mpu, 69, -7);          // GYRO_Y
+  twiDeviceSet16(mpu, 71, 3);           // GYRO_Z
+  twiDeviceSet16(mag, 3, 200);          // X
+  twiDeviceSet16(mag, 5, -400);         // Z
+  twiDeviceSet16(mag, 7, 50);           // Y
+}
+
+// same packet layout and CRC-8 as RadioLink.h (version 2), so the CRC is inside the budget
+static void sendControlPacket(Nrf24Device *radio, uint8_t throttle, uint8_t control, uint8_t alive) {
+  uint8_t packet[9] = {2, alive, throttle, 127, 127, 127, control, 0, 0};
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < 8; i++) {
+    crc ^= packet[i];
+    for (uint8_t bit = 0; bit < 8; bit++) crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+  packet[8] = crc;
+  nrf24Receive(radio, packet, sizeof(packet));
+}
+
+// ****************************************************************************************
+//        MAIN
+// ****************************************************************************************
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <image.elf> <cycle_budget.txt> [--write-budget]\n", argv[0]);
+    return 2;
+  }
+  bool updateBudget = (argc > 3 && strcmp(argv[3], "--write-budget") == 0);
+
+  elf_firmware_t firmware;
+  memset(&firmware, 0, sizeof(firmware));
+  if (elf_read_firmware(argv[1], &firmware) != 0) {
+    fprintf(stderr, "cannot read %s\n", argv[1]);
+    return 2;
+  }
+  avr_t *avr = avr_make_mcu_by_name("atmega328p");
+  if (!avr) {
+    fprintf(stderr, "simavr has no atmega328p core\n");
+    return 2;
+  }
+  avr_init(avr);
+  firmware.frequency = CPU_FREQUENCY;
+  avr_load_firmware(avr, &firmware);
+
+  TwiRegisterDevice mpu, mag;
+  Nrf24Device radio;
+  twiDeviceInit(avr, &mpu, MPU_ADDRESS);
+  twiDeviceInit(avr, &mag, MAG_ADDRESS);
+#ifdef ESC_HARDWARE_PWM  // the image was built with it (CMakeLists.txt reads Parameters.h)
+  nrf24Init(avr, &radio, 'D', 5);  // CSN on pin 5, 10 is a timer output
+#else
+  nrf24Init(avr, &radio, 'B', 2);  // CSN on pin 10
+#endif
+  setupSensors(&mpu, &mag);
+  avr_register_io_write(avr, GPIOR0_DATA_ADDRESS, markerWrite, NULL);
+
+  uint64_t packetInterval = (uint64_t)(PACKET_INTERVAL * CPU_FREQUENCY);
+  uint64_t nextPacket = packetInterval;
+  uint64_t endCycle = (uint64_t)(SIMULATION_END * CPU_FREQUENCY);
+  uint8_t alive = 0;
+  int state = cpu_Running;
+  while (state != cpu_Done && state != cpu_Crashed && avr->cycle < endCycle) {
+    state = avr_run(avr);
+    if (avr->cycle >= nextPacket) {
+      nextPacket += packetInterval;
+      double seconds = (double)avr->cycle / CPU_FREQUENCY;
+      if (seconds < ARM_STICK_UP_UNTIL) sendControlPacket(&radio, 255, 0, alive++);
+      else if (seconds < ARM_STICK_DOWN_UNTIL) sendControlPacket(&radio, 0, 0, alive++);
+      else sendControlPacket(&radio, 128, 0b00000100, alive++);  // flying in attitude mode so every PID runs
+    }
+  }
+  if (state == cpu_Crashed) {
+    fprintf(stderr, "simulated CPU crashed at cycle %llu\n", (unsigned long long)avr->cycle);
+    return 2;
+  }
+
+  if (updateBudget) {
+    if (!writeBudget(argv[2])) {
+      fprintf(stderr, "cannot write %s\n", argv[2]);
+      return 2;
+    }
+    printf("budget written to %s\n", argv[2]);
+  }
+  if (!readBudget(argv[2])) {
+    fprintf(stderr, "cannot read %s\n", argv[2]);
+    return 2;
+  }
+
+  int result = 0;
+  printf("%-14s %8s %10s %10s %10s %10s  %s\n", "stage", "samples", "min", "mean", "max", "budget", "status");
+  for (uint8_t i = 1; i < NUM_STAGES; i++) {
+    StageStats *s = &stats[i];
+    const char *status = "ok";
+    if (s->samples == 0) {
+      status = "NOT REACHED";
+      result = 1;
+    }
+    else if (!s->hasBudget) {
+      status = "no budget";
+    }
+    else if (s->max > s->budget) {
+      status = "OVER BUDGET";
+      result = 1;
+    }
+    printf("%-14s %8lu %10llu %10llu %10llu %10llu  %s\n", s->name, s->samples,
+           (unsigned long long)s->min,
+           (unsigned long long)(s->samples ? s->total / s->samples : 0),
+           (unsigned long long)s->max, (unsigned long long)s->budget, status);
+  }
+  if (markerErrors) {
+    printf("%lu unbalanced stage markers\n", markerErrors);
+    result = 1;
+  }
+  return result;
+}
@@ -0,0 +1,162 @@
+// ****************************************************************************************
+// Peripheral models for the cycle benchmark
+// ****************************************************************************************
+
+#include "SimParts.h"
+
+#include <string.h>
+
+#include "avr_twi.h"
+#include "avr_spi.h"
+#include "avr_ioport.h"
+
+// ****************************************************************************************
+//        TWI REGISTER DEVICE
+// ****************************************************************************************
+
+static const char *twiIrqNames[2] = {"8<twi.sensor.in", "32>twi.sensor.out"};
+
+static void twiDeviceHook(avr_irq_t *irq, uint32_t value, void *param) {
+  (void)irq;
+  TwiRegisterDevice *device = (TwiRegisterDevice *)param;
+  avr_twi_msg_irq_t msg;
+  msg.u.v = value;
+
+  if (msg.u.twi.msg & TWI_COND_STOP) {
+    device->selected = false;
+  }
+  if (msg.u.twi.msg & TWI_COND_START) {
+    device->selected = false;
+    device->bytesSinceStart = 0;
+    if ((msg.u.twi.addr >> 1) == device->address) {
+      device->selected = true;
+      avr_raise_irq(device->irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, msg.u.twi.addr, 1));
+    }
+  }
+  if (!device->selected) return;
+
+  if (msg.u.twi.msg & TWI_COND_WRITE) {
+    avr_raise_irq(device->irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, msg.u.twi.addr, 1));
+    if (device->bytesSinceStart == 0) {
+      device->registerPointer = msg.u.twi.data;  // first byte selects the register
+    }
+    else {
+      device->registers[device->registerPointer++] = msg.u.twi.data;
+    }
+    device->bytesSinceStart++;
+  }
+  if (msg.u.twi.msg & TWI_COND_READ) {
+    uint8_t data = device->registers[device->registerPointer++];
+    avr_raise_irq(device->irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_READ, msg.u.twi.addr, data));
+  }
+}
+
+void twiDeviceInit(avr_t *avr, TwiRegisterDevice *device, uint8_t address) {
+  memset(device, 0, sizeof(*device));
+  device->address = address;
+  device->irq = avr_alloc_irq(&avr->irq_pool, 0, 2, twiIrqNames);
+  avr_irq_register_notify(device->irq + TWI_IRQ_OUTPUT, twiDeviceHook, device);
+  avr_connect_irq(device->irq + TWI_IRQ_INPUT, avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT));
+  avr_connect_irq(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT), device->irq + TWI_IRQ_OUTPUT);
+}
+
+void twiDeviceSet16(TwiRegisterDevice *device, uint8_t firstRegister, int16_t value) {
+  device->registers[firstRegister] = (uint8_t)((uint16_t)value >> 8);
+  device->registers[(uint8_t)(firstRegister + 1)] = (uint8_t)value;
+}
+
+// ****************************************************************************************
+//        NRF24L01+
+// ****************************************************************************************
+
+const uint8_t NRF_STATUS = 0x07;
+const uint8_t NRF_FIFO_STATUS = 0x17;
+const uint8_t NRF_R_REGISTER = 0x00;
+const uint8_t NRF_W_REGISTER = 0x20;
+const uint8_t NRF_R_RX_PL_WID = 0x60;
+const uint8_t NRF_R_RX_PAYLOAD = 0x61;
+const uint8_t NRF_FLUSH_RX = 0xE2;
+const uint8_t NRF_RX_FIFO_DEPTH = 3;
+
+static uint8_t nrf24Status(Nrf24Device *device) {
+  uint8_t status = device->registers[NRF_STATUS][0] & 0x31;  // TX flags as last written
+  if (device->rxFifo.empty()) status |= 0x0E;   // RX_P_NO = 111, fifo empty
+  else status |= 0x40 | (1 << 1);               // RX_DR, data on pipe 1
+  return status;
+}
+
+static uint8_t nrf24ReadRegister(Nrf24Device *device, uint8_t reg, uint8_t byteIndex) {
+  if (reg == NRF_STATUS) return nrf24Status(device);
+  if (reg == NRF_FIFO_STATUS) return 0x10 | (device->rxFifo.empty() ? 0x01 : 0x00);  // TX_EMPTY | RX_EMPTY
+  return device->registers[reg][byteIndex < 5 ? byteIndex : 4];
+}
+
+static void nrf24SpiHook(avr_irq_t *irq, uint32_t value, void *param) {
+  (void)irq;
+  Nrf24Device *device = (Nrf24Device *)param;
+  if (!device->selected) return;
+  uint8_t in = (uint8_t)value;
+  uint8_t reply = 0;
+
+  if (device->index == 0) {
+    device->command = in;
+    reply = nrf24Status(device);
+    if (in == NRF_FLUSH_RX) device->rxFifo.clear();
+    if (in == NRF_R_RX_PAYLOAD) device->popOnDeselect = true;
+  }
+  else {
+    uint8_t byteIndex = device->index - 1;
+    uint8_t command = device->command;
+    if (command < NRF_W_REGISTER) {
+      reply = nrf24ReadRegister(device, command & 0x1F, byteIndex);
+    }
+    else if (command < NRF_W_REGISTER + 0x20) {
+      if (byteIndex < 5) device->registers[command & 0x1F][byteIndex] = in;
+    }
+    else if (command == NRF_R_RX_PL_WID) {
+      reply = device->rxFifo.empty() ? 0 : (uint8_t)device->rxFifo.front().size();
+    }
+    else if (command == NRF_R_RX_PAYLOAD) {
+      if (!device->rxFifo.empty() && byteIndex < device->rxFifo.front().size()) reply = device->rxFifo.front()[byteIndex];
+    }
+  }
+  device->index++;
+  avr_raise_irq(device->spiInput, reply);
+}
+
+static void nrf24CsnHook(avr_irq_t *irq, uint32_t value, void *param) {
+  (void)irq;
+  Nrf24Device *device = (Nrf24Device *)param;
+  bool selected = (value == 0);  // active low
+  if (device->selected && !selected && device->popOnDeselect && !device->rxFifo.empty()) {
+    device->rxFifo.pop_front();
+  }
+  device->selected = selected;
+  device->index = 0;
+  device->popOnDeselect = false;
+}
+
+void nrf24Init(avr_t *avr, Nrf24Device *device, char csnPort, uint8_t csnPin) {
+  memset(device->registers, 0, sizeof(device->registers));
+  device->rxFifo.clear();
+  device->selected = false;
+  device->command = 0;
+  device->index = 0;
+  device->popOnDeselect = false;
+  // datasheet reset values for the registers the RF24 library reads back
+  device->registers[0x00][0] = 0x08;  // CONFIG
+  device->registers[0x01][0] = 0x3F;  // EN_AA
+  device->registers[0x02][0] = 0x03;  // EN_RXADDR
+  device->registers[0x03][0] = 0x03;  // SETUP_AW
+  device->registers[0x04][0] = 0x03;  // SETUP_RETR
+  device->registers[0x05][0] = 0x02;  // RF_CH
+  device->registers[0x06][0] = 0x0E;  // RF_SETUP
+  device->spiInput = avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_INPUT);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_OUTPUT), nrf24SpiHook, device);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(csnPort), csnPin), nrf24CsnHook, device);
+}
+
+void nrf24Receive(Nrf24Device *device, const uint8_t *payload, uint8_t length) {
+  if (device->rxFifo.size() >= NRF_RX_FIFO_DEPTH) return;  // fifo full, packet lost as on the real chip
+  device->rxFifo.push_back(std::vector<uint8_t>(payload, payload + length));
+}
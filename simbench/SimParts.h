@@ -0,0 +1,44 @@
+// ****************************************************************************************
+// Peripheral models attached to the simulated ATmega328P for the cycle benchmark
+//    MPU-6050 and HMC5883L as TWI slaves with a plain register file
+//    nRF24L01+ on SPI with a scripted stream of control packets
+// ****************************************************************************************
+
+#ifndef SIMBENCH_SIM_PARTS_H
+#define SIMBENCH_SIM_PARTS_H
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+#include "sim_avr.h"
+#include "sim_irq.h"
+
+// I2C device with auto-incrementing register pointer, as both sensors behave
+struct TwiRegisterDevice {
+  uint8_t address;        // 7 bit
+  uint8_t registers[256];
+  uint8_t registerPointer;
+  uint8_t bytesSinceStart;
+  bool selected;
+  avr_irq_t *irq;
+};
+
+void twiDeviceInit(avr_t *avr, TwiRegisterDevice *device, uint8_t address);
+void twiDeviceSet16(TwiRegisterDevice *device, uint8_t firstRegister, int16_t value);
+
+// nRF24L01+ seen from the MCU side of the SPI bus
+struct Nrf24Device {
+  uint8_t registers[32][5];
+  std::deque<std::vector<uint8_t> > rxFifo;
+  bool selected;
+  uint8_t command;
+  uint8_t index;
+  bool popOnDeselect;
+  avr_irq_t *spiInput;
+};
+
+void nrf24Init(avr_t *avr, Nrf24Device *device, char csnPort, uint8_t csnPin);
+void nrf24Receive(Nrf24Device *device, const uint8_t *payload, uint8_t length);
+
+#endif
@@ -0,0 +1,36 @@
+// ****************************************************************************************
+// Blackbox flash image to CSV
+//    blackbox_decode flash.img > flights.csv
+//    the image is a raw dump of the serial flash, or the file given to hal::flashAttach
+//    (quadcopter_bench --blackbox <file> leaves one behind)
+// ****************************************************************************************
+
+#include "QuadcopterFirmware.h"
+#include "BlackboxDecoder.h"
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <flash image>\n", argv[0]);
+    return 2;
+  }
+  FILE *file = fopen(argv[1], "rb");
+  if (!file) {
+    fprintf(stderr, "cannot open %s\n", argv[1]);
+    return 2;
+  }
+  std::vector<uint8_t> image;
+  uint8_t buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) image.insert(image.end(), buffer, buffer + n);
+  fclose(file);
+
+  BlackboxDecoder decoder;
+  decoder.load(image.data(), image.size());
+  BlackboxRecord record;
+  blackboxPrintCsvHeader(stdout);
+  while (decoder.next(&record)) blackboxPrintCsv(stdout, &record);
+  fprintf(stderr, "%zu logs (%lu cut short), %lu intra + %lu predicted frames, %lu skipped, %zu bytes%s\n",
+          decoder.logs.size(), decoder.truncatedLogs, decoder.intraFrames, decoder.predictedFrames,
+          decoder.skippedFrames, decoder.bytes(), decoder.corrupt ? ", stopped at corrupt data" : "");
+  return decoder.corrupt ? 1 : 0;
+}
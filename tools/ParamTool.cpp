@@ -0,0 +1,132 @@
+// ****************************************************************************************
+// Shows and edits the parameter store (ParamStore.h) in an EEPROM image
+//    avrdude -p m328p -c arduino -P /dev/ttyUSB0 -U eeprom:r:eeprom.bin:r
+//    param_tool eeprom.bin                          prints every parameter
+//    param_tool eeprom.bin rate.roll.kp=1.4 ...     changes some and saves a new record
+//    param_tool eeprom.bin defaults                 saves the compiled values (applied in argument order)
+//    param_tool eeprom.bin recalibrate              drops the last calibration, the next boot calibrates
+//    avrdude ... -U eeprom:w:eeprom.bin:r
+//    the file is created erased if it does not exist
+// ****************************************************************************************
+
+#include "QuadcopterFirmware.h"
+#include "HalHost.h"
+
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+struct paramName {
+  const char *name;
+  float *value;
+  int16_t *value16;
+  int *valueInt;
+};
+
+const char *axisNames[NUM_AXES] = {"roll", "pitch", "yaw"};
+const char *gainNames[3] = {"kp", "ki", "kd"};
+const char *offsetNames[6] = {"ax", "ay", "az", "gx", "gy", "gz"};
+
+std::vector<paramName> paramNames;
+std::vector<std::string> nameStore;
+
+void addName(const std::string &name, float *value, int16_t *value16, int *valueInt) {
+  nameStore.push_back(name);
+  paramName entry = {NULL, value, value16, valueInt};
+  paramNames.push_back(entry);
+}
+
+void buildNames() {
+  nameStore.reserve(64);
+  for (byte axis = 0; axis < NUM_AXES; axis++) {
+    for (byte gain = 0; gain < 3; gain++) {
+      addName(std::string("rate.") + axisNames[axis] + "." + gainNames[gain], &rateGains[axis][gain], NULL, NULL);
+    }
+  }
+  for (byte axis = 0; axis < NUM_AXES; axis++) {
+    for (byte gain = 0; gain < 3; gain++) {
+      addName(std::string("attitude.") + axisNames[axis] + "." + gainNames[gain], &attitudeGains[axis][gain], NULL, NULL);
+    }
+  }
+  for (byte i = 0; i < 6; i++) {
+    addName(std::string("offset.scale.") + offsetNames[i], &offsetScale[i], NULL, NULL);
+    addName(std::string("offset.intercept.") + offsetNames[i], &offsetIntercept[i], NULL, NULL);
+  }
+  addName("offset.angle.roll", &offsetAngle[0], NULL, NULL);
+  addName("offset.angle.pitch", &offsetAngle[1], NULL, NULL);
+  addName("offset.angle.yaw", &offsetAngle[2], NULL, NULL);
+  addName("mag.offset.x", NULL, NULL, &mxo);
+  addName("mag.offset.y", NULL, NULL, &myo);
+  addName("calibration.temperature", NULL, &calibratedTemperature, NULL);
+  for (byte i = 0; i < 6; i++) {
+    addName(std::string("calibration.") + offsetNames[i], NULL, &calibratedOffsets[i], NULL);
+  }
+  for (size_t i = 0; i < paramNames.size(); i++) paramNames[i].name = nameStore[i].c_str();
+}
+
+paramName *findName(const char *name) {
+  for (size_t i = 0; i < paramNames.size(); i++) {
+    if (strcmp(paramNames[i].name, name) == 0) return &paramNames[i];
+  }
+  return NULL;
+}
+
+void printParams() {
+  for (size_t i = 0; i < paramNames.size(); i++) {
+    const paramName &entry = paramNames[i];
+    if (entry.value) printf("%s=%.9g\n", entry.name, *entry.value);
+    else if (entry.value16) printf("%s=%d\n", entry.name, *entry.value16);
+    else printf("%s=%d\n", entry.name, *entry.valueInt);
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <eeprom image> [name=value ... | defaults | recalibrate]\n", argv[0]);
+    return 2;
+  }
+  buildNames();
+  hal::eepromAttach(argv[1]);
+  paramSet compiled;
+  gatherParams(&compiled);
+  bool loaded = loadParams();
+  if (argc == 2) {
+    if (loaded) fprintf(stderr, "record %u in slot %u of %u\n", paramSequence, paramSlot, PARAM_SLOTS);
+    else fprintf(stderr, "no valid record (version %u), these are the compiled defaults\n", PARAM_STORE_VERSION);
+    printParams();
+    hal::eepromDetach();
+    return 0;
+  }
+  for (int arg = 2; arg < argc; arg++) {
+    if (strcmp(argv[arg], "defaults") == 0) {
+      scatterParams(&compiled);
+      continue;
+    }
+    if (strcmp(argv[arg], "recalibrate") == 0) {
+      calibratedTemperature = NO_CALIBRATION;
+      continue;
+    }
+    char name[64];
+    const char *equals = strchr(argv[arg], '=');
+    if (!equals || equals - argv[arg] >= (long)sizeof(name)) {
+      fprintf(stderr, "expected name=value, got %s\n", argv[arg]);
+      return 2;
+    }
+    memcpy(name, argv[arg], equals - argv[arg]);
+    name[equals - argv[arg]] = 0;
+    paramName *entry = findName(name);
+    char *end;
+    double value = strtod(equals + 1, &end);
+    if (!entry || *end || end == equals + 1) {
+      fprintf(stderr, "%s %s, run without changes for the list\n", entry ? "bad value for" : "unknown parameter", name);
+      return 2;
+    }
+    if (entry->value) *entry->value = (float)value;
+    else if (entry->value16) *entry->value16 = (int16_t)value;
+    else *entry->valueInt = (int)value;
+  }
+  saveParams();
+  fprintf(stderr, "saved record %u in slot %u\n", paramSequence, paramSlot);
+  hal::eepromDetach();
+  return 0;
+}
@@ -0,0 +1,21 @@
+// ****************************************************************************************
+// Telemetry stream to CSV
+//    telemetry_decode < capture.bin > flight.csv
+//    or live: stty -F /dev/ttyUSB0 1000000 raw && telemetry_decode < /dev/ttyUSB0
+//    frame counts and errors go to stderr at the end
+// ****************************************************************************************
+
+#include "QuadcopterFirmware.h"
+#include "TelemetryDecoder.h"
+
+int main() {
+  TelemetryDecoder decoder;
+  telemetryRecord record;
+  telemetryPrintCsvHeader(stdout);
+  int c;
+  while ((c = getchar()) != EOF) {
+    if (decoder.push((uint8_t)c, &record)) telemetryPrintCsv(stdout, &record);
+  }
+  fprintf(stderr, "%lu records, %lu bad frames\n", decoder.frames, decoder.badFrames);
+  return 0;
+}